@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "pkg/result.hpp"
+#include "pkg/sha256.hpp"
+
+namespace pkg {
+
+enum class ArchiveCodec {
+  kUnknown = 0,  // not enough bytes seen yet
+  kTar,          // uncompressed
+  kGzip,
+  kXz,
+  kBzip2,
+  kZstd,
+};
+
+struct ExtractOptions {
+  // Leading path components dropped from every entry, as tar's
+  // --strip-components.
+  int strip_components = 0;
+  // When set, the compressed input is hashed as it is decoded and finish()
+  // fails with kConflict on a mismatch.
+  std::string expected_sha256;
+  // Receives the output of `tar` when extractFile() has to fall back to it.
+  std::filesystem::path log_path;
+};
+
+struct ExtractStats {
+  std::uint64_t input_bytes = 0;
+  std::uint64_t entries = 0;
+  std::uint64_t bytes_written = 0;
+};
+
+// Streaming tar extractor for plain, gzip, xz, bzip2 and zstd archives.
+// Compressed bytes are pushed in with write() in chunks of any size, so an
+// archive can be unpacked straight from a download without touching disk
+// twice. The codec is sniffed from the leading magic bytes.
+//
+// Regular files, directories, symlinks and hard links are created with their
+// archived permission bits and mtimes. Absolute paths have their leading
+// "/" stripped, as GNU tar does, and are unpacked under the destination.
+// Entries that would still land outside it ("..", or a path through a
+// symlink) are rejected. Device nodes and FIFOs are skipped.
+class ArchiveExtractor {
+ public:
+  ArchiveExtractor(std::filesystem::path dest, ExtractOptions options);
+  ~ArchiveExtractor();
+
+  ArchiveExtractor(const ArchiveExtractor&) = delete;
+  ArchiveExtractor& operator=(const ArchiveExtractor&) = delete;
+
+  // Decodes and unpacks the next chunk of the archive. Fails with
+  // kNotFound if the archive uses a codec this build cannot decode.
+  Status write(std::string_view chunk);
+  // Flushes outstanding data, applies directory modes and checks that the
+  // archive and the checksum are complete.
+  Status finish();
+
+  ArchiveCodec codec() const noexcept { return codec_; }
+  const ExtractStats& stats() const noexcept { return stats_; }
+
+  // Unpacks a file in one read pass. Codecs without a built-in decoder are
+  // handed to `tar -xf` instead, with the checksum verified separately.
+  static Result<ExtractStats> extractFile(const std::filesystem::path& archive,
+                                          const std::filesystem::path& dest,
+                                          const ExtractOptions& options);
+  static ArchiveCodec detect(std::string_view head);
+  static bool builtIn(ArchiveCodec codec);
+  static const char* codecName(ArchiveCodec codec);
+
+ private:
+  struct Pipeline;
+
+  Status start();
+
+  std::filesystem::path dest_;
+  ExtractOptions options_;
+  ArchiveCodec codec_ = ArchiveCodec::kUnknown;
+  std::string head_;
+  Sha256 hasher_;
+  ExtractStats stats_;
+  std::unique_ptr<Pipeline> pipeline_;
+};
+
+}  // namespace pkg
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace pkg {
+
+// Bump allocator. Allocations are carved out of malloc'd chunks, each
+// twice the size of the one before, and are only released together by
+// reset() or the destructor, so thousands of small objects cost a handful
+// of malloc calls. Not thread-safe; use one arena per thread.
+class Arena {
+ public:
+  static constexpr std::size_t kDefaultChunkSize = 4096;
+
+  explicit Arena(std::size_t first_chunk_size = kDefaultChunkSize);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Returns nullptr only if the system is out of memory.
+  void* allocate(std::size_t size,
+                 std::size_t align = alignof(std::max_align_t));
+  // Resizes a block returned by allocate(). The most recent allocation
+  // grows in place when its chunk has room; otherwise the contents are
+  // copied to a new block and the old one is abandoned.
+  void* reallocate(void* ptr,
+                   std::size_t old_size,
+                   std::size_t new_size,
+                   std::size_t align = alignof(std::max_align_t));
+  // Copies `s` into the arena.
+  std::string_view copy(std::string_view s);
+
+  // Frees every chunk but the first, which is kept for reuse.
+  void reset();
+
+  std::size_t chunkCount() const noexcept { return chunks_; }
+  std::size_t bytesAllocated() const noexcept { return reserved_; }
+
+ private:
+  struct Chunk;
+  bool grow(std::size_t min_size, std::size_t align);
+
+  Chunk* head_ = nullptr;
+  char* cursor_ = nullptr;
+  char* end_ = nullptr;
+  // Start of the most recent allocation, for in-place growth.
+  char* last_ = nullptr;
+  std::size_t next_size_;
+  std::size_t chunks_ = 0;
+  std::size_t reserved_ = 0;
+};
+
+}  // namespace pkg
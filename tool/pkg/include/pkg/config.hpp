@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
 #include <vector>
@@ -22,16 +23,52 @@ struct ResolverConfig {
   std::string strategy = "strict";
 };
 
+struct FetchConfig {
+  std::string user_agent = "npkg/0.1";
+  int parallel = 8;
+  int retry_max = 3;
+  int retry_backoff_ms = 750;
+  // Size cap for build/downloads; least recently used archives go first.
+  std::int64_t cache_max_mb = 10240;
+};
+
+struct BuildConfig {
+  int jobs = 0;
+  std::string backend_default = "make";
+  // Caller environment variables handed to build scripts. Their values are
+  // part of every derivation hash.
+  std::vector<std::string> env_passthrough;
+  // [build.backends] in toml_util::appendCanonical form, for hashing.
+  std::string backends;
+};
+
 struct ProfileConfig {
   std::string activate_symlink = "/usr/local";
   std::string activate_target = "/usr/ports/profile/current";
   int generations_to_keep = 5;
 };
 
+struct IntegrityConfig {
+  std::string hash_algo = "sha256";
+};
+
+// Binary cache consulted before building a port. `dir` holds one archive
+// and one metadata file per derivation hash; relative paths are taken from
+// the root. Empty disables substitution.
+struct SubstituteConfig {
+  std::string dir;
+  // Upload each port built locally to `dir`.
+  bool push = false;
+};
+
 struct Config {
   LayoutConfig layout;
   ResolverConfig resolver;
+  FetchConfig fetch;
+  BuildConfig build;
   ProfileConfig profile;
+  IntegrityConfig integrity;
+  SubstituteConfig substitute;
 };
 
 class ConfigStore {
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pkg/config.hpp"
+#include "pkg/port.hpp"
+#include "pkg/resolver.hpp"
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// Name -> derivation hash (lowercase hex SHA-256).
+using DerivationMap = std::unordered_map<std::string, std::string>;
+
+// Build inputs that come from pkg.toml and the caller rather than from a
+// recipe: the [build] backend settings, the variables listed in
+// build.env_passthrough and the absolute store dir, captured once so that
+// scripts run with exactly the values that were hashed. The store dir is
+// included because outputs embed $PKG_STORE_DIR (rpaths, .pc files), so
+// the same recipe under another root is a different output.
+class BuildEnvironment {
+ public:
+  // Handed to scripts when set, but not hashed: they locate tools and
+  // scratch space rather than select them, and differ between otherwise
+  // equal hosts. Listing one in build.env_passthrough hashes it too.
+  static constexpr const char* kUnhashedVariables[] = {"PATH", "HOME",
+                                                       "TMPDIR"};
+
+  static BuildEnvironment capture(const std::filesystem::path& root,
+                                  const Config& config);
+
+  // Lowercase hex SHA-256 of the hashed inputs.
+  const std::string& digest() const noexcept { return digest_; }
+  // NAME=value for every set variable scripts inherit.
+  std::vector<std::string> scriptEnv() const;
+
+ private:
+  // Passthrough variables in config order; nullopt when unset.
+  std::vector<std::pair<std::string, std::optional<std::string>>> hashed_;
+  std::vector<std::pair<std::string, std::string>> unhashed_;
+  std::string digest_;
+};
+
+// Identity of one build of a port. The hash covers everything that can
+// change what the build produces: the canonicalized pkg.toml, every file in
+// the recipe directory (scripts and whatever they read, such as patches),
+// the pinned source, the build environment and the derivation hashes of the
+// direct dependencies. Changing any input of a dependency therefore changes
+// every dependent.
+class Derivation {
+ public:
+  // Hex digits of the hash used in store directory names.
+  static constexpr std::size_t kStorePrefixLength = 32;
+
+  // `deps` must already hold the hashes of recipe.deps.
+  static Result<std::string> hash(const PortRecipe& recipe,
+                                  const DerivationMap& deps,
+                                  const BuildEnvironment& env);
+  // Hashes every resolved port; relies on `order` listing dependencies
+  // before their dependents.
+  static Result<DerivationMap> hashAll(const ResolveResult& resolved,
+                                       const BuildEnvironment& env);
+  // "<hash prefix>-<name>-<version>".
+  static std::string storeName(const PortRecipe& recipe, std::string_view drv);
+};
+
+}  // namespace pkg
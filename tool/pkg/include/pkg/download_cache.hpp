@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// Content-addressed store for verified source archives, keyed by SHA-256.
+// Objects only enter the cache through commit() after their digest has been
+// checked, so presence of an object means it is already verified.
+class DownloadCache {
+ public:
+  DownloadCache(std::filesystem::path dir, std::uint64_t max_bytes);
+
+  // Returns the cached object for the digest and marks it recently used.
+  std::optional<std::filesystem::path> find(std::string_view sha256) const;
+  // Unique scratch path on the cache filesystem for an in-flight download.
+  std::filesystem::path stagingPath(std::string_view sha256) const;
+  // Flushes a verified staging file to disk and renames it into place.
+  Result<std::filesystem::path> commit(const std::filesystem::path& staged,
+                                       std::string_view sha256) const;
+  // Deletes least recently used objects until the cache fits max_bytes.
+  // A max_bytes of 0 disables pruning.
+  Status prune() const;
+
+  const std::filesystem::path& dir() const noexcept { return dir_; }
+
+ private:
+  std::filesystem::path objectPath(std::string_view sha256) const;
+
+  std::filesystem::path dir_;
+  std::uint64_t max_bytes_;
+};
+
+}  // namespace pkg
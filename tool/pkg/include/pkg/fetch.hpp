@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pkg/config.hpp"
+#include "pkg/download_cache.hpp"
+#include "pkg/port.hpp"
+#include "pkg/result.hpp"
+#include "pkg/trace.hpp"
+
+namespace pkg {
+
+struct FetchRequest {
+  // Null for ports that need nothing fetched; such requests finish at once.
+  const PortRecipe* recipe = nullptr;
+  // Clone target for git sources.
+  std::filesystem::path src_dir;
+  std::filesystem::path log_path;
+  // Unpack url archives into src_dir (first path component stripped) while
+  // they download. Falls back to leaving only the archive when the codec
+  // has no built-in decoder.
+  bool unpack = false;
+};
+
+struct FetchedSource {
+  // Verified archive for url sources; empty for git and source-less ports.
+  std::filesystem::path archive;
+  std::uint64_t bytes = 0;
+  std::int64_t elapsed_ms = 0;
+  int attempts = 0;
+  bool cached = false;
+  // src_dir already holds the unpacked archive.
+  bool unpacked = false;
+
+  // One-line human summary such as "12.0 MiB in 1.5s (8.0 MiB/s)".
+  std::string describe() const;
+};
+
+// Downloads one source, retrying transient failures with exponential
+// backoff as configured under [fetch].
+class Fetcher {
+ public:
+  Fetcher(const Config& config, const DownloadCache& cache);
+
+  Result<FetchedSource> fetch(const FetchRequest& request) const;
+
+  // False for recipes without a remote source (no src.type or no url).
+  static bool needsFetch(const PortRecipe& recipe);
+
+ private:
+  Result<FetchedSource> fetchOnce(const FetchRequest& request) const;
+
+  const Config& config_;
+  const DownloadCache& cache_;
+};
+
+// Pipeline stage that fetches (and optionally prepares) a batch of sources
+// on up to `parallel` threads. Consumers block on just the sources they
+// need, so downstream work can start before the batch is done.
+class FetchQueue {
+ public:
+  using Callback =
+      std::function<void(std::size_t index, const Result<FetchedSource>&)>;
+  // Runs on the fetch thread right after a successful fetch, e.g. to unpack
+  // the archive while the consumer is still busy with earlier work.
+  using Prepare =
+      std::function<Status(std::size_t index, const FetchedSource& fetched)>;
+
+  struct Options {
+    int parallel = 1;
+    // Upper bound on sources that are in flight or finished but not yet
+    // taken. 0 means unbounded. Only safe together with an `order` in which
+    // every request comes after the requests its consumer depends on.
+    std::size_t max_ready = 0;
+    Prepare prepare;
+    // Runs serialized once per request.
+    Callback on_done;
+    // Records a slice per port, with the fetch phase nested under it, on
+    // the worker's lane. `prepare` runs inside the port slice.
+    BuildTrace* trace = nullptr;
+  };
+
+  struct StageTiming {
+    // Time the request sat in the queue before a worker picked it up.
+    std::int64_t queued_ms = 0;
+    // When the result became available.
+    std::chrono::steady_clock::time_point ready_at;
+  };
+
+  // `order` lists request indices in the order they should be started; an
+  // empty order means index order.
+  FetchQueue(const Fetcher& fetcher,
+             std::vector<FetchRequest> requests,
+             std::vector<std::size_t> order,
+             Options options);
+  // Cancels requests that have not started and joins the workers.
+  ~FetchQueue();
+
+  FetchQueue(const FetchQueue&) = delete;
+  FetchQueue& operator=(const FetchQueue&) = delete;
+
+  const Result<FetchedSource>& wait(std::size_t index);
+  // Waits for the result and frees its slot in the ready bound.
+  const Result<FetchedSource>& take(std::size_t index);
+  // Frees the slot of a request whose result will never be taken.
+  void release(std::size_t index);
+  StageTiming timing(std::size_t index);
+  void cancel();
+
+ private:
+  void worker();
+  void releaseLocked(std::size_t index);
+
+  const Fetcher& fetcher_;
+  std::vector<FetchRequest> requests_;
+  std::vector<std::size_t> order_;
+  Options options_;
+  std::vector<std::optional<Result<FetchedSource>>> results_;
+  std::vector<StageTiming> timings_;
+  std::vector<bool> released_;
+  std::vector<bool> holding_;
+  std::chrono::steady_clock::time_point created_;
+  std::size_t next_ = 0;
+  std::size_t held_ = 0;
+  bool cancelled_ = false;
+  std::mutex mu_;
+  std::mutex callback_mu_;
+  std::condition_variable cv_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace pkg
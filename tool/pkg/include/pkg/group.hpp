@@ -20,8 +20,10 @@ class GroupStore {
   static Result<Group> loadByName(const std::filesystem::path& root,
                                   const Config& config,
                                   std::string_view group_name);
-  static Status validateAll(const std::filesystem::path& root,
-                            const Config& config);
+  // Parses every group file in parallel and returns all failures, ordered
+  // by directory and file name. Empty means every group is valid.
+  static std::vector<Status> validateAll(const std::filesystem::path& root,
+                                         const Config& config);
 };
 
 }  // namespace pkg
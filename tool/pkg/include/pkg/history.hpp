@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#include "pkg/config.hpp"
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+struct PortTiming {
+  std::string version;
+  int runs = 0;
+  std::int64_t last_ms = 0;
+  std::int64_t avg_ms = 0;
+  // CPU time (user + sys) of the phase scripts, and the largest resident
+  // set any of them reached, over all recorded runs.
+  std::int64_t last_cpu_ms = 0;
+  std::int64_t avg_cpu_ms = 0;
+  std::int64_t peak_rss_kb = 0;
+};
+
+struct BuildHistory {
+  int schema = 1;
+  std::unordered_map<std::string, PortTiming> ports;
+
+  void record(const std::string& name,
+              const std::string& version,
+              std::int64_t duration_ms,
+              std::int64_t cpu_ms = 0,
+              std::int64_t max_rss_kb = 0);
+};
+
+class BuildHistoryStore {
+ public:
+  static constexpr const char* kHistoryFilename = "history.toml";
+
+  // A missing history file is not an error; it yields an empty history.
+  static Result<BuildHistory> load(const std::filesystem::path& root,
+                                   const Config& config);
+  static Status save(const std::filesystem::path& root,
+                     const Config& config,
+                     const BuildHistory& history);
+};
+
+}  // namespace pkg
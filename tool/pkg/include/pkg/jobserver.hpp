@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// GNU make style jobserver backed by a named FIFO. The pool holds jobs - 1
+// tokens; the remaining slot is the implicit one owned by pkg itself. Every
+// concurrently running port occupies one slot, and make/ninja/cargo started
+// by its scripts draw extra tokens from the same FIFO through MAKEFLAGS.
+class Jobserver {
+ public:
+  static Result<std::unique_ptr<Jobserver>> create(
+      const std::filesystem::path& fifo_path, int jobs);
+  ~Jobserver();
+
+  Jobserver(const Jobserver&) = delete;
+  Jobserver& operator=(const Jobserver&) = delete;
+
+  enum class Slot {
+    kNone,      // the pool failed; nothing was taken
+    kImplicit,
+    kToken,
+  };
+
+  // Blocks until a slot is free. On a read error it returns kNone so the
+  // caller runs rather than stalls; such a slot is never released, which
+  // would add a token the pool did not have.
+  Slot acquire();
+  void release(Slot slot);
+
+  int jobs() const noexcept { return jobs_; }
+  // Value to export as MAKEFLAGS to child processes.
+  std::string makeflags() const;
+
+ private:
+  Jobserver(std::filesystem::path fifo_path, int fd, int jobs);
+
+  std::filesystem::path fifo_path_;
+  int fd_ = -1;
+  int jobs_ = 1;
+  std::atomic<bool> implicit_free_{true};
+};
+
+// Holds one jobserver slot for the lifetime of the object.
+class JobSlot {
+ public:
+  explicit JobSlot(Jobserver* jobserver)
+      : jobserver_(jobserver),
+        slot_(jobserver_ != nullptr ? jobserver_->acquire()
+                                    : Jobserver::Slot::kNone) {}
+  ~JobSlot() {
+    if (jobserver_ != nullptr) {
+      jobserver_->release(slot_);
+    }
+  }
+
+  JobSlot(const JobSlot&) = delete;
+  JobSlot& operator=(const JobSlot&) = delete;
+
+ private:
+  Jobserver* jobserver_;
+  Jobserver::Slot slot_;
+};
+
+}  // namespace pkg
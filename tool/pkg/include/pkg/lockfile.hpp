@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -9,13 +12,34 @@
 
 namespace pkg {
 
+// Resources used by one phase script of a port, as reported by wait4().
+struct PhaseUsage {
+  std::string phase;
+  int exit_code = 0;
+  int term_signal = 0;
+  std::int64_t wall_ms = 0;
+  std::int64_t user_ms = 0;
+  std::int64_t sys_ms = 0;
+  std::int64_t max_rss_kb = 0;
+  std::int64_t read_bytes = 0;
+  std::int64_t write_bytes = 0;
+};
+
 struct LockEntry {
   std::string name;
   std::string version;
   std::string status;
   std::string recipe;
   std::vector<std::string> deps;
+  // Derivation hash; the store directory is named after its prefix.
+  std::string drv;
   std::string store;
+  // Pipeline waits: queued before the fetch stage picked the port up, and
+  // between its source being ready and the build starting.
+  std::int64_t fetch_wait_ms = 0;
+  std::int64_t build_wait_ms = 0;
+  // Phases run by the last build, in order; empty for reused ports.
+  std::vector<PhaseUsage> phases;
 };
 
 struct Lockfile {
@@ -26,11 +50,54 @@ struct Lockfile {
 
 class LockfileStore {
  public:
+  // Appended to the lockfile name for the journal of a build in progress.
+  static constexpr const char* kJournalSuffix = ".journal";
+
+  // Reads the lockfile. A journal left behind by an interrupted build is
+  // newer than the lockfile, so it is replayed instead; such a lockfile
+  // keeps the state "building".
   static Result<Lockfile> load(const std::filesystem::path& root,
                                const Config& config);
+  // Replaces the lockfile atomically: the new contents are written to a
+  // temporary file, fsynced and renamed over the old one.
   static Status save(const std::filesystem::path& root,
                      const Config& config,
                      const Lockfile& lockfile);
 };
 
+// Append-only log of a build in progress. It starts with the whole planned
+// lockfile; every entry that changes state is appended again, and the last
+// copy wins on replay. Each append is fsynced and ends with a marker line,
+// so progress survives a crash, a record torn anywhere is dropped on load,
+// and `pkg build --resume` can pick up the rest.
+class LockfileJournal {
+ public:
+  // Replaces any older journal with one holding `lockfile`.
+  static Result<std::unique_ptr<LockfileJournal>> begin(
+      const std::filesystem::path& root,
+      const Config& config,
+      const Lockfile& lockfile);
+  ~LockfileJournal();
+
+  LockfileJournal(const LockfileJournal&) = delete;
+  LockfileJournal& operator=(const LockfileJournal&) = delete;
+
+  // Thread-safe.
+  Status record(const LockEntry& entry);
+  // Saves the final lockfile and removes the journal.
+  Status compact(const Lockfile& lockfile);
+
+ private:
+  LockfileJournal(std::filesystem::path root,
+                  const Config& config,
+                  std::filesystem::path path,
+                  int fd);
+
+  std::filesystem::path root_;
+  const Config& config_;
+  std::filesystem::path path_;
+  int fd_ = -1;
+  std::mutex mu_;
+};
+
 }  // namespace pkg
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace pkg {
+
+class Parallel {
+ public:
+  // Calls task(i) for every i in [0, count) on up to `threads` threads
+  // (0 or less means one per hardware thread) and returns once all calls
+  // have finished. Indices are handed out in increasing order.
+  static void forEach(std::size_t count,
+                      int threads,
+                      const std::function<void(std::size_t index)>& task);
+};
+
+}  // namespace pkg
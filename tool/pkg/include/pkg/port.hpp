@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "pkg/arena.hpp"
 #include "pkg/config.hpp"
 #include "pkg/result.hpp"
 
@@ -19,6 +23,8 @@ struct SourceSpec {
   std::string type;
   std::string url;
   std::string sha256;
+  // Commit, tag or branch checked out for git sources; empty tracks HEAD.
+  std::string rev;
 };
 
 struct BuildSpec {
@@ -42,6 +48,38 @@ struct PortRecipe {
   BuildSpec build;
   ScriptSpec scripts;
   std::filesystem::path recipe_path;
+  // SHA-256 of the canonicalized pkg.toml; see toml_util::appendCanonical.
+  std::string manifest_sha256;
+};
+
+// A PortRecipe whose strings are views into an Arena, for loading many
+// recipes without a heap allocation per field. Valid until the arena it
+// was loaded into is reset or destroyed.
+struct PortRecipeView {
+  std::string_view name;
+  std::string_view version;
+  std::string_view summary;
+  std::string_view license;
+  std::span<const std::string_view> deps;
+  struct {
+    std::string_view type;
+    std::string_view url;
+    std::string_view sha256;
+    std::string_view rev;
+  } src;
+  struct {
+    std::string_view system = "make";
+  } build;
+  struct {
+    std::string_view patch;
+    std::string_view build;
+    std::string_view install;
+    std::string_view check;
+  } scripts;
+  std::string_view recipe_path;
+  std::string_view manifest_sha256;
+
+  PortRecipe toRecipe() const;
 };
 
 class PortStore {
@@ -56,8 +94,40 @@ class PortStore {
                                                 const Config& config,
                                                 std::string_view port_name,
                                                 std::string_view version);
-  static Status validateAll(const std::filesystem::path& root,
-                            const Config& config);
+  // Loads the current recipe of each port in `port_names` into `arena`,
+  // one result per name in the same order.
+  static std::vector<Result<PortRecipeView>> loadCurrentViews(
+      const std::filesystem::path& root,
+      const Config& config,
+      const std::vector<std::string>& port_names,
+      Arena& arena);
+  static Result<PortRecipeView> loadRecipeViewAtVersion(
+      const std::filesystem::path& root,
+      const Config& config,
+      std::string_view port_name,
+      std::string_view version,
+      Arena& arena);
+
+  // Snapshot of the last fully valid tree, under the build directory.
+  static constexpr const char* kValidatedFilename = "validated.bin";
+
+  // Loads every port's current recipe in parallel, checks that each
+  // dependency names an existing port and returns all failures, ordered
+  // by port name. Empty means the tree is valid; the validated snapshot
+  // is then refreshed.
+  static std::vector<Status> validateAll(const std::filesystem::path& root,
+                                         const Config& config);
+  // Like validateAll, but only re-checks ports whose versions.toml,
+  // pkg.toml or scripts changed since the validated snapshot was written,
+  // plus the ports depending on a changed or removed port. `checked`
+  // receives the number of ports re-checked.
+  static std::vector<Status> validateChanged(const std::filesystem::path& root,
+                                             const Config& config,
+                                             std::size_t* checked);
+  // Reports every dependency cycle among the ports that load, one error
+  // per cycle, ordered by port name.
+  static std::vector<Status> validateGraph(const std::filesystem::path& root,
+                                           const Config& config);
 };
 
 }  // namespace pkg
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+enum class Redirect {
+  kInherit = 0,
+  kNull,
+  kFile,    // append to ProcessSpec::log_path
+  kPipe,    // stdout only: stream to ProcessSpec::on_stdout
+  kStdout,  // stderr only: same target as stdout
+};
+
+struct ProcessSpec {
+  std::vector<std::string> argv;
+  // NAME=value entries. Layered over the parent environment unless
+  // inherit_env is false, in which case they are the whole environment.
+  std::vector<std::string> env;
+  bool inherit_env = true;
+  std::filesystem::path cwd;
+  Redirect stdout_mode = Redirect::kInherit;
+  Redirect stderr_mode = Redirect::kInherit;
+  std::filesystem::path log_path;
+  // Receives stdout chunks for Redirect::kPipe. Returning an error stops
+  // reading; the child is still reaped and the error is returned.
+  std::function<Status(std::string_view chunk)> on_stdout;
+};
+
+struct ProcessResult {
+  int exit_code = -1;
+  int term_signal = 0;
+  std::int64_t wall_ms = 0;
+  std::int64_t user_ms = 0;
+  std::int64_t sys_ms = 0;
+  std::int64_t max_rss_kb = 0;
+  std::int64_t read_blocks = 0;
+  std::int64_t write_blocks = 0;
+
+  bool ok() const noexcept { return term_signal == 0 && exit_code == 0; }
+  std::string describe() const;
+};
+
+class Process {
+ public:
+  // Spawns argv[0] (searched in PATH when it has no slash) and waits for
+  // it. A non-zero exit is reported in the result, not as an error status.
+  static Result<ProcessResult> run(const ProcessSpec& spec);
+  // Runs the command and collects its stdout into `output`.
+  static Result<ProcessResult> capture(const ProcessSpec& spec,
+                                       std::string& output);
+  // Appends stdout and stderr to log_path; a non-zero exit is an error.
+  // `result`, when given, receives the exit status and resource usage even
+  // if the command failed.
+  static Status runToLog(ProcessSpec spec,
+                         const std::filesystem::path& log_path,
+                         ProcessResult* result = nullptr);
+  static Status runToLog(std::vector<std::string> argv,
+                         const std::filesystem::path& log_path);
+  static std::string commandLine(const std::vector<std::string>& argv);
+  static std::optional<std::filesystem::path> findExecutable(
+      std::string_view name);
+};
+
+}  // namespace pkg
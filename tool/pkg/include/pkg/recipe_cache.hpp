@@ -0,0 +1,63 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "pkg/config.hpp"
+#include "pkg/port.hpp"
+#include "pkg/recipe_index.hpp"
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// Memo of parsed versions.toml and pkg.toml files, so each recipe is read
+// and validated at most once per process however many commands, resolves
+// or validations ask for it. Entries are never evicted: returned pointers
+// stay valid for the life of the cache. Failed loads are not cached.
+// Safe to use from several threads.
+class RecipeCache {
+ public:
+  // The cache shared by PortStore, Resolver and the commands.
+  static RecipeCache& global();
+
+  Result<const VersionPointers*> versions(const std::filesystem::path& root,
+                                          const Config& config,
+                                          std::string_view port_name);
+  Result<const PortRecipe*> current(const std::filesystem::path& root,
+                                    const Config& config,
+                                    std::string_view port_name);
+  Result<const PortRecipe*> atVersion(const std::filesystem::path& root,
+                                      const Config& config,
+                                      std::string_view port_name,
+                                      std::string_view version);
+
+  // Backs later lookups with the on-disk index at `path`, so unchanged
+  // recipes are not parsed again in the next process.
+  void useIndex(const std::filesystem::path& path);
+  // Writes newly parsed recipes back to the index, if one is in use.
+  Status saveIndex();
+
+  // Forgets every parsed recipe, so the next lookups parse again. Pointers
+  // returned earlier dangle; only for benchmarks and tools that know no
+  // ResolveResult or recipe pointer is still alive.
+  void clear();
+
+ private:
+  template <typename T, typename Load>
+  Result<const T*> lookup(
+      std::unordered_map<std::string, std::unique_ptr<const T>>& map,
+      const std::string& key,
+      Load load);
+
+  std::mutex mu_;
+  std::unordered_map<std::string, std::unique_ptr<const VersionPointers>>
+      versions_;
+  std::unordered_map<std::string, std::unique_ptr<const PortRecipe>> recipes_;
+  std::unique_ptr<RecipeIndex> index_;
+};
+
+}  // namespace pkg
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pkg/port.hpp"
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// stat() fingerprint used to decide whether an indexed file changed.
+struct FileStamp {
+  std::string path;
+  std::int64_t mtime_ns = 0;
+  std::uint64_t size = 0;
+  std::uint64_t inode = 0;
+
+  static std::optional<FileStamp> of(const std::filesystem::path& path);
+  bool current() const;
+};
+
+// Persistent binary index of parsed versions.toml and pkg.toml files
+// (build/index.bin). Each record carries the stamps of the files it was
+// parsed from; a record is only served while every stamp still matches,
+// so edited recipes are transparently re-parsed. The file is mapped
+// read-only and records are decoded on lookup.
+class RecipeIndex {
+ public:
+  static constexpr const char* kIndexFilename = "index.bin";
+
+  // A missing, unreadable or outdated index yields an empty one; it is a
+  // cache, never a source of errors.
+  static std::unique_ptr<RecipeIndex> open(std::filesystem::path path);
+  ~RecipeIndex();
+
+  RecipeIndex(const RecipeIndex&) = delete;
+  RecipeIndex& operator=(const RecipeIndex&) = delete;
+
+  // Record keys for a port directory and one of its versions.
+  static std::string versionsKey(const std::filesystem::path& port_dir);
+  static std::string recipeKey(const std::filesystem::path& port_dir,
+                               std::string_view version);
+
+  // Thread-safe with respect to each other; not against put*/save.
+  std::optional<VersionPointers> findVersions(const std::string& key) const;
+  std::optional<PortRecipe> findRecipe(const std::string& key) const;
+
+  // Keys of every indexed versions.toml record, i.e. the port directories
+  // known when the index was written.
+  std::vector<std::string> portKeys() const;
+
+  void putVersions(const std::string& key,
+                   const VersionPointers& versions,
+                   const std::filesystem::path& file);
+  // Stamps recipe_path and every script the recipe references.
+  void putRecipe(const std::string& key, const PortRecipe& recipe);
+
+  // Rewrites the index if anything was added since it was opened. Records
+  // that were not looked up are carried over unless their file is gone.
+  Status save() const;
+
+ private:
+  explicit RecipeIndex(std::filesystem::path path);
+  std::optional<std::string_view> findCurrent(const std::string& key,
+                                              char kind) const;
+
+  std::filesystem::path path_;
+  void* map_ = nullptr;
+  std::size_t map_size_ = 0;
+  // Key -> encoded record inside the mapping.
+  std::unordered_map<std::string_view, std::string_view> records_;
+  // Key -> encoded record added during this run.
+  std::unordered_map<std::string, std::string> fresh_;
+};
+
+}  // namespace pkg
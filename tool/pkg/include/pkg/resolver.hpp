@@ -13,7 +13,8 @@
 namespace pkg {
 
 struct ResolvedNode {
-  PortRecipe recipe;
+  // Owned by RecipeCache::global().
+  const PortRecipe& recipe;
 };
 
 struct ResolveResult {
@@ -21,11 +22,26 @@ struct ResolveResult {
   std::unordered_map<std::string, ResolvedNode> nodes;
 };
 
+// Ports that all depend on each other, directly or transitively.
+struct DependencyCycle {
+  // Sorted by name.
+  std::vector<std::string> ports;
+  // One concrete cycle through ports.front(), ending where it started.
+  std::vector<std::string> path;
+};
+
 class Resolver {
  public:
   static Result<ResolveResult> resolveGroup(const std::filesystem::path& root,
                                             const Config& config,
                                             const Group& group);
+
+  // Every dependency cycle among `recipes`, from one linear pass of
+  // Tarjan's strongly connected components algorithm, so all cycles are
+  // reported at once rather than one per resolve. Deps on ports outside
+  // `recipes` are ignored. Ordered by first port name.
+  static std::vector<DependencyCycle> findCycles(
+      const std::vector<const PortRecipe*>& recipes);
 };
 
 }  // namespace pkg
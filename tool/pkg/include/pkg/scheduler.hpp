@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+struct ScheduleNode {
+  std::string name;
+  std::vector<std::size_t> deps;
+  // Expected cost of the node; used to rank ready nodes by critical path.
+  std::int64_t weight = 1;
+};
+
+enum class NodeState {
+  kPending = 0,
+  kDone,
+  kFailed,
+  kSkipped,
+};
+
+struct ScheduleOptions {
+  // Keep starting nodes after a failure; only the failed node's transitive
+  // dependents are skipped.
+  bool keep_going = false;
+  // Called, outside the scheduler's lock, for each node skipped because a
+  // dependency failed while keep_going was set.
+  std::function<void(std::size_t index)> on_skipped;
+};
+
+class BuildScheduler {
+ public:
+  using Task = std::function<Status(std::size_t index)>;
+
+  // Runs `task` for every node once all of its deps are kDone, with at most
+  // `jobs` tasks in flight. Among ready nodes the one heading the heaviest
+  // remaining chain of dependents starts first. Unless options.keep_going
+  // is set, no new nodes are started after the first failure and
+  // everything left over is reported as kSkipped.
+  static std::vector<NodeState> run(const std::vector<ScheduleNode>& nodes,
+                                    int jobs,
+                                    const Task& task,
+                                    const ScheduleOptions& options = {});
+
+  // Weight of each node plus the heaviest path through its dependents.
+  static std::vector<std::int64_t> criticalPath(
+      const std::vector<ScheduleNode>& nodes);
+};
+
+}  // namespace pkg
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// Incremental SHA-256. Uses the x86 SHA extensions when the CPU has them
+// and a portable implementation otherwise.
+class Sha256 {
+ public:
+  static constexpr std::size_t kDigestSize = 32;
+  using Digest = std::array<std::uint8_t, kDigestSize>;
+
+  Sha256();
+
+  void update(const void* data, std::size_t len);
+  void update(std::string_view data) { update(data.data(), data.size()); }
+  Digest finish();
+  std::string finishHex();
+
+  static std::string toHex(const Digest& digest);
+  // Writes the 64 hex digits of `digest` to `out`, without a terminator.
+  static void toHex(const Digest& digest, char* out);
+  static std::string hashHex(std::string_view data);
+  static Result<std::string> hashFileHex(const std::filesystem::path& path);
+  // Name of the block function selected for this CPU.
+  static const char* implementation();
+
+ private:
+  std::uint32_t state_[8];
+  std::uint64_t length_ = 0;
+  std::uint8_t buffer_[64];
+  std::size_t buffered_ = 0;
+};
+
+}  // namespace pkg
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "pkg/config.hpp"
+#include "pkg/derivation.hpp"
+#include "pkg/lockfile.hpp"
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+struct Substitution {
+  // Size of the archive the store dir was unpacked from.
+  std::uint64_t bytes = 0;
+  std::int64_t elapsed_ms = 0;
+
+  // One-line human summary such as "3.2 MiB in 0.4s".
+  std::string describe() const;
+};
+
+// Source of prebuilt store dirs, keyed by derivation hash, that `pkg build`
+// consults before building a port. Outputs are only published once
+// complete, so a hit is always a whole store dir. Thread-safe.
+class Substituter {
+ public:
+  virtual ~Substituter() = default;
+
+  // Whether a usable output for entry.drv exists. Checked while planning,
+  // so that ports which will be substituted need not fetch their sources.
+  virtual bool has(const LockEntry& entry) const = 0;
+  // Unpacks the output of entry.drv into `store_dir`, replacing whatever is
+  // there. Fails with kNotFound on a miss and kConflict on a corrupt
+  // archive; `store_dir` is left untouched on any failure.
+  virtual Result<Substitution> fetch(const LockEntry& entry,
+                                     const std::filesystem::path& store_dir,
+                                     const std::filesystem::path& log_path) const = 0;
+  // Publishes a freshly built `store_dir` under entry.drv. A drv that is
+  // already present is left as is.
+  virtual Status push(const LockEntry& entry,
+                      const std::filesystem::path& store_dir,
+                      const std::filesystem::path& log_path) const = 0;
+  virtual std::string describe() const = 0;
+
+  // The cache configured under [substitute], or null when there is none.
+  // Outputs are pushed and accepted only for the build environment `env`.
+  static std::unique_ptr<Substituter> fromConfig(
+      const std::filesystem::path& root,
+      const Config& config,
+      const BuildEnvironment& env);
+};
+
+// Binary cache in a plain directory, local or on a shared mount such as
+// NFS. Each output is a gzip tarball of the store dir plus a small
+// <drv>.toml naming the port, the archive and its SHA-256. Archives are
+// named <drv>-<digest prefix>.tar.gz. Both files are written under
+// temporary names, fsynced and renamed into place, metadata last, so the
+// metadata marks a complete entry even after a crash, and concurrent
+// pushers of the same drv cannot tear each other's writes. The metadata
+// also records the build environment digest; an entry whose digest differs
+// from ours, or that has none, is refused even though the drv already
+// covers the environment.
+class DirectorySubstituter final : public Substituter {
+ public:
+  DirectorySubstituter(std::filesystem::path dir, std::string env_digest);
+
+  bool has(const LockEntry& entry) const override;
+  Result<Substitution> fetch(const LockEntry& entry,
+                             const std::filesystem::path& store_dir,
+                             const std::filesystem::path& log_path) const override;
+  Status push(const LockEntry& entry,
+              const std::filesystem::path& store_dir,
+              const std::filesystem::path& log_path) const override;
+  std::string describe() const override;
+
+  static constexpr const char* kArchiveSuffix = ".tar.gz";
+  static constexpr const char* kMetadataSuffix = ".toml";
+
+ private:
+  std::filesystem::path archivePath(const std::string& drv,
+                                    const std::string& sha256) const;
+  std::filesystem::path metadataPath(const std::string& drv) const;
+  // Unique scratch name next to `path`, also across hosts sharing the dir.
+  std::filesystem::path stagingPath(const std::filesystem::path& path) const;
+
+  std::filesystem::path dir_;
+  std::string env_digest_;
+};
+
+}  // namespace pkg
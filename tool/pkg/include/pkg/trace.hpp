@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pkg/result.hpp"
+
+namespace pkg {
+
+// Timeline of a build in Chrome Trace Event format, viewable in Perfetto or
+// chrome://tracing. Each thread that records gets its own lane, named after
+// its pool ("build 1", "fetch 3", ...). Thread-safe.
+class BuildTrace {
+ public:
+  // A slice on the calling thread's lane, from construction to destruction.
+  // Slices opened while another is live on the same thread nest under it.
+  // With a null trace every operation is a no-op.
+  class Span {
+   public:
+    // `job` slices also count toward the pool's concurrent jobs counter.
+    Span(BuildTrace* trace,
+         const char* pool,
+         std::string name,
+         const char* category,
+         bool job = false);
+    ~Span();
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    void arg(std::string key, std::string value);
+
+   private:
+    BuildTrace* trace_;
+    const char* pool_;
+    std::string name_;
+    const char* category_;
+    bool job_;
+    std::int64_t start_us_ = 0;
+    int lane_ = 0;
+    std::vector<std::pair<std::string, std::string>> args_;
+  };
+
+  explicit BuildTrace(std::string process_name);
+
+  BuildTrace(const BuildTrace&) = delete;
+  BuildTrace& operator=(const BuildTrace&) = delete;
+
+  Status save(const std::filesystem::path& path) const;
+
+ private:
+  struct Event {
+    char phase = 'X';
+    std::string name;
+    const char* category = "";
+    std::int64_t ts_us = 0;
+    std::int64_t dur_us = 0;
+    int lane = 0;
+    std::vector<std::pair<std::string, std::string>> args;
+  };
+
+  struct Lane {
+    std::string name;
+    int sort_index = 0;
+  };
+
+  std::int64_t nowUs() const;
+  std::size_t poolLocked(const char* pool);
+  int laneLocked(const char* pool);
+  int begin(const char* pool, bool job, std::int64_t* start_us);
+  void end(Event event, const char* pool, bool job);
+  void countLocked(const char* pool, int delta, std::int64_t ts_us);
+
+  const std::string process_name_;
+  const std::chrono::steady_clock::time_point started_;
+  mutable std::mutex mu_;
+  std::vector<Event> events_;
+  std::vector<Lane> lanes_;
+  std::unordered_map<std::thread::id, int> lane_of_thread_;
+  // Per pool, in order of first use: lanes handed out and jobs running.
+  std::vector<std::string> pools_;
+  std::vector<int> pool_lanes_;
+  std::vector<int> pool_jobs_;
+};
+
+}  // namespace pkg
@@ -0,0 +1,483 @@
+// pkg_bench: generates a synthetic ports tree and times the hot paths of
+// loading, validating and resolving it. Results are printed as JSON
+// (shaped like Google Benchmark's) so runs can be diffed over time.
+//
+//   pkg_bench [--ports N] [--fanout K] [--depth D] [--seed S]
+//             [--iterations R] [--tree DIR] [--keep] [--out FILE]
+//   pkg_bench generate --tree DIR [--ports N] [--fanout K] [--depth D]
+//             [--seed S]
+
+#include <time.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "pkg/arena.hpp"
+#include "pkg/config.hpp"
+#include "pkg/group.hpp"
+#include "pkg/lockfile.hpp"
+#include "pkg/port.hpp"
+#include "pkg/recipe_cache.hpp"
+#include "pkg/resolver.hpp"
+#include "toml_util.hpp"
+
+namespace {
+
+using pkg::Result;
+using pkg::Status;
+using pkg::StatusCode;
+
+struct TreeShape {
+  int ports = 2000;
+  int fanout = 4;
+  int depth = 12;
+  std::uint32_t seed = 1;
+};
+
+struct Options {
+  TreeShape shape;
+  int iterations = 5;
+  std::filesystem::path tree;
+  std::filesystem::path out;
+  bool keep = false;
+  bool generate_only = false;
+};
+
+struct Measurement {
+  std::string name;
+  int iterations = 0;
+  std::int64_t items = 0;
+  std::vector<double> real_ms;
+  std::vector<double> cpu_ms;
+};
+
+std::string portName(int i) { return "p" + std::to_string(i); }
+
+Status writeFile(const std::filesystem::path& path, const std::string& text) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << text;
+  if (!out) {
+    return Status{StatusCode::kIoError, "Failed to write " + path.string()};
+  }
+  return Status::Ok();
+}
+
+// Ports are split into `depth` layers. Every port outside the bottom layer
+// depends on one port of the layer just below it, so the longest chain is
+// `depth` long, plus up to fanout-1 more drawn from any lower layer.
+Result<std::int64_t> generateTree(const std::filesystem::path& root,
+                                  const TreeShape& shape) {
+  std::error_code ec;
+  std::filesystem::remove_all(root, ec);
+  std::filesystem::create_directories(root / "groups", ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create " + root.string() + ": " + ec.message()};
+  }
+  auto status = writeFile(root / pkg::ConfigStore::kConfigFilename,
+                          "[layout]\nports_dir = \"ports\"\n"
+                          "groups_dir = \"groups\"\nbuild_dir = \"build\"\n");
+  if (!status.ok()) {
+    return status;
+  }
+
+  const int n = std::max(1, shape.ports);
+  const int depth = std::clamp(shape.depth, 1, n);
+  std::mt19937 rng(shape.seed);
+  std::int64_t edges = 0;
+  std::string group = "name = \"all\"\nports = [";
+  for (int i = 0; i < n; ++i) {
+    const int layer = static_cast<int>(static_cast<std::int64_t>(i) * depth / n);
+    // First port of `layer`, and of the layer below it.
+    const auto layerStart = [&](int l) {
+      return static_cast<int>((static_cast<std::int64_t>(l) * n + depth - 1) / depth);
+    };
+    std::vector<int> deps;
+    if (layer > 0) {
+      const int below = layerStart(layer - 1);
+      const int here = layerStart(layer);
+      deps.push_back(below + static_cast<int>(rng() % (here - below)));
+      for (int k = 1; k < shape.fanout && static_cast<int>(deps.size()) < here; ++k) {
+        const int dep = static_cast<int>(rng() % here);
+        if (std::find(deps.begin(), deps.end(), dep) == deps.end()) {
+          deps.push_back(dep);
+        }
+      }
+    }
+    edges += static_cast<std::int64_t>(deps.size());
+
+    const auto port_dir = root / "ports" / portName(i);
+    const auto version_dir = port_dir / "1.0";
+    std::filesystem::create_directories(version_dir, ec);
+    std::ostringstream recipe;
+    recipe << "name = \"" << portName(i) << "\"\nversion = \"1.0\"\n"
+           << "summary = \"synthetic port " << i << "\"\nlicense = \"MIT\"\n"
+           << "deps = [";
+    for (std::size_t d = 0; d < deps.size(); ++d) {
+      recipe << (d == 0 ? "" : ", ") << '"' << portName(deps[d]) << '"';
+    }
+    recipe << "]\n\n[src]\ntype = \"\"\n\n[build]\nsystem = \"make\"\n\n"
+           << "[scripts]\nbuild = \"build.sh\"\ninstall = \"install.sh\"\n";
+    for (const auto& [file, text] :
+         {std::pair{port_dir / "versions.toml", std::string("current = \"1.0\"\n")},
+          std::pair{version_dir / "pkg.toml", recipe.str()},
+          std::pair{version_dir / "build.sh", std::string("#!/bin/sh\n")},
+          std::pair{version_dir / "install.sh", std::string("#!/bin/sh\n")}}) {
+      status = writeFile(file, text);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    group += (i == 0 ? "\"" : ", \"") + portName(i) + "\"";
+  }
+  status = writeFile(root / "groups" / "all.toml", group + "]\n");
+  if (!status.ok()) {
+    return status;
+  }
+  return edges;
+}
+
+double cpuNowMs() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) * 1e3 + static_cast<double>(ts.tv_nsec) / 1e6;
+}
+
+// Times `iterations` calls of `body`, running `setup` untimed before each.
+// Stops at the first failing call.
+Result<Measurement> measure(std::string name,
+                            int iterations,
+                            std::int64_t items,
+                            const std::function<void()>& setup,
+                            const std::function<Status()>& body) {
+  Measurement m;
+  m.name = std::move(name);
+  m.items = items;
+  for (int i = 0; i < iterations; ++i) {
+    if (setup) {
+      setup();
+    }
+    const auto wall = std::chrono::steady_clock::now();
+    const double cpu = cpuNowMs();
+    auto status = body();
+    m.cpu_ms.push_back(cpuNowMs() - cpu);
+    m.real_ms.push_back(std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - wall)
+                            .count());
+    if (!status.ok()) {
+      return Status{status.code(), m.name + ": " + status.message()};
+    }
+    ++m.iterations;
+  }
+  std::cerr << "  " << m.name << ": "
+            << *std::min_element(m.real_ms.begin(), m.real_ms.end()) << " ms (min of "
+            << m.iterations << ")\n";
+  return m;
+}
+
+double mean(const std::vector<double>& v) {
+  double sum = 0;
+  for (double x : v) {
+    sum += x;
+  }
+  return v.empty() ? 0 : sum / static_cast<double>(v.size());
+}
+
+std::string jsonString(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out + "\"";
+}
+
+std::string toJson(const Options& options,
+                   std::int64_t edges,
+                   const std::vector<Measurement>& results) {
+  char date[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+  std::ostringstream out;
+  out.precision(6);
+  out << std::fixed;
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": " << jsonString(date) << ",\n"
+      << "    \"ports\": " << options.shape.ports << ",\n"
+      << "    \"fanout\": " << options.shape.fanout << ",\n"
+      << "    \"depth\": " << options.shape.depth << ",\n"
+      << "    \"edges\": " << edges << ",\n"
+      << "    \"seed\": " << options.shape.seed << ",\n"
+      << "    \"iterations\": " << options.iterations << "\n  },\n"
+      << "  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& m = results[i];
+    const double real = mean(m.real_ms);
+    out << (i == 0 ? "\n" : ",\n") << "    {\n"
+        << "      \"name\": " << jsonString(m.name) << ",\n"
+        << "      \"iterations\": " << m.iterations << ",\n"
+        << "      \"real_time\": " << real << ",\n"
+        << "      \"cpu_time\": " << mean(m.cpu_ms) << ",\n"
+        << "      \"min_time\": " << *std::min_element(m.real_ms.begin(), m.real_ms.end())
+        << ",\n"
+        << "      \"max_time\": " << *std::max_element(m.real_ms.begin(), m.real_ms.end())
+        << ",\n"
+        << "      \"time_unit\": \"ms\",\n"
+        << "      \"items_per_second\": "
+        << (real > 0 ? static_cast<double>(m.items) * 1e3 / real : 0.0) << "\n    }";
+  }
+  out << "\n  ]\n}\n";
+  return out.str();
+}
+
+Status runSuite(const Options& options, std::int64_t edges) {
+  const auto& root = options.tree;
+  auto cfg_result = pkg::ConfigStore::load(root);
+  if (!cfg_result.ok()) {
+    return cfg_result.status();
+  }
+  const pkg::Config cfg = cfg_result.value();
+  auto& cache = pkg::RecipeCache::global();
+  const int n = options.shape.ports;
+  const int iterations = options.iterations;
+
+  std::vector<std::string> recipe_paths;
+  std::vector<std::string> names;
+  for (int i = 0; i < n; ++i) {
+    names.push_back(portName(i));
+    recipe_paths.push_back(
+        (root / cfg.layout.ports_dir / names.back() / "1.0" / "pkg.toml").string());
+  }
+
+  std::vector<Measurement> results;
+  const auto add = [&](Result<Measurement> m) {
+    if (!m.ok()) {
+      return m.status();
+    }
+    results.push_back(std::move(m).value());
+    return Status::Ok();
+  };
+  const auto first_error = [](std::vector<Status> errors) {
+    return errors.empty() ? Status::Ok() : errors.front();
+  };
+  const auto clear_cache = [&] { cache.clear(); };
+
+  std::cerr << "pkg_bench: " << n << " ports, " << edges << " edges\n";
+
+  auto status = add(measure("parse_file/recipe", iterations, n, nullptr, [&] {
+    for (const auto& path : recipe_paths) {
+      auto parsed = pkg::toml_util::parseFile(std::filesystem::path(path));
+      if (!parsed.ok()) {
+        return parsed.status();
+      }
+    }
+    return Status::Ok();
+  }));
+  if (!status.ok()) return status;
+
+  status = add(measure("parse_file/recipe_arena", iterations, n, nullptr, [&] {
+    pkg::Arena arena(1 << 20);
+    for (const auto& path : recipe_paths) {
+      auto parsed = pkg::toml_util::parseFile(path, arena);
+      if (!parsed.ok()) {
+        return parsed.status();
+      }
+    }
+    return Status::Ok();
+  }));
+  if (!status.ok()) return status;
+
+  status = add(measure("port_store/load_current_views", iterations, n, nullptr, [&] {
+    pkg::Arena arena(1 << 20);
+    for (auto& view : pkg::PortStore::loadCurrentViews(root, cfg, names, arena)) {
+      if (!view.ok()) {
+        return view.status();
+      }
+    }
+    return Status::Ok();
+  }));
+  if (!status.ok()) return status;
+
+  status = add(measure("port_store/validate_all", iterations, n, clear_cache, [&] {
+    return first_error(pkg::PortStore::validateAll(root, cfg));
+  }));
+  if (!status.ok()) return status;
+
+  status = add(measure("port_store/validate_changed_noop", iterations, n,
+                       clear_cache, [&] {
+    std::size_t checked = 0;
+    return first_error(pkg::PortStore::validateChanged(root, cfg, &checked));
+  }));
+  if (!status.ok()) return status;
+
+  auto group = pkg::GroupStore::loadByName(root, cfg, "all");
+  if (!group.ok()) {
+    return group.status();
+  }
+  status = add(measure("resolver/resolve_group_cold", iterations, edges,
+                       clear_cache, [&] {
+    return pkg::Resolver::resolveGroup(root, cfg, group.value()).status();
+  }));
+  if (!status.ok()) return status;
+
+  // Warm: every recipe is already parsed, so this is the graph walk alone.
+  auto resolved = pkg::Resolver::resolveGroup(root, cfg, group.value());
+  if (!resolved.ok()) {
+    return resolved.status();
+  }
+  status = add(measure("resolver/resolve_group_warm", iterations, edges, nullptr,
+                       [&] {
+    return pkg::Resolver::resolveGroup(root, cfg, group.value()).status();
+  }));
+  if (!status.ok()) return status;
+
+  pkg::Lockfile lock;
+  lock.state = "complete";
+  for (const auto& name : resolved.value().order) {
+    const auto& recipe = resolved.value().nodes.at(name).recipe;
+    pkg::LockEntry entry;
+    entry.name = recipe.name;
+    entry.version = recipe.version;
+    entry.status = "built";
+    entry.recipe = recipe.recipe_path.string();
+    entry.deps = recipe.deps;
+    entry.drv = recipe.manifest_sha256;
+    entry.store = "store/" + entry.drv.substr(0, 32) + "-" + recipe.name + "-" +
+                  recipe.version;
+    lock.entries.push_back(std::move(entry));
+  }
+  status = add(measure("lockfile/save", iterations, n, nullptr, [&] {
+    return pkg::LockfileStore::save(root, cfg, lock);
+  }));
+  if (!status.ok()) return status;
+
+  status = add(measure("lockfile/load", iterations, n, nullptr, [&] {
+    return pkg::LockfileStore::load(root, cfg).status();
+  }));
+  if (!status.ok()) return status;
+
+  const auto lock_path = (root / cfg.layout.lockfile).string();
+  status = add(measure("parse_file/lockfile", iterations, n, nullptr, [&] {
+    return pkg::toml_util::parseFile(std::filesystem::path(lock_path)).status();
+  }));
+  if (!status.ok()) return status;
+
+  cache.clear();
+  const auto json = toJson(options, edges, results);
+  if (options.out.empty()) {
+    std::cout << json;
+    return Status::Ok();
+  }
+  return writeFile(options.out, json);
+}
+
+template <typename T>
+bool parseNumber(const std::string& text, T& out) {
+  const auto* end = text.data() + text.size();
+  const auto [ptr, ec] = std::from_chars(text.data(), end, out);
+  return ec == std::errc() && ptr == end;
+}
+
+bool parseArgs(int argc, char** argv, Options& options) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::size_t i = 0;
+  if (!args.empty() && args[0] == "generate") {
+    options.generate_only = true;
+    ++i;
+  }
+  for (; i < args.size(); ++i) {
+    const auto& arg = args[i];
+    if (arg == "--keep") {
+      options.keep = true;
+      continue;
+    }
+    if (i + 1 >= args.size()) {
+      return false;
+    }
+    const auto& value = args[++i];
+    bool ok = true;
+    if (arg == "--ports") {
+      ok = parseNumber(value, options.shape.ports);
+    } else if (arg == "--fanout") {
+      ok = parseNumber(value, options.shape.fanout);
+    } else if (arg == "--depth") {
+      ok = parseNumber(value, options.shape.depth);
+    } else if (arg == "--seed") {
+      ok = parseNumber(value, options.shape.seed);
+    } else if (arg == "--iterations") {
+      ok = parseNumber(value, options.iterations) && options.iterations > 0;
+    } else if (arg == "--tree") {
+      options.tree = value;
+    } else if (arg == "--out") {
+      options.out = value;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return !(options.generate_only && options.tree.empty()) &&
+         options.shape.ports > 0 && options.shape.fanout > 0 &&
+         options.shape.depth > 0;
+}
+
+void printUsage() {
+  std::cerr << "Usage:\n"
+            << "  pkg_bench [--ports N] [--fanout K] [--depth D] [--seed S]\n"
+            << "            [--iterations R] [--tree DIR] [--keep] [--out FILE]\n"
+            << "  pkg_bench generate --tree DIR [--ports N] [--fanout K]\n"
+            << "            [--depth D] [--seed S]\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseArgs(argc, argv, options)) {
+    printUsage();
+    return 1;
+  }
+  const bool temporary = options.tree.empty();
+  if (temporary) {
+    options.tree = std::filesystem::temp_directory_path() /
+                   ("pkg-bench-" + std::to_string(::getpid()));
+  }
+
+  auto edges = generateTree(options.tree, options.shape);
+  if (!edges.ok()) {
+    std::cerr << "error: " << edges.status().message() << "\n";
+    return 1;
+  }
+  if (options.generate_only) {
+    std::cerr << "pkg_bench: wrote " << options.shape.ports << " ports, "
+              << edges.value() << " edges to " << options.tree.string() << "\n";
+    return 0;
+  }
+
+  const auto status = runSuite(options, edges.value());
+  if (temporary && !options.keep) {
+    std::error_code ec;
+    std::filesystem::remove_all(options.tree, ec);
+  }
+  if (!status.ok()) {
+    std::cerr << "error: " << status.message() << "\n";
+    return 1;
+  }
+  return 0;
+}
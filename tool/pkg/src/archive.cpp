@@ -0,0 +1,1163 @@
+#include "pkg/archive.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "pkg/process.hpp"
+
+#if defined(PKG_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(PKG_HAVE_LZMA)
+#include <lzma.h>
+#endif
+#if defined(PKG_HAVE_BZIP2)
+#include <bzlib.h>
+#endif
+#if defined(PKG_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace pkg {
+namespace {
+
+constexpr std::size_t kBlockSize = 512;
+constexpr std::size_t kChunkSize = 256 * 1024;
+// Enough to tell every supported codec apart, including ustar's magic.
+constexpr std::size_t kSniffSize = 262;
+
+std::string errnoMessage(const std::string& what, const std::string& path) {
+  return what + " " + path + ": " + std::strerror(errno);
+}
+
+Status writeAll(int fd, const char* data, std::size_t n,
+                const std::string& path) {
+  while (n > 0) {
+    const ssize_t written = ::write(fd, data, n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return Status{StatusCode::kIoError, errnoMessage("Failed to write", path)};
+    }
+    data += written;
+    n -= static_cast<std::size_t>(written);
+  }
+  return Status::Ok();
+}
+
+std::uint64_t parseOctal(const char* field, std::size_t len) {
+  std::uint64_t value = 0;
+  std::size_t i = 0;
+  while (i < len && (field[i] == ' ' || field[i] == '\0')) {
+    ++i;
+  }
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+    value = (value << 3) | static_cast<std::uint64_t>(field[i] - '0');
+  }
+  return value;
+}
+
+// Numeric header fields are octal text, or big-endian base-256 when the top
+// bit of the first byte is set (GNU extension for sizes over 8 GiB).
+std::uint64_t parseNumber(const char* field, std::size_t len) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(field);
+  if ((bytes[0] & 0x80) == 0) {
+    return parseOctal(field, len);
+  }
+  std::uint64_t value = bytes[0] & 0x7f;
+  for (std::size_t i = 1; i < len; ++i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+std::string fieldString(const char* field, std::size_t len) {
+  return std::string(field, strnlen(field, len));
+}
+
+// pax times are decimal seconds with an optional fraction.
+struct timespec parsePaxTime(const std::string& value) {
+  struct timespec out {};
+  char* end = nullptr;
+  out.tv_sec = static_cast<time_t>(std::strtoll(value.c_str(), &end, 10));
+  if (end != nullptr && *end == '.') {
+    long scale = 100000000;
+    for (++end; *end >= '0' && *end <= '9' && scale > 0; ++end, scale /= 10) {
+      out.tv_nsec += (*end - '0') * scale;
+    }
+  }
+  return out;
+}
+
+// Consumes the decompressed tar stream and materializes it under dest.
+class TarSink {
+ public:
+  TarSink(std::filesystem::path dest, int strip, ExtractStats& stats)
+      : dest_(std::move(dest)), strip_(strip), stats_(stats) {
+    buffer_.reserve(kChunkSize);
+  }
+
+  ~TarSink() { closeFile(); }
+
+  Status feed(const char* data, std::size_t n) {
+    while (n > 0) {
+      std::size_t used = 0;
+      switch (state_) {
+        case State::kHeader: {
+          used = std::min(n, kBlockSize - header_fill_);
+          std::memcpy(header_ + header_fill_, data, used);
+          header_fill_ += used;
+          if (header_fill_ == kBlockSize) {
+            header_fill_ = 0;
+            auto s = onHeader();
+            if (!s.ok()) {
+              return s;
+            }
+          }
+          break;
+        }
+        case State::kData: {
+          used = static_cast<std::size_t>(
+              std::min<std::uint64_t>(n, remaining_));
+          if (fd_ >= 0) {
+            auto s = append(data, used);
+            if (!s.ok()) {
+              return s;
+            }
+          } else if (meta_ != Meta::kNone) {
+            meta_data_.append(data, used);
+          }
+          remaining_ -= used;
+          if (remaining_ == 0) {
+            auto s = endEntry();
+            if (!s.ok()) {
+              return s;
+            }
+          }
+          break;
+        }
+        case State::kPadding: {
+          used = static_cast<std::size_t>(
+              std::min<std::uint64_t>(n, remaining_));
+          remaining_ -= used;
+          if (remaining_ == 0) {
+            state_ = State::kHeader;
+          }
+          break;
+        }
+        case State::kEnd:
+          // Trailing zero blocks and record padding.
+          return Status::Ok();
+      }
+      data += used;
+      n -= used;
+    }
+    return Status::Ok();
+  }
+
+  Status finish() {
+    if (state_ != State::kEnd && !(state_ == State::kHeader &&
+                                   header_fill_ == 0 && saw_entry_)) {
+      return Status{StatusCode::kParseError, "Truncated tar archive"};
+    }
+    // Deepest first, so a read-only parent is locked down last.
+    for (auto it = dirs_.rbegin(); it != dirs_.rend(); ++it) {
+      const auto full = dest_ / it->path;
+      if (::chmod(full.c_str(), it->mode) != 0) {
+        return Status{StatusCode::kIoError,
+                      errnoMessage("Failed to chmod", full.string())};
+      }
+      setMtime(full, it->mtime, 0);
+    }
+    dirs_.clear();
+    return Status::Ok();
+  }
+
+ private:
+  enum class State { kHeader, kData, kPadding, kEnd };
+  enum class Meta { kNone, kPax, kGlobalPax, kLongName, kLongLink };
+
+  struct PendingDir {
+    std::string path;
+    mode_t mode;
+    struct timespec mtime;
+  };
+
+  Status onHeader() {
+    const bool zero = std::all_of(header_, header_ + kBlockSize,
+                                  [](char c) { return c == '\0'; });
+    if (zero) {
+      if (++zero_blocks_ == 2) {
+        state_ = State::kEnd;
+      }
+      return Status::Ok();
+    }
+    zero_blocks_ = 0;
+
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < kBlockSize; ++i) {
+      const bool in_checksum = i >= 148 && i < 156;
+      sum += in_checksum ? ' ' : static_cast<unsigned char>(header_[i]);
+    }
+    if (sum != parseOctal(header_ + 148, 8)) {
+      return Status{StatusCode::kParseError,
+                    "Bad tar header checksum (not a tar archive?)"};
+    }
+    saw_entry_ = true;
+
+    const char type = header_[156];
+    meta_ = Meta::kNone;
+    switch (type) {
+      case 'x':
+        meta_ = Meta::kPax;
+        break;
+      case 'g':
+        meta_ = Meta::kGlobalPax;
+        break;
+      case 'L':
+        meta_ = Meta::kLongName;
+        break;
+      case 'K':
+        meta_ = Meta::kLongLink;
+        break;
+      default:
+        break;
+    }
+    // Extension headers describe the entry that follows them, so a pax
+    // size override only ever applies to a real entry.
+    std::uint64_t size = parseNumber(header_ + 124, 12);
+    if (meta_ == Meta::kNone && pax_size_) {
+      size = *pax_size_;
+    }
+    remaining_ = size;
+    padding_ = (kBlockSize - size % kBlockSize) % kBlockSize;
+    if (meta_ != Meta::kNone) {
+      meta_data_.clear();
+      return startData();
+    }
+
+    std::string name;
+    if (long_name_) {
+      name = std::move(*long_name_);
+    } else {
+      name = fieldString(header_, 100);
+      const std::string prefix = fieldString(header_ + 345, 155);
+      // Only POSIX ustar has a prefix field; GNU headers reuse the bytes.
+      if (std::memcmp(header_ + 257, "ustar\0", 6) == 0 && !prefix.empty()) {
+        name = prefix + "/" + name;
+      }
+    }
+    std::string link = long_link_ ? std::move(*long_link_)
+                                  : fieldString(header_ + 157, 100);
+    long_name_.reset();
+    long_link_.reset();
+    pax_size_.reset();
+
+    const auto mode = static_cast<mode_t>(parseOctal(header_ + 100, 8) & 0777);
+    struct timespec mtime {
+      static_cast<time_t>(parseNumber(header_ + 136, 12)), 0
+    };
+    if (pax_mtime_) {
+      mtime = *pax_mtime_;
+      pax_mtime_.reset();
+    }
+
+    auto mapped = mapPath(name);
+    if (!mapped.ok()) {
+      return mapped.status();
+    }
+    const std::string rel = mapped.value();
+    if (rel.empty()) {
+      // Stripped away entirely, e.g. the top-level directory.
+      return startData();
+    }
+
+    Status s;
+    if (type == '5' || ((type == '0' || type == '\0') && !name.empty() &&
+                        name.back() == '/')) {
+      s = makeDir(rel, mode, mtime);
+    } else if (type == '0' || type == '\0' || type == '7') {
+      s = openFile(rel, mode, mtime);
+    } else if (type == '2') {
+      s = makeSymlink(rel, link, mtime);
+    } else if (type == '1') {
+      s = makeHardlink(rel, link);
+    }
+    // Devices, FIFOs and unknown types are skipped.
+    if (!s.ok()) {
+      return s;
+    }
+    return startData();
+  }
+
+  Status startData() {
+    state_ = remaining_ > 0 ? State::kData : State::kPadding;
+    if (remaining_ == 0) {
+      return endEntry();
+    }
+    return Status::Ok();
+  }
+
+  Status endEntry() {
+    if (fd_ >= 0) {
+      auto s = closeFile();
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    if (meta_ != Meta::kNone) {
+      auto s = applyMeta();
+      meta_ = Meta::kNone;
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    remaining_ = padding_;
+    padding_ = 0;
+    state_ = remaining_ > 0 ? State::kPadding : State::kHeader;
+    return Status::Ok();
+  }
+
+  Status applyMeta() {
+    if (meta_ == Meta::kLongName || meta_ == Meta::kLongLink) {
+      std::string value(meta_data_.c_str());
+      (meta_ == Meta::kLongName ? long_name_ : long_link_) = std::move(value);
+      return Status::Ok();
+    }
+    if (meta_ != Meta::kPax) {
+      return Status::Ok();
+    }
+    // Records are "<len> <key>=<value>\n", with len covering the record.
+    std::size_t pos = 0;
+    while (pos < meta_data_.size()) {
+      const auto space = meta_data_.find(' ', pos);
+      if (space == std::string::npos) {
+        return Status{StatusCode::kParseError, "Truncated pax header record"};
+      }
+      char* end = nullptr;
+      const auto len = std::strtoull(meta_data_.c_str() + pos, &end, 10);
+      if (end != meta_data_.c_str() + space || len == 0 ||
+          len > meta_data_.size() - pos || space + 1 >= pos + len ||
+          meta_data_[pos + len - 1] != '\n') {
+        return Status{StatusCode::kParseError, "Malformed pax header record"};
+      }
+      const std::string_view record(meta_data_.data() + space + 1,
+                                    pos + len - space - 2);
+      const auto eq = record.find('=');
+      if (eq != std::string_view::npos) {
+        const auto key = record.substr(0, eq);
+        const std::string value(record.substr(eq + 1));
+        if (key == "path") {
+          long_name_ = value;
+        } else if (key == "linkpath") {
+          long_link_ = value;
+        } else if (key == "size") {
+          pax_size_ = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "mtime") {
+          pax_mtime_ = parsePaxTime(value);
+        }
+      }
+      pos += len;
+    }
+    return Status::Ok();
+  }
+
+  Result<std::string> mapPath(const std::string& name) const {
+    std::vector<std::string_view> parts;
+    std::string_view rest(name);
+    while (!rest.empty()) {
+      const auto slash = rest.find('/');
+      const auto part = rest.substr(0, slash);
+      rest = slash == std::string_view::npos ? std::string_view{}
+                                             : rest.substr(slash + 1);
+      if (part.empty() || part == ".") {
+        continue;
+      }
+      if (part == "..") {
+        return Status{StatusCode::kInvalidArgument,
+                      "Refusing archive entry outside the destination: " +
+                          name};
+      }
+      parts.push_back(part);
+    }
+    std::string out;
+    for (std::size_t i = static_cast<std::size_t>(strip_); i < parts.size();
+         ++i) {
+      if (!out.empty()) {
+        out += '/';
+      }
+      out += parts[i];
+    }
+    return out;
+  }
+
+  // Creates the parent directories of rel, refusing to pass through
+  // anything that is not a real directory.
+  Status ensureParents(const std::string& rel) {
+    std::size_t slash = rel.find('/');
+    while (slash != std::string::npos) {
+      auto s = ensureDir(rel.substr(0, slash));
+      if (!s.ok()) {
+        return s;
+      }
+      slash = rel.find('/', slash + 1);
+    }
+    return Status::Ok();
+  }
+
+  Status ensureDir(const std::string& rel) {
+    if (known_dirs_.count(rel) != 0) {
+      return Status::Ok();
+    }
+    const auto full = dest_ / rel;
+    struct stat st {};
+    if (::lstat(full.c_str(), &st) != 0) {
+      if (errno != ENOENT || (::mkdir(full.c_str(), 0755) != 0 &&
+                              errno != EEXIST)) {
+        return Status{StatusCode::kIoError,
+                      errnoMessage("Failed to create directory",
+                                   full.string())};
+      }
+    } else if (!S_ISDIR(st.st_mode)) {
+      return Status{StatusCode::kInvalidArgument,
+                    "Refusing archive entry through non-directory: " + rel};
+    }
+    known_dirs_.insert(rel);
+    return Status::Ok();
+  }
+
+  // Clears the way for a new non-directory entry at full.
+  Status removeExisting(const std::filesystem::path& full) {
+    if (::unlink(full.c_str()) != 0 && errno != ENOENT) {
+      return Status{StatusCode::kIoError,
+                    errnoMessage("Failed to replace", full.string())};
+    }
+    return Status::Ok();
+  }
+
+  Status makeDir(const std::string& rel, mode_t mode,
+                 const struct timespec& mtime) {
+    auto s = ensureParents(rel);
+    if (s.ok()) {
+      s = ensureDir(rel);
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    // Owner write is kept until finish() so the contents can be created.
+    ::chmod((dest_ / rel).c_str(), mode | S_IRWXU);
+    dirs_.push_back(PendingDir{rel, mode, mtime});
+    ++stats_.entries;
+    return Status::Ok();
+  }
+
+  Status openFile(const std::string& rel, mode_t mode,
+                  const struct timespec& mtime) {
+    auto s = ensureParents(rel);
+    if (!s.ok()) {
+      return s;
+    }
+    const auto full = dest_ / rel;
+    s = removeExisting(full);
+    if (!s.ok()) {
+      return s;
+    }
+    fd_ = ::open(full.c_str(),
+                 O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+      return Status{StatusCode::kIoError,
+                    errnoMessage("Failed to create", full.string())};
+    }
+    file_path_ = full.string();
+    file_mode_ = mode;
+    file_mtime_ = mtime;
+    known_files_.insert(rel);
+    ++stats_.entries;
+    return Status::Ok();
+  }
+
+  // Small files are gathered into one write; large runs bypass the buffer.
+  Status append(const char* data, std::size_t n) {
+    stats_.bytes_written += n;
+    if (buffer_.size() + n > kChunkSize) {
+      auto s = flush();
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    if (n >= kChunkSize) {
+      return writeAll(fd_, data, n, file_path_);
+    }
+    buffer_.insert(buffer_.end(), data, data + n);
+    return Status::Ok();
+  }
+
+  Status flush() {
+    if (buffer_.empty()) {
+      return Status::Ok();
+    }
+    auto s = writeAll(fd_, buffer_.data(), buffer_.size(), file_path_);
+    buffer_.clear();
+    return s;
+  }
+
+  Status closeFile() {
+    if (fd_ < 0) {
+      return Status::Ok();
+    }
+    auto s = flush();
+    if (s.ok() && ::fchmod(fd_, file_mode_) != 0) {
+      s = Status{StatusCode::kIoError,
+                 errnoMessage("Failed to chmod", file_path_)};
+    }
+    if (s.ok()) {
+      const struct timespec times[2] = {{0, UTIME_OMIT}, file_mtime_};
+      ::futimens(fd_, times);
+    }
+    if (::close(fd_) != 0 && s.ok()) {
+      s = Status{StatusCode::kIoError,
+                 errnoMessage("Failed to close", file_path_)};
+    }
+    fd_ = -1;
+    buffer_.clear();
+    return s;
+  }
+
+  Status makeSymlink(const std::string& rel, const std::string& target,
+                     const struct timespec& mtime) {
+    auto s = ensureParents(rel);
+    if (!s.ok()) {
+      return s;
+    }
+    const auto full = dest_ / rel;
+    s = removeExisting(full);
+    if (!s.ok()) {
+      return s;
+    }
+    known_files_.erase(rel);
+    if (::symlink(target.c_str(), full.c_str()) != 0) {
+      return Status{StatusCode::kIoError,
+                    errnoMessage("Failed to create symlink", full.string())};
+    }
+    setMtime(full, mtime, AT_SYMLINK_NOFOLLOW);
+    ++stats_.entries;
+    return Status::Ok();
+  }
+
+  Status makeHardlink(const std::string& rel, const std::string& target) {
+    auto mapped = mapPath(target);
+    if (!mapped.ok()) {
+      return mapped.status();
+    }
+    if (mapped.value().empty()) {
+      return Status{StatusCode::kInvalidArgument,
+                    "Hard link target stripped away: " + target};
+    }
+    // link() resolves every component of the target, so a symlink among
+    // its parents would reach outside the destination. Only files this
+    // archive created, under directories it vetted, are acceptable.
+    if (known_files_.count(mapped.value()) == 0) {
+      return Status{StatusCode::kInvalidArgument,
+                    "Refusing hard link to a file not extracted from the "
+                    "archive: " + target};
+    }
+    auto s = ensureParents(mapped.value());
+    if (!s.ok()) {
+      return s;
+    }
+    const auto source = dest_ / mapped.value();
+    struct stat st {};
+    if (::lstat(source.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      return Status{StatusCode::kInvalidArgument,
+                    "Refusing hard link to a non-regular file: " + target};
+    }
+    s = ensureParents(rel);
+    if (!s.ok()) {
+      return s;
+    }
+    const auto full = dest_ / rel;
+    s = removeExisting(full);
+    if (!s.ok()) {
+      return s;
+    }
+    // Without AT_SYMLINK_FOLLOW the last component is never followed.
+    if (::linkat(AT_FDCWD, source.c_str(), AT_FDCWD, full.c_str(), 0) != 0) {
+      return Status{StatusCode::kIoError,
+                    errnoMessage("Failed to create hard link", full.string())};
+    }
+    known_files_.insert(rel);
+    ++stats_.entries;
+    return Status::Ok();
+  }
+
+  static void setMtime(const std::filesystem::path& full,
+                       const struct timespec& mtime, int flags) {
+    const struct timespec times[2] = {{0, UTIME_OMIT}, mtime};
+    ::utimensat(AT_FDCWD, full.c_str(), times, flags);
+  }
+
+  std::filesystem::path dest_;
+  int strip_;
+  ExtractStats& stats_;
+
+  State state_ = State::kHeader;
+  char header_[kBlockSize];
+  std::size_t header_fill_ = 0;
+  int zero_blocks_ = 0;
+  bool saw_entry_ = false;
+  std::uint64_t remaining_ = 0;
+  std::uint64_t padding_ = 0;
+
+  Meta meta_ = Meta::kNone;
+  std::string meta_data_;
+  std::optional<std::string> long_name_;
+  std::optional<std::string> long_link_;
+  std::optional<std::uint64_t> pax_size_;
+  std::optional<struct timespec> pax_mtime_;
+
+  int fd_ = -1;
+  std::string file_path_;
+  mode_t file_mode_ = 0644;
+  struct timespec file_mtime_ {};
+  std::vector<char> buffer_;
+
+  std::unordered_set<std::string> known_dirs_;
+  // Regular files created by this archive, the only valid hard link
+  // targets.
+  std::unordered_set<std::string> known_files_;
+  std::vector<PendingDir> dirs_;
+};
+
+
+class Decoder {
+ public:
+  virtual ~Decoder() = default;
+  virtual Status feed(const char* data, std::size_t n, TarSink& sink) = 0;
+  // Called once at end of input; fails if the stream was cut short.
+  virtual Status finish(TarSink& sink) = 0;
+};
+
+class PlainDecoder final : public Decoder {
+ public:
+  Status feed(const char* data, std::size_t n, TarSink& sink) override {
+    return sink.feed(data, n);
+  }
+  Status finish(TarSink&) override { return Status::Ok(); }
+};
+
+#if defined(PKG_HAVE_ZLIB)
+class GzipDecoder final : public Decoder {
+ public:
+  GzipDecoder() : out_(kChunkSize) {}
+  ~GzipDecoder() override {
+    if (initialized_) {
+      inflateEnd(&zs_);
+    }
+  }
+
+  Status feed(const char* data, std::size_t n, TarSink& sink) override {
+    if (!initialized_) {
+      // 15 + 32: maximum window, gzip or zlib header detected automatically.
+      if (inflateInit2(&zs_, 15 + 32) != Z_OK) {
+        return Status{StatusCode::kInternalError, "inflateInit2 failed"};
+      }
+      initialized_ = true;
+    }
+    zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs_.avail_in = static_cast<uInt>(n);
+    while (zs_.avail_in > 0) {
+      if (ended_) {
+        // Zero padding after the last member is ignored, as gzip does.
+        if (std::all_of(zs_.next_in, zs_.next_in + zs_.avail_in,
+                        [](Bytef b) { return b == 0; })) {
+          return Status::Ok();
+        }
+        // Concatenated members, as produced by pigz or `cat a.gz b.gz`.
+        inflateReset(&zs_);
+        ended_ = false;
+      }
+      zs_.next_out = reinterpret_cast<Bytef*>(out_.data());
+      zs_.avail_out = static_cast<uInt>(out_.size());
+      const int rc = inflate(&zs_, Z_NO_FLUSH);
+      if (rc != Z_OK && rc != Z_STREAM_END) {
+        return Status{StatusCode::kParseError,
+                      std::string("gzip: ") +
+                          (zs_.msg != nullptr ? zs_.msg : "corrupt stream")};
+      }
+      auto s = sink.feed(out_.data(), out_.size() - zs_.avail_out);
+      if (!s.ok()) {
+        return s;
+      }
+      ended_ = rc == Z_STREAM_END;
+    }
+    return Status::Ok();
+  }
+
+  Status finish(TarSink& sink) override {
+    // Drain output that did not fit into the last buffer.
+    while (initialized_ && !ended_) {
+      zs_.next_out = reinterpret_cast<Bytef*>(out_.data());
+      zs_.avail_out = static_cast<uInt>(out_.size());
+      const int rc = inflate(&zs_, Z_FINISH);
+      auto s = sink.feed(out_.data(), out_.size() - zs_.avail_out);
+      if (!s.ok()) {
+        return s;
+      }
+      if (rc == Z_STREAM_END) {
+        ended_ = true;
+      } else if (zs_.avail_out != 0) {
+        return Status{StatusCode::kParseError, "gzip: truncated stream"};
+      }
+    }
+    return Status::Ok();
+  }
+
+ private:
+  z_stream zs_{};
+  std::vector<char> out_;
+  bool initialized_ = false;
+  bool ended_ = false;
+};
+#endif
+
+#if defined(PKG_HAVE_LZMA)
+class XzDecoder final : public Decoder {
+ public:
+  XzDecoder() : out_(kChunkSize) {}
+  ~XzDecoder() override { lzma_end(&xs_); }
+
+  Status feed(const char* data, std::size_t n, TarSink& sink) override {
+    xs_.next_in = reinterpret_cast<const std::uint8_t*>(data);
+    xs_.avail_in = n;
+    return run(LZMA_RUN, sink);
+  }
+
+  Status finish(TarSink& sink) override {
+    xs_.next_in = nullptr;
+    xs_.avail_in = 0;
+    return run(LZMA_FINISH, sink);
+  }
+
+ private:
+  Status run(lzma_action action, TarSink& sink) {
+    if (!initialized_) {
+      if (lzma_stream_decoder(&xs_, UINT64_MAX, LZMA_CONCATENATED) !=
+          LZMA_OK) {
+        return Status{StatusCode::kInternalError, "lzma_stream_decoder failed"};
+      }
+      initialized_ = true;
+    }
+    while (true) {
+      xs_.next_out = reinterpret_cast<std::uint8_t*>(out_.data());
+      xs_.avail_out = out_.size();
+      const lzma_ret rc = lzma_code(&xs_, action);
+      auto s = sink.feed(out_.data(), out_.size() - xs_.avail_out);
+      if (!s.ok()) {
+        return s;
+      }
+      if (rc == LZMA_STREAM_END) {
+        return Status::Ok();
+      }
+      if (rc != LZMA_OK) {
+        return Status{StatusCode::kParseError,
+                      "xz: corrupt or truncated stream (code " +
+                          std::to_string(static_cast<int>(rc)) + ")"};
+      }
+      if (xs_.avail_in == 0 && xs_.avail_out != 0 && action == LZMA_RUN) {
+        return Status::Ok();
+      }
+    }
+  }
+
+  lzma_stream xs_ = LZMA_STREAM_INIT;
+  std::vector<char> out_;
+  bool initialized_ = false;
+};
+#endif
+
+#if defined(PKG_HAVE_BZIP2)
+class Bzip2Decoder final : public Decoder {
+ public:
+  Bzip2Decoder() : out_(kChunkSize) {}
+  ~Bzip2Decoder() override {
+    if (initialized_) {
+      BZ2_bzDecompressEnd(&bs_);
+    }
+  }
+
+  Status feed(const char* data, std::size_t n, TarSink& sink) override {
+    bs_.next_in = const_cast<char*>(data);
+    bs_.avail_in = static_cast<unsigned int>(n);
+    while (bs_.avail_in > 0) {
+      if (!initialized_) {
+        // Also restarts after each stream of a multi-stream file (pbzip2).
+        if (BZ2_bzDecompressInit(&bs_, 0, 0) != BZ_OK) {
+          return Status{StatusCode::kInternalError,
+                        "BZ2_bzDecompressInit failed"};
+        }
+        initialized_ = true;
+      }
+      bs_.next_out = out_.data();
+      bs_.avail_out = static_cast<unsigned int>(out_.size());
+      const int rc = BZ2_bzDecompress(&bs_);
+      if (rc != BZ_OK && rc != BZ_STREAM_END) {
+        return Status{StatusCode::kParseError,
+                      "bzip2: corrupt stream (code " + std::to_string(rc) +
+                          ")"};
+      }
+      auto s = sink.feed(out_.data(), out_.size() - bs_.avail_out);
+      if (!s.ok()) {
+        return s;
+      }
+      ended_ = rc == BZ_STREAM_END;
+      if (ended_) {
+        // Keep the unread input across the reinitialization.
+        char* next_in = bs_.next_in;
+        const unsigned int avail_in = bs_.avail_in;
+        BZ2_bzDecompressEnd(&bs_);
+        bs_ = bz_stream{};
+        bs_.next_in = next_in;
+        bs_.avail_in = avail_in;
+        initialized_ = false;
+      }
+    }
+    return Status::Ok();
+  }
+
+  Status finish(TarSink& sink) override {
+    while (initialized_ && !ended_) {
+      bs_.next_out = out_.data();
+      bs_.avail_out = static_cast<unsigned int>(out_.size());
+      const int rc = BZ2_bzDecompress(&bs_);
+      auto s = sink.feed(out_.data(), out_.size() - bs_.avail_out);
+      if (!s.ok()) {
+        return s;
+      }
+      if (rc == BZ_STREAM_END) {
+        ended_ = true;
+      } else if (rc != BZ_OK || bs_.avail_out != 0) {
+        return Status{StatusCode::kParseError, "bzip2: truncated stream"};
+      }
+    }
+    return Status::Ok();
+  }
+
+ private:
+  bz_stream bs_{};
+  std::vector<char> out_;
+  bool initialized_ = false;
+  bool ended_ = false;
+};
+#endif
+
+#if defined(PKG_HAVE_ZSTD)
+class ZstdDecoder final : public Decoder {
+ public:
+  ZstdDecoder() : out_(ZSTD_DStreamOutSize()), ds_(ZSTD_createDStream()) {}
+  ~ZstdDecoder() override { ZSTD_freeDStream(ds_); }
+
+  Status feed(const char* data, std::size_t n, TarSink& sink) override {
+    ZSTD_inBuffer in{data, n, 0};
+    // A full output buffer may leave decoded bytes inside the stream.
+    while (in.pos < in.size || out_full_) {
+      ZSTD_outBuffer out{out_.data(), out_.size(), 0};
+      const std::size_t rc = ZSTD_decompressStream(ds_, &out, &in);
+      if (ZSTD_isError(rc)) {
+        return Status{StatusCode::kParseError,
+                      std::string("zstd: ") + ZSTD_getErrorName(rc)};
+      }
+      auto s = sink.feed(out_.data(), out.pos);
+      if (!s.ok()) {
+        return s;
+      }
+      out_full_ = out.pos == out.size;
+      frame_done_ = rc == 0;
+    }
+    return Status::Ok();
+  }
+
+  Status finish(TarSink& sink) override {
+    auto s = feed(nullptr, 0, sink);
+    if (s.ok() && !frame_done_) {
+      s = Status{StatusCode::kParseError, "zstd: truncated stream"};
+    }
+    return s;
+  }
+
+ private:
+  std::vector<char> out_;
+  ZSTD_DStream* ds_;
+  bool out_full_ = false;
+  bool frame_done_ = false;
+};
+#endif
+
+}  // namespace
+
+struct ArchiveExtractor::Pipeline {
+  TarSink sink;
+  std::unique_ptr<Decoder> decoder;
+
+  Pipeline(const std::filesystem::path& dest, int strip, ExtractStats& stats)
+      : sink(dest, strip, stats) {}
+};
+
+ArchiveExtractor::ArchiveExtractor(std::filesystem::path dest,
+                                   ExtractOptions options)
+    : dest_(std::move(dest)), options_(std::move(options)) {}
+
+ArchiveExtractor::~ArchiveExtractor() = default;
+
+ArchiveCodec ArchiveExtractor::detect(std::string_view head) {
+  const auto starts = [&](std::string_view magic) {
+    return head.substr(0, magic.size()) == magic;
+  };
+  if (starts("\x1f\x8b")) {
+    return ArchiveCodec::kGzip;
+  }
+  if (starts(std::string_view("\xfd" "7zXZ\0", 6))) {
+    return ArchiveCodec::kXz;
+  }
+  if (starts("BZh")) {
+    return ArchiveCodec::kBzip2;
+  }
+  if (starts("\x28\xb5\x2f\xfd")) {
+    return ArchiveCodec::kZstd;
+  }
+  if (head.size() < kSniffSize) {
+    return ArchiveCodec::kUnknown;
+  }
+  // Anything else is treated as a plain tar; the header checksum rejects
+  // formats that are not.
+  return ArchiveCodec::kTar;
+}
+
+bool ArchiveExtractor::builtIn(ArchiveCodec codec) {
+  switch (codec) {
+    case ArchiveCodec::kTar:
+      return true;
+#if defined(PKG_HAVE_ZLIB)
+    case ArchiveCodec::kGzip:
+      return true;
+#endif
+#if defined(PKG_HAVE_LZMA)
+    case ArchiveCodec::kXz:
+      return true;
+#endif
+#if defined(PKG_HAVE_BZIP2)
+    case ArchiveCodec::kBzip2:
+      return true;
+#endif
+#if defined(PKG_HAVE_ZSTD)
+    case ArchiveCodec::kZstd:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* ArchiveExtractor::codecName(ArchiveCodec codec) {
+  switch (codec) {
+    case ArchiveCodec::kTar:
+      return "tar";
+    case ArchiveCodec::kGzip:
+      return "gzip";
+    case ArchiveCodec::kXz:
+      return "xz";
+    case ArchiveCodec::kBzip2:
+      return "bzip2";
+    case ArchiveCodec::kZstd:
+      return "zstd";
+    case ArchiveCodec::kUnknown:
+      break;
+  }
+  return "unknown";
+}
+
+Status ArchiveExtractor::start() {
+  if (!builtIn(codec_)) {
+    return Status{StatusCode::kNotFound,
+                  std::string("No built-in decoder for ") + codecName(codec_) +
+                      " archives"};
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(dest_, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create " + dest_.string() + ": " + ec.message()};
+  }
+  pipeline_ = std::make_unique<Pipeline>(dest_, options_.strip_components,
+                                         stats_);
+  switch (codec_) {
+#if defined(PKG_HAVE_ZLIB)
+    case ArchiveCodec::kGzip:
+      pipeline_->decoder = std::make_unique<GzipDecoder>();
+      break;
+#endif
+#if defined(PKG_HAVE_LZMA)
+    case ArchiveCodec::kXz:
+      pipeline_->decoder = std::make_unique<XzDecoder>();
+      break;
+#endif
+#if defined(PKG_HAVE_BZIP2)
+    case ArchiveCodec::kBzip2:
+      pipeline_->decoder = std::make_unique<Bzip2Decoder>();
+      break;
+#endif
+#if defined(PKG_HAVE_ZSTD)
+    case ArchiveCodec::kZstd:
+      pipeline_->decoder = std::make_unique<ZstdDecoder>();
+      break;
+#endif
+    default:
+      pipeline_->decoder = std::make_unique<PlainDecoder>();
+      break;
+  }
+  return Status::Ok();
+}
+
+Status ArchiveExtractor::write(std::string_view chunk) {
+  if (!options_.expected_sha256.empty()) {
+    hasher_.update(chunk);
+  }
+  stats_.input_bytes += chunk.size();
+  if (!pipeline_) {
+    // Hold back the first bytes until the codec can be identified.
+    head_.append(chunk);
+    codec_ = detect(head_);
+    if (codec_ == ArchiveCodec::kUnknown) {
+      return Status::Ok();
+    }
+    auto s = start();
+    if (!s.ok()) {
+      return s;
+    }
+    chunk = head_;
+  }
+  auto s = pipeline_->decoder->feed(chunk.data(), chunk.size(), pipeline_->sink);
+  head_.clear();
+  return s;
+}
+
+Status ArchiveExtractor::finish() {
+  if (!pipeline_) {
+    // Shorter than the sniff window: only a tiny plain tar fits.
+    codec_ = head_.empty() ? ArchiveCodec::kUnknown : detect(head_);
+    if (codec_ == ArchiveCodec::kUnknown) {
+      codec_ = ArchiveCodec::kTar;
+    }
+    auto s = start();
+    if (s.ok()) {
+      s = pipeline_->decoder->feed(head_.data(), head_.size(), pipeline_->sink);
+    }
+    head_.clear();
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  auto s = pipeline_->decoder->finish(pipeline_->sink);
+  if (s.ok()) {
+    s = pipeline_->sink.finish();
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  if (!options_.expected_sha256.empty()) {
+    const std::string actual = hasher_.finishHex();
+    if (actual != options_.expected_sha256) {
+      return Status{StatusCode::kConflict,
+                    "sha256 mismatch: expected " + options_.expected_sha256 +
+                        " got " + actual};
+    }
+  }
+  return Status::Ok();
+}
+
+Result<ExtractStats> ArchiveExtractor::extractFile(
+    const std::filesystem::path& archive,
+    const std::filesystem::path& dest,
+    const ExtractOptions& options) {
+  const int fd = ::open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status{StatusCode::kIoError,
+                  errnoMessage("Failed to open", archive.string())};
+  }
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  ArchiveExtractor extractor(dest, options);
+  std::vector<char> buf(kChunkSize * 4);
+  Status s;
+  while (true) {
+    const ssize_t got = ::read(fd, buf.data(), buf.size());
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      s = Status{StatusCode::kIoError,
+                 errnoMessage("Failed to read", archive.string())};
+      break;
+    }
+    if (got == 0) {
+      s = extractor.finish();
+      break;
+    }
+    s = extractor.write(std::string_view(buf.data(), static_cast<std::size_t>(got)));
+    if (!s.ok()) {
+      break;
+    }
+  }
+  ::close(fd);
+  if (s.ok()) {
+    return extractor.stats();
+  }
+  const bool fallback =
+      s.code() == StatusCode::kNotFound && !extractor.pipeline_;
+  if (!fallback && s.code() == StatusCode::kConflict) {
+    return s;
+  }
+  // A decode error stops the pass before the digest is known; tell a
+  // damaged file apart from a broken archive.
+  if (!options.expected_sha256.empty()) {
+    auto actual = Sha256::hashFileHex(archive);
+    if (!actual.ok()) {
+      return actual.status();
+    }
+    if (actual.value() != options.expected_sha256) {
+      return Status{StatusCode::kConflict,
+                    "sha256 mismatch: expected " + options.expected_sha256 +
+                        " got " + actual.value()};
+    }
+  }
+  if (!fallback) {
+    return s;
+  }
+
+  // No decoder compiled in for this codec; tar knows how to call the
+  // matching decompressor.
+  s = Process::runToLog(
+      {"tar", "-xf", archive.string(), "-C", dest.string(),
+       "--strip-components=" + std::to_string(options.strip_components)},
+      options.log_path);
+  if (!s.ok()) {
+    return s;
+  }
+  ExtractStats stats;
+  std::error_code ec;
+  stats.input_bytes = std::filesystem::file_size(archive, ec);
+  return stats;
+}
+
+}  // namespace pkg
@@ -0,0 +1,119 @@
+#include "pkg/arena.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace pkg {
+
+struct Arena::Chunk {
+  Chunk* prev;
+  std::size_t size;
+};
+
+namespace {
+
+char* alignUp(char* p, std::size_t align) {
+  const auto addr = reinterpret_cast<std::uintptr_t>(p);
+  return p + ((align - addr % align) % align);
+}
+
+}  // namespace
+
+Arena::Arena(std::size_t first_chunk_size)
+    : next_size_(first_chunk_size == 0 ? kDefaultChunkSize : first_chunk_size) {}
+
+Arena::~Arena() {
+  while (head_ != nullptr) {
+    Chunk* prev = head_->prev;
+    std::free(head_);
+    head_ = prev;
+  }
+}
+
+bool Arena::grow(std::size_t min_size, std::size_t align) {
+  std::size_t size = next_size_;
+  while (size < min_size + align + sizeof(Chunk)) {
+    size *= 2;
+  }
+  auto* chunk = static_cast<Chunk*>(std::malloc(size));
+  if (chunk == nullptr) {
+    return false;
+  }
+  chunk->prev = head_;
+  chunk->size = size;
+  head_ = chunk;
+  cursor_ = reinterpret_cast<char*>(chunk + 1);
+  end_ = reinterpret_cast<char*>(chunk) + size;
+  last_ = nullptr;
+  next_size_ = size * 2;
+  ++chunks_;
+  reserved_ += size;
+  return true;
+}
+
+void* Arena::allocate(std::size_t size, std::size_t align) {
+  char* p = cursor_ != nullptr ? alignUp(cursor_, align) : nullptr;
+  if (p == nullptr || static_cast<std::size_t>(end_ - p) < size) {
+    if (!grow(size, align)) {
+      return nullptr;
+    }
+    p = alignUp(cursor_, align);
+  }
+  cursor_ = p + size;
+  last_ = p;
+  return p;
+}
+
+void* Arena::reallocate(void* ptr,
+                        std::size_t old_size,
+                        std::size_t new_size,
+                        std::size_t align) {
+  if (ptr == nullptr) {
+    return allocate(new_size, align);
+  }
+  char* p = static_cast<char*>(ptr);
+  if (p == last_ && static_cast<std::size_t>(end_ - p) >= new_size) {
+    cursor_ = p + new_size;
+    return p;
+  }
+  if (new_size <= old_size) {
+    return p;
+  }
+  void* moved = allocate(new_size, align);
+  if (moved != nullptr) {
+    std::memcpy(moved, p, old_size);
+  }
+  return moved;
+}
+
+std::string_view Arena::copy(std::string_view s) {
+  if (s.empty()) {
+    return {};
+  }
+  auto* p = static_cast<char*>(allocate(s.size(), 1));
+  if (p == nullptr) {
+    return {};
+  }
+  std::memcpy(p, s.data(), s.size());
+  return {p, s.size()};
+}
+
+void Arena::reset() {
+  if (head_ == nullptr) {
+    return;
+  }
+  // Keep the oldest (smallest) chunk; later ones were sized for a peak.
+  while (head_->prev != nullptr) {
+    Chunk* prev = head_->prev;
+    reserved_ -= head_->size;
+    std::free(head_);
+    head_ = prev;
+    --chunks_;
+  }
+  cursor_ = reinterpret_cast<char*>(head_ + 1);
+  end_ = reinterpret_cast<char*>(head_) + head_->size;
+  last_ = nullptr;
+}
+
+}  // namespace pkg
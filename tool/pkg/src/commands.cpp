@@ -1,20 +1,40 @@
 #include "pkg/commands.hpp"
 
 #include <algorithm>
-#include <cstdlib>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <unistd.h>
+
+#include "pkg/archive.hpp"
 #include "pkg/config.hpp"
+#include "pkg/derivation.hpp"
+#include "pkg/download_cache.hpp"
+#include "pkg/fetch.hpp"
 #include "pkg/group.hpp"
+#include "pkg/history.hpp"
+#include "pkg/jobserver.hpp"
 #include "pkg/lockfile.hpp"
 #include "pkg/port.hpp"
+#include "pkg/process.hpp"
+#include "pkg/recipe_cache.hpp"
 #include "pkg/resolver.hpp"
+#include "pkg/scheduler.hpp"
+#include "pkg/sha256.hpp"
+#include "pkg/substituter.hpp"
+#include "pkg/trace.hpp"
 
 namespace pkg {
 namespace {
@@ -22,11 +42,17 @@ namespace {
 void printUsage() {
   std::cout
       << "Usage:\n"
-      << "  pkg validate [--root <path>]\n"
+      << "  pkg validate [--changed] [--graph] [--root <path>]\n"
       << "  pkg resolve --group <name> [--root <path>]\n"
       << "  pkg resolve <port> [<port> ...] [--root <path>]\n"
-      << "  pkg build --group <name> [--root <path>]\n"
-      << "  pkg build <port> [<port> ...] [--root <path>]\n"
+      << "  pkg fetch --group <name> [--root <path>]\n"
+      << "  pkg fetch <port> [<port> ...] [--root <path>]\n"
+      << "  pkg build --group <name> [--keep-going] [--trace=<file>]\n"
+      << "            [--root <path>]\n"
+      << "  pkg build <port> [<port> ...] [--keep-going] [--trace=<file>]\n"
+      << "            [--root <path>]\n"
+      << "  pkg build --resume [--keep-going] [--trace=<file>] [--root <path>]\n"
+      << "  pkg stats [--root <path>]\n"
       << "  pkg apply [--root <path>]\n";
 }
 
@@ -34,157 +60,305 @@ void printStatusError(const Status& status) {
   std::cerr << "error: " << status.message() << "\n";
 }
 
-std::string shellQuote(const std::string& value) {
-  std::string out = "'";
-  for (char c : value) {
-    if (c == '\'') {
-      out += "'\\''";
-    } else {
-      out.push_back(c);
+// Unpacks a fetched url source into a fresh src_dir. Git sources were
+// cloned in place by the fetch stage and need nothing here.
+Status prepareSource(const PortRecipe& recipe,
+                     const FetchedSource& fetched,
+                     const std::filesystem::path& src_dir,
+                     const std::filesystem::path& log_path) {
+  std::error_code ec;
+  std::filesystem::create_directories(src_dir, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create source dir: " + src_dir.string()};
+  }
+  if (recipe.src.type != "url" || fetched.archive.empty() ||
+      fetched.unpacked) {
+    return Status::Ok();
+  }
+
+  std::filesystem::remove_all(src_dir, ec);
+  ec.clear();
+  std::filesystem::create_directories(src_dir, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to prepare source dir: " + src_dir.string()};
+  }
+
+  // Cache hits were verified when they were stored; re-checking the digest
+  // during the unpack pass costs no extra read and catches on-disk damage.
+  ExtractOptions options;
+  options.strip_components = 1;
+  options.log_path = log_path;
+  if (fetched.cached) {
+    options.expected_sha256 = recipe.src.sha256;
+  }
+  auto extracted = ArchiveExtractor::extractFile(fetched.archive, src_dir,
+                                                 options);
+  if (!extracted.ok()) {
+    if (fetched.cached &&
+        extracted.status().code() == StatusCode::kConflict) {
+      std::filesystem::remove(fetched.archive, ec);
+      return Status{StatusCode::kConflict,
+                    "Cached archive for " + recipe.name +
+                        " is corrupt and was removed: " +
+                        extracted.status().message()};
     }
+    return Status{extracted.status().code(),
+                  "Failed to unpack " + fetched.archive.string() + ": " +
+                      extracted.status().message()};
+  }
+  return Status::Ok();
+}
+
+// Runs one phase script and appends its resource usage to entry.phases,
+// whether or not it succeeds. The script sees only the PKG_* variables and
+// what `env` captured, never the rest of the caller's environment.
+Status runScript(const char* phase,
+                 const std::filesystem::path& script_path,
+                 const std::filesystem::path& log_path,
+                 const PortRecipe& recipe,
+                 const std::filesystem::path& root,
+                 const std::filesystem::path& src_dir,
+                 const std::filesystem::path& build_dir,
+                 const std::filesystem::path& store_dir,
+                 const BuildEnvironment& env,
+                 const Jobserver& jobserver,
+                 LockEntry& entry) {
+  ProcessSpec spec;
+  spec.argv = {"/bin/sh", script_path.string()};
+  spec.inherit_env = false;
+  spec.env = env.scriptEnv();
+  spec.env.insert(spec.env.end(), {
+      "PKG_NAME=" + recipe.name,
+      "PKG_VERSION=" + recipe.version,
+      "PKG_ROOT=" + root.string(),
+      "PKG_SRC_DIR=" + src_dir.string(),
+      "PKG_BUILD_DIR=" + build_dir.string(),
+      "PKG_STORE_DIR=" + store_dir.string(),
+      "PKG_JOBS=" + std::to_string(jobserver.jobs()),
+      "MAKEFLAGS=" + jobserver.makeflags(),
+  });
+  ProcessResult result;
+  auto s = Process::runToLog(std::move(spec), log_path, &result);
+  // A script that could not be spawned leaves `result` untouched.
+  if (result.exit_code >= 0 || result.term_signal != 0) {
+    PhaseUsage usage;
+    usage.phase = phase;
+    usage.exit_code = result.exit_code;
+    usage.term_signal = result.term_signal;
+    usage.wall_ms = result.wall_ms;
+    usage.user_ms = result.user_ms;
+    usage.sys_ms = result.sys_ms;
+    usage.max_rss_kb = result.max_rss_kb;
+    // rusage counts blocks of 512 bytes regardless of the filesystem.
+    usage.read_bytes = result.read_blocks * 512;
+    usage.write_bytes = result.write_blocks * 512;
+    entry.phases.push_back(std::move(usage));
   }
-  out.push_back('\'');
-  return out;
+  return s;
+}
+
+struct BuildContext {
+  const std::filesystem::path& root;
+  const Config& cfg;
+  std::filesystem::path logs_dir;
+  const BuildEnvironment& env;
+  Jobserver& jobserver;
+  BuildTrace* trace = nullptr;
+  // Receives each port built here when [substitute] push is on.
+  const Substituter* push_to = nullptr;
+};
+
+std::filesystem::path sourceDirFor(const std::filesystem::path& root,
+                                   const Config& cfg,
+                                   const PortRecipe& recipe) {
+  return root / cfg.layout.build_dir / "src" /
+         (recipe.name + "-" + recipe.version);
 }
 
-std::string hashKey(std::string_view text) {
-  const std::size_t h = std::hash<std::string_view>{}(text);
-  std::ostringstream oss;
-  oss << std::hex << std::setfill('0') << std::setw(16)
-      << static_cast<unsigned long long>(h);
-  return oss.str();
+std::filesystem::path logPathFor(const std::filesystem::path& logs_dir,
+                                 const PortRecipe& recipe) {
+  return logs_dir / (recipe.name + "-" + recipe.version + ".log");
 }
 
-Status runCommandToLog(const std::string& command,
-                       const std::filesystem::path& log_path) {
-  const std::string shell_cmd =
-      command + " >> " + shellQuote(log_path.string()) + " 2>&1";
-  const int rc = std::system(shell_cmd.c_str());
-  if (rc != 0) {
-    return Status{StatusCode::kInternalError,
-                  "Command failed: " + command + " (see " +
-                      log_path.string() + ")"};
+// Written next to a store dir once every phase of its build (or its
+// substitution) succeeded. Scripts install straight into the final store
+// path, since outputs may embed it, so a failed or interrupted build can
+// leave files behind; only the marker makes a store dir reusable.
+std::filesystem::path completionMarker(const std::filesystem::path& store_dir) {
+  return store_dir.parent_path() / ("." + store_dir.filename().string() + ".done");
+}
+
+bool storeIsComplete(const std::filesystem::path& store_dir) {
+  std::error_code ec;
+  return std::filesystem::is_directory(store_dir, ec) &&
+         std::filesystem::exists(completionMarker(store_dir), ec);
+}
+
+Status markStoreComplete(const std::filesystem::path& store_dir) {
+  const auto marker = completionMarker(store_dir);
+  std::ofstream out(marker);
+  out.close();
+  if (!out) {
+    return Status{StatusCode::kIoError,
+                  "Failed to write store marker: " + marker.string()};
   }
   return Status::Ok();
 }
 
-Status prepareSource(const PortRecipe& recipe,
-                     const std::filesystem::path& src_dir,
-                     const std::filesystem::path& downloads_dir,
-                     const std::filesystem::path& log_path) {
+// Drops a store dir together with its marker, marker first, so nothing
+// half-removed ever looks complete.
+void clearStore(const std::filesystem::path& store_dir) {
+  std::error_code ec;
+  std::filesystem::remove(completionMarker(store_dir), ec);
+  std::filesystem::remove_all(store_dir, ec);
+}
+
+// Runs every phase of one port. Sets entry.status to "built" or "reused" on
+// success; the caller records failures. A failed build leaves no store dir.
+Status buildPort(const PortRecipe& recipe,
+                 LockEntry& entry,
+                 const BuildContext& ctx) {
+  const auto& root = ctx.root;
+  const auto& cfg = ctx.cfg;
+  const auto recipe_dir = recipe.recipe_path.parent_path();
+  const auto src_dir = sourceDirFor(root, cfg, recipe);
+  const auto build_dir =
+      root / cfg.layout.build_dir / (recipe.name + "-" + recipe.version);
+  const auto store_dir = root / entry.store;
+  const auto log_path = logPathFor(ctx.logs_dir, recipe);
+
   std::error_code ec;
+  if (storeIsComplete(store_dir)) {
+    entry.status = "reused";
+    return Status::Ok();
+  }
+
+  JobSlot slot(&ctx.jobserver);
+
   std::filesystem::create_directories(src_dir, ec);
   if (ec) {
     return Status{StatusCode::kIoError,
                   "Failed to create source dir: " + src_dir.string()};
   }
+  std::filesystem::remove_all(build_dir, ec);
+  ec.clear();
+  std::filesystem::create_directories(build_dir, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create build dir: " + build_dir.string()};
+  }
+  clearStore(store_dir);
+  std::filesystem::create_directories(store_dir, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create store dir: " + store_dir.string()};
+  }
 
-  if (recipe.src.type == "git") {
-    if (recipe.src.url.empty()) {
-      return Status::Ok();
-    }
-    const auto git_dir = src_dir / ".git";
-    if (!std::filesystem::exists(git_dir)) {
-      return runCommandToLog(
-          "git clone --depth 1 " + shellQuote(recipe.src.url) + " " +
-              shellQuote(src_dir.string()),
-          log_path);
+  const auto patch_script = recipe.scripts.patch.empty()
+                                ? std::filesystem::path{}
+                                : recipe_dir / recipe.scripts.patch;
+  const auto build_script = recipe_dir / recipe.scripts.build;
+  const auto install_script = recipe_dir / recipe.scripts.install;
+  const auto check_script = recipe.scripts.check.empty()
+                                ? std::filesystem::path{}
+                                : recipe_dir / recipe.scripts.check;
+
+  const auto run_phase = [&](const char* phase,
+                              const std::filesystem::path& script) {
+    BuildTrace::Span span(ctx.trace, "build", phase, "phase");
+    return runScript(phase, script, log_path, recipe, root, src_dir,
+                     build_dir, store_dir, ctx.env, ctx.jobserver, entry);
+  };
+  const auto run_phases = [&]() -> Status {
+    Status s;
+    if (!patch_script.empty()) {
+      s = run_phase("patch", patch_script);
+      if (!s.ok()) {
+        return s;
+      }
     }
-    auto s = runCommandToLog("git -C " + shellQuote(src_dir.string()) +
-                                 " fetch --depth 1 origin",
-                             log_path);
+    s = run_phase("build", build_script);
     if (!s.ok()) {
       return s;
     }
-    return runCommandToLog("git -C " + shellQuote(src_dir.string()) +
-                               " reset --hard origin/HEAD",
-                           log_path);
-  }
-
-  if (recipe.src.type == "url") {
-    if (recipe.src.url.empty()) {
-      return Status::Ok();
-    }
-    std::filesystem::create_directories(downloads_dir, ec);
-    if (ec) {
-      return Status{StatusCode::kIoError,
-                    "Failed to create downloads dir: " + downloads_dir.string()};
-    }
-    std::string filename = "source.tar";
-    const auto slash = recipe.src.url.find_last_of('/');
-    if (slash != std::string::npos && slash + 1 < recipe.src.url.size()) {
-      filename = recipe.src.url.substr(slash + 1);
-    }
-    const auto archive_path =
-        downloads_dir / (recipe.name + "-" + recipe.version + "-" + filename);
-
-    std::string fetch_cmd;
-    fetch_cmd = "(command -v fetch >/dev/null 2>&1 && fetch -o " +
-                shellQuote(archive_path.string()) + " " +
-                shellQuote(recipe.src.url) +
-                ") || (command -v curl >/dev/null 2>&1 && curl -LfsS -o " +
-                shellQuote(archive_path.string()) + " " +
-                shellQuote(recipe.src.url) + ")";
-    auto s = runCommandToLog(fetch_cmd, log_path);
+    s = run_phase("install", install_script);
     if (!s.ok()) {
       return s;
     }
-
-    if (!recipe.src.sha256.empty()) {
-      s = runCommandToLog(
-          "test \"$(sha256 -q " + shellQuote(archive_path.string()) +
-              ")\" = " + shellQuote(recipe.src.sha256),
-          log_path);
+    if (!check_script.empty()) {
+      s = run_phase("check", check_script);
       if (!s.ok()) {
-        return Status{StatusCode::kInternalError,
-                      "sha256 mismatch for " + archive_path.string()};
+        return s;
       }
     }
+    return markStoreComplete(store_dir);
+  };
+  auto s = run_phases();
+  if (!s.ok()) {
+    clearStore(store_dir);
+    return s;
+  }
 
-    std::filesystem::remove_all(src_dir, ec);
-    ec.clear();
-    std::filesystem::create_directories(src_dir, ec);
-    if (ec) {
-      return Status{StatusCode::kIoError,
-                    "Failed to prepare source dir: " + src_dir.string()};
+  entry.status = "built";
+  if (ctx.push_to != nullptr) {
+    // The port itself succeeded; a cache that cannot take it only costs
+    // the next machine a build.
+    BuildTrace::Span span(ctx.trace, "build", "push", "phase");
+    s = ctx.push_to->push(entry, store_dir, log_path);
+    if (!s.ok()) {
+      std::cerr << "warning: failed to push " << entry.name << ": "
+                << s.message() << "\n";
     }
-
-    return runCommandToLog(
-        "tar -xf " + shellQuote(archive_path.string()) + " -C " +
-            shellQuote(src_dir.string()) + " --strip-components=1",
-        log_path);
   }
+  return Status::Ok();
+}
 
-  if (recipe.src.type.empty()) {
-    return Status::Ok();
+// Weights nodes by their recorded build time. Ports without history get the
+// mean of the known ones, so with no history at all every node weighs the
+// same and ranking degrades to dependency depth.
+void assignWeights(const BuildHistory& history, std::vector<ScheduleNode>& graph) {
+  std::int64_t known_total = 0;
+  std::int64_t known_count = 0;
+  for (const auto& node : graph) {
+    auto it = history.ports.find(node.name);
+    if (it != history.ports.end() && it->second.runs > 0) {
+      known_total += std::max<std::int64_t>(1, it->second.avg_ms);
+      ++known_count;
+    }
+  }
+  const std::int64_t fallback =
+      known_count > 0 ? std::max<std::int64_t>(1, known_total / known_count) : 1;
+  for (auto& node : graph) {
+    auto it = history.ports.find(node.name);
+    node.weight = (it != history.ports.end() && it->second.runs > 0)
+                      ? std::max<std::int64_t>(1, it->second.avg_ms)
+                      : fallback;
   }
+}
 
-  return Status{StatusCode::kInvalidArgument,
-                "Unsupported src.type for " + recipe.name + ": " +
-                    recipe.src.type};
+// Node indices sorted by descending critical path, ties in resolver order.
+std::vector<std::size_t> criticalPathOrder(const std::vector<ScheduleNode>& graph) {
+  const auto path = BuildScheduler::criticalPath(graph);
+  std::vector<std::size_t> order(graph.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    return path[a] > path[b];
+  });
+  return order;
 }
 
-Status runScript(const std::filesystem::path& script_path,
-                 const std::filesystem::path& log_path,
-                 const PortRecipe& recipe,
-                 const std::filesystem::path& root,
-                 const std::filesystem::path& src_dir,
-                 const std::filesystem::path& build_dir,
-                 const std::filesystem::path& store_dir,
-                 int jobs) {
-  std::ostringstream cmd;
-  cmd << "env "
-      << "PKG_NAME=" << shellQuote(recipe.name) << " "
-      << "PKG_VERSION=" << shellQuote(recipe.version) << " "
-      << "PKG_ROOT=" << shellQuote(root.string()) << " "
-      << "PKG_SRC_DIR=" << shellQuote(src_dir.string()) << " "
-      << "PKG_BUILD_DIR=" << shellQuote(build_dir.string()) << " "
-      << "PKG_STORE_DIR=" << shellQuote(store_dir.string()) << " "
-      << "PKG_JOBS=" << shellQuote(std::to_string(jobs)) << " "
-      << "/bin/sh " << shellQuote(script_path.string())
-      << " >> " << shellQuote(log_path.string()) << " 2>&1";
-
-  return runCommandToLog(cmd.str(), log_path);
+void printFetchResult(const LockEntry& entry, const Result<FetchedSource>& result) {
+  if (!result.ok()) {
+    std::cerr << "fetch: " << entry.name << "@" << entry.version
+              << " failed: " << result.status().message() << "\n";
+    return;
+  }
+  std::cout << "fetch: " << entry.name << "@" << entry.version << ": "
+            << result.value().describe() << "\n";
 }
 
 std::filesystem::path parseRoot(const std::vector<std::string>& args) {
@@ -205,10 +379,25 @@ std::string parseGroup(const std::vector<std::string>& args) {
   return {};
 }
 
+// Accepts both --trace=<file> and --trace <file>; empty when absent.
+std::filesystem::path parseTrace(const std::vector<std::string>& args) {
+  static constexpr std::string_view kFlag = "--trace";
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == kFlag && i + 1 < args.size()) {
+      return args[i + 1];
+    }
+    if (args[i].size() > kFlag.size() + 1 && args[i].starts_with(kFlag) &&
+        args[i][kFlag.size()] == '=') {
+      return args[i].substr(kFlag.size() + 1);
+    }
+  }
+  return {};
+}
+
 std::vector<std::string> parsePortTargets(const std::vector<std::string>& args) {
   std::vector<std::string> ports;
   for (size_t i = 1; i < args.size(); ++i) {
-    if (args[i] == "--group" || args[i] == "--root") {
+    if (args[i] == "--group" || args[i] == "--root" || args[i] == "--trace") {
       ++i;
       continue;
     }
@@ -220,7 +409,12 @@ std::vector<std::string> parsePortTargets(const std::vector<std::string>& args)
   return ports;
 }
 
-int runValidate(const std::filesystem::path& root) {
+int runValidate(const std::filesystem::path& root,
+                const std::vector<std::string>& args) {
+  const bool changed_only =
+      std::find(args.begin(), args.end(), "--changed") != args.end();
+  const bool check_graph =
+      std::find(args.begin(), args.end(), "--graph") != args.end();
   auto cfg = ConfigStore::load(root);
   if (!cfg.ok()) {
     printStatusError(cfg.status());
@@ -231,17 +425,33 @@ int runValidate(const std::filesystem::path& root) {
     printStatusError(s);
     return 1;
   }
-  s = GroupStore::validateAll(root, cfg.value());
-  if (!s.ok()) {
-    printStatusError(s);
-    return 1;
+  // Report every broken group and port in one go, not just the first.
+  auto errors = GroupStore::validateAll(root, cfg.value());
+  std::size_t checked = 0;
+  auto port_errors =
+      changed_only ? PortStore::validateChanged(root, cfg.value(), &checked)
+                   : PortStore::validateAll(root, cfg.value());
+  errors.insert(errors.end(), std::make_move_iterator(port_errors.begin()),
+                std::make_move_iterator(port_errors.end()));
+  if (check_graph) {
+    auto graph_errors = PortStore::validateGraph(root, cfg.value());
+    errors.insert(errors.end(), std::make_move_iterator(graph_errors.begin()),
+                  std::make_move_iterator(graph_errors.end()));
   }
-  s = PortStore::validateAll(root, cfg.value());
-  if (!s.ok()) {
-    printStatusError(s);
+  if (!errors.empty()) {
+    for (const auto& error : errors) {
+      printStatusError(error);
+    }
+    std::cerr << "validate: " << errors.size() << " error"
+              << (errors.size() == 1 ? "" : "s") << "\n";
     return 1;
   }
-  std::cout << "validate: ok\n";
+  if (changed_only) {
+    std::cout << "validate: ok (" << checked << " port"
+              << (checked == 1 ? "" : "s") << " re-checked)\n";
+  } else {
+    std::cout << "validate: ok\n";
+  }
   return 0;
 }
 
@@ -272,10 +482,17 @@ Result<ResolveResult> resolveFromArgs(const std::filesystem::path& root,
     resolved_group.ports = std::move(ports);
   }
 
+  auto& recipes = RecipeCache::global();
+  recipes.useIndex(root / cfg.value().layout.build_dir /
+                   RecipeIndex::kIndexFilename);
   auto resolved = Resolver::resolveGroup(root, cfg.value(), resolved_group);
   if (!resolved.ok()) {
     return resolved.status();
   }
+  // The index only saves work; failing to update it is not fatal.
+  if (auto s = recipes.saveIndex(); !s.ok()) {
+    std::cerr << "warning: " << s.message() << "\n";
+  }
 
   if (out_cfg) {
     *out_cfg = cfg.value();
@@ -304,17 +521,31 @@ int runResolve(const std::filesystem::path& root,
   return 0;
 }
 
-int runBuild(const std::filesystem::path& root,
-             const std::vector<std::string>& args) {
-  Config cfg;
-  Group group;
-  auto resolved = resolveFromArgs(root, args, &cfg, &group);
+// Resolves the requested ports and plans a lock entry for each, in
+// dependency order.
+Result<ResolveResult> planFromArgs(const std::filesystem::path& root,
+                                   const std::vector<std::string>& args,
+                                   Config* out_cfg,
+                                   Group* out_group,
+                                   Lockfile* out_lock) {
+  // Scripts must not be handed a passthrough variable that shadows the
+  // PKG_* or MAKEFLAGS values pkg sets for them.
+  auto valid = ConfigStore::validate(root);
+  if (!valid.ok()) {
+    return valid;
+  }
+  auto resolved = resolveFromArgs(root, args, out_cfg, out_group);
   if (!resolved.ok()) {
-    printStatusError(resolved.status());
-    return 1;
+    return resolved;
+  }
+  auto drvs = Derivation::hashAll(resolved.value(),
+                                  BuildEnvironment::capture(root, *out_cfg));
+  if (!drvs.ok()) {
+    return drvs.status();
   }
 
-  Lockfile lock;
+  const Config& cfg = *out_cfg;
+  Lockfile& lock = *out_lock;
   lock.schema = 1;
   lock.state = "planned";
   for (const auto& name : resolved.value().order) {
@@ -324,12 +555,144 @@ int runBuild(const std::filesystem::path& root,
     entry.version = recipe.version;
     entry.status = "planned";
     entry.recipe = std::filesystem::relative(recipe.recipe_path, root).string();
+    entry.drv = drvs.value().at(name);
     entry.store = cfg.layout.store_dir + "/" +
-                  hashKey(recipe.name + "@" + recipe.version).substr(0, 12) +
-                  "-" + recipe.name + "-" + recipe.version;
+                  Derivation::storeName(recipe, entry.drv);
     entry.deps = recipe.deps;
     lock.entries.push_back(std::move(entry));
   }
+  return resolved;
+}
+
+// Takes the plan of an earlier `pkg build` from ports.lock instead of
+// resolving again. Entries that finished (built, substituted or reused,
+// store still marked complete) are kept and flagged in `done`; the rest
+// are planned afresh under their current derivation hash, so a port fixed
+// since the failed run builds with its new recipe. Refuses when a finished
+// port's inputs or any port's deps changed, as the lock's graph no longer
+// holds.
+Result<ResolveResult> resumeFromLock(const std::filesystem::path& root,
+                                     Config* out_cfg,
+                                     Lockfile* out_lock,
+                                     std::vector<bool>* done) {
+  auto valid = ConfigStore::validate(root);
+  if (!valid.ok()) {
+    return valid;
+  }
+  auto cfg = ConfigStore::load(root);
+  if (!cfg.ok()) {
+    return cfg.status();
+  }
+  auto lock = LockfileStore::load(root, cfg.value());
+  if (!lock.ok()) {
+    return lock.status();
+  }
+  if (lock.value().entries.empty()) {
+    return Status{StatusCode::kNotFound,
+                  "Nothing to resume in " +
+                      (root / cfg.value().layout.lockfile).string()};
+  }
+  const auto refuse = [](const std::string& why) {
+    return Status{StatusCode::kConflict,
+                  "Cannot resume: " + why +
+                      "; run pkg build without --resume"};
+  };
+
+  auto& recipes = RecipeCache::global();
+  recipes.useIndex(root / cfg.value().layout.build_dir /
+                   RecipeIndex::kIndexFilename);
+  const auto env = BuildEnvironment::capture(root, cfg.value());
+  ResolveResult resolved;
+  DerivationMap drvs;
+  done->assign(lock.value().entries.size(), false);
+  for (size_t i = 0; i < lock.value().entries.size(); ++i) {
+    auto& entry = lock.value().entries[i];
+    auto recipe =
+        recipes.atVersion(root, cfg.value(), entry.name, entry.version);
+    if (!recipe.ok()) {
+      return recipe.status();
+    }
+    auto deps = recipe.value()->deps;
+    auto locked_deps = entry.deps;
+    std::sort(deps.begin(), deps.end());
+    std::sort(locked_deps.begin(), locked_deps.end());
+    if (deps != locked_deps) {
+      return refuse("dependencies of " + entry.name + " changed");
+    }
+    for (const auto& dep : deps) {
+      if (drvs.count(dep) == 0) {
+        return refuse(entry.name + " depends on " + dep +
+                      ", which is not planned before it");
+      }
+    }
+    auto drv = Derivation::hash(*recipe.value(), drvs, env);
+    if (!drv.ok()) {
+      return drv.status();
+    }
+
+    const bool finished =
+        (entry.status == "built" || entry.status == "substituted" ||
+         entry.status == "reused") &&
+        storeIsComplete(root / entry.store);
+    if (finished && drv.value() != entry.drv) {
+      return refuse("inputs of " + entry.name + " changed since it was " +
+                    entry.status);
+    }
+    if (!finished) {
+      entry.status = "planned";
+      entry.drv = drv.value();
+      entry.store = cfg.value().layout.store_dir + "/" +
+                    Derivation::storeName(*recipe.value(), entry.drv);
+      entry.fetch_wait_ms = 0;
+      entry.build_wait_ms = 0;
+      entry.phases.clear();
+    }
+    (*done)[i] = finished;
+    drvs.emplace(entry.name, std::move(drv.value()));
+    resolved.order.push_back(entry.name);
+    resolved.nodes.emplace(entry.name, ResolvedNode{*recipe.value()});
+  }
+  if (auto s = recipes.saveIndex(); !s.ok()) {
+    std::cerr << "warning: " << s.message() << "\n";
+  }
+
+  *out_cfg = cfg.value();
+  *out_lock = std::move(lock.value());
+  out_lock->state = "planned";
+  return resolved;
+}
+
+int runBuild(const std::filesystem::path& root,
+             const std::vector<std::string>& args) {
+  const bool resume =
+      std::find(args.begin(), args.end(), "--resume") != args.end();
+  if (resume && (!parseGroup(args).empty() || !parsePortTargets(args).empty())) {
+    printStatusError(Status{StatusCode::kInvalidArgument,
+                            "--resume takes its ports from the lockfile; "
+                            "drop --group and port names"});
+    return 1;
+  }
+
+  Config cfg;
+  Group group;
+  Lockfile lock;
+  // Entries finished by the run being resumed; never scheduled again.
+  std::vector<bool> done;
+  auto resolved = resume ? resumeFromLock(root, &cfg, &lock, &done)
+                         : planFromArgs(root, args, &cfg, &group, &lock);
+  if (!resolved.ok()) {
+    printStatusError(resolved.status());
+    return 1;
+  }
+  if (resume) {
+    group.name = "--resume";
+    std::cout << "build: resuming "
+              << (root / cfg.layout.lockfile).string() << ", "
+              << std::count(done.begin(), done.end(), true) << " of "
+              << done.size() << " ports already done\n";
+  } else {
+    done.assign(lock.entries.size(), false);
+  }
 
   const auto logs_dir = root / cfg.layout.build_dir / "logs";
   std::error_code ec;
@@ -340,127 +703,270 @@ int runBuild(const std::filesystem::path& root,
     return 1;
   }
 
-  bool has_failure = false;
-  const int jobs = std::max(1u, std::thread::hardware_concurrency());
-  int built_count = 0;
-  int reused_count = 0;
-  int failed_count = 0;
-  int skipped_count = 0;
-  int planned_count = 0;
+  const int jobs = cfg.build.jobs > 0
+                       ? cfg.build.jobs
+                       : static_cast<int>(
+                             std::max(1u, std::thread::hardware_concurrency()));
+  auto jobserver = Jobserver::create(
+      root / cfg.layout.build_dir /
+          ("jobserver-" + std::to_string(::getpid()) + ".fifo"),
+      jobs);
+  if (!jobserver.ok()) {
+    printStatusError(jobserver.status());
+    return 1;
+  }
+
+  const DownloadCache downloads(
+      root / cfg.layout.build_dir / "downloads",
+      static_cast<std::uint64_t>(cfg.fetch.cache_max_mb) * 1024 * 1024);
+  const auto trace_path = parseTrace(args);
+  std::unique_ptr<BuildTrace> trace;
+  if (!trace_path.empty()) {
+    trace = std::make_unique<BuildTrace>("pkg build " + group.name);
+  }
+  // Captured after planning, from the same process environment, so the
+  // scripts see the values the derivation hashes cover.
+  const auto env = BuildEnvironment::capture(root, cfg);
+  const auto substituter = Substituter::fromConfig(root, cfg, env);
+  const BuildContext ctx{root,
+                         cfg,
+                         logs_dir,
+                         env,
+                         *jobserver.value(),
+                         trace.get(),
+                         cfg.substitute.push ? substituter.get() : nullptr};
+
+  auto history = BuildHistoryStore::load(root, cfg);
+  if (!history.ok()) {
+    printStatusError(history.status());
+    return 1;
+  }
+
+  std::unordered_map<std::string, std::size_t> entry_index;
   for (size_t i = 0; i < lock.entries.size(); ++i) {
-    auto& entry = lock.entries[i];
-    const auto& recipe = resolved.value().nodes.at(entry.name).recipe;
-    const auto recipe_dir = recipe.recipe_path.parent_path();
-    const auto src_dir =
-        root / cfg.layout.build_dir / "src" / (recipe.name + "-" + recipe.version);
-    const auto build_dir =
-        root / cfg.layout.build_dir / (recipe.name + "-" + recipe.version);
-    const auto downloads_dir = root / cfg.layout.build_dir / "downloads";
-    const auto store_dir = root / entry.store;
-    const auto log_path =
-        logs_dir / (recipe.name + "-" + recipe.version + ".log");
-
-    if (has_failure) {
-      entry.status = "skipped";
-      ++skipped_count;
-      continue;
+    entry_index.emplace(lock.entries[i].name, i);
+  }
+  std::vector<ScheduleNode> graph;
+  graph.reserve(lock.entries.size());
+  for (const auto& entry : lock.entries) {
+    ScheduleNode node;
+    node.name = entry.name;
+    for (const auto& dep : entry.deps) {
+      node.deps.push_back(entry_index.at(dep));
     }
+    graph.push_back(std::move(node));
+  }
+  assignWeights(history.value(), graph);
 
-    if (std::filesystem::exists(store_dir) &&
-        !std::filesystem::is_empty(store_dir, ec)) {
-      entry.status = "reused";
-      ++reused_count;
-      continue;
+  // Progress is journaled as each port finishes, so an interrupted build
+  // leaves a lockfile that `pkg build --resume` can continue from.
+  auto journal = LockfileJournal::begin(root, cfg, lock);
+  if (!journal.ok()) {
+    printStatusError(journal.status());
+    return 1;
+  }
+  const auto checkpoint = [&](const LockEntry& entry) {
+    if (auto s = journal.value()->record(entry); !s.ok()) {
+      std::cerr << "warning: " << s.message() << "\n";
     }
+  };
 
-    std::filesystem::create_directories(src_dir, ec);
-    if (ec) {
-      entry.status = "failed";
-      has_failure = true;
-      ++failed_count;
+  // Sources are fetched in the background, heaviest critical path first,
+  // and each port waits only for its own source before building. Ports the
+  // substituter has an output for fetch nothing up front.
+  std::vector<bool> substitutable(lock.entries.size(), false);
+  std::vector<FetchRequest> fetch_requests(lock.entries.size());
+  for (size_t i = 0; i < lock.entries.size(); ++i) {
+    const auto& recipe = resolved.value().nodes.at(lock.entries[i].name).recipe;
+    if (done[i] || storeIsComplete(root / lock.entries[i].store)) {
       continue;
     }
-    std::filesystem::remove_all(build_dir, ec);
-    ec.clear();
-    std::filesystem::create_directories(build_dir, ec);
-    if (ec) {
-      entry.status = "failed";
-      has_failure = true;
-      ++failed_count;
+    if (substituter && substituter->has(lock.entries[i])) {
+      substitutable[i] = true;
       continue;
     }
-    std::filesystem::remove_all(store_dir, ec);
-    ec.clear();
-    std::filesystem::create_directories(store_dir, ec);
-    if (ec) {
-      entry.status = "failed";
-      has_failure = true;
-      ++failed_count;
+    if (!Fetcher::needsFetch(recipe)) {
       continue;
     }
+    fetch_requests[i].recipe = &recipe;
+    fetch_requests[i].src_dir = sourceDirFor(root, cfg, recipe);
+    fetch_requests[i].log_path = logPathFor(logs_dir, recipe);
+    fetch_requests[i].unpack = true;
+  }
+  // The fetch stage also unpacks each archive, so the next port's source
+  // is extracted while earlier ones compile. At most two prepared ports per
+  // build job are held ahead of the build stage. Critical-path order lists
+  // every port after its deps, which keeps the bound from starving a
+  // dependency.
+  const Fetcher fetcher(cfg, downloads);
+  FetchQueue::Options fetch_options;
+  fetch_options.parallel = cfg.fetch.parallel;
+  fetch_options.max_ready = static_cast<std::size_t>(jobs) * 2;
+  fetch_options.trace = trace.get();
+  fetch_options.prepare = [&](std::size_t index, const FetchedSource& fetched) {
+    const auto& recipe = resolved.value().nodes.at(lock.entries[index].name).recipe;
+    // Cached archives are re-verified in the same pass that extracts them;
+    // fresh downloads were hashed while streaming, inside the fetch phase.
+    BuildTrace::Span span(trace.get(), "fetch",
+                          fetched.cached ? "verify+extract" : "extract",
+                          "phase");
+    return prepareSource(recipe, fetched, sourceDirFor(root, cfg, recipe),
+                         logPathFor(logs_dir, recipe));
+  };
+  fetch_options.on_done = [&](std::size_t index,
+                              const Result<FetchedSource>& r) {
+    printFetchResult(lock.entries[index], r);
+  };
+  FetchQueue fetches(fetcher, std::move(fetch_requests),
+                     criticalPathOrder(graph), std::move(fetch_options));
 
-    const auto patch_script = recipe.scripts.patch.empty()
-                                  ? std::filesystem::path{}
-                                  : recipe_dir / recipe.scripts.patch;
-    const auto build_script = recipe_dir / recipe.scripts.build;
-    const auto install_script = recipe_dir / recipe.scripts.install;
-    const auto check_script = recipe.scripts.check.empty()
-                                  ? std::filesystem::path{}
-                                  : recipe_dir / recipe.scripts.check;
+  // With --keep-going only the dependents of a failed port are skipped.
+  // Their sources are never taken, so their slots in the fetch stage's
+  // ready bound are handed back at once.
+  ScheduleOptions schedule_options;
+  schedule_options.keep_going =
+      std::find(args.begin(), args.end(), "--keep-going") != args.end();
+  schedule_options.on_skipped = [&](std::size_t index) {
+    fetches.release(index);
+    lock.entries[index].status = "skipped";
+    checkpoint(lock.entries[index]);
+  };
 
-    {
-      auto s = prepareSource(recipe, src_dir, downloads_dir, log_path);
-      if (!s.ok()) {
-        entry.status = "failed";
-        has_failure = true;
-        ++failed_count;
-        continue;
-      }
-    }
+  std::vector<std::int64_t> durations_ms(lock.entries.size(), 0);
+  std::vector<Status> failures(lock.entries.size());
+  const auto states = BuildScheduler::run(
+      graph, jobs, [&](std::size_t index) {
+        if (done[index]) {
+          return Status::Ok();
+        }
+        auto& entry = lock.entries[index];
+        const auto& recipe = resolved.value().nodes.at(entry.name).recipe;
+        BuildTrace::Span span(trace.get(), "build",
+                              recipe.name + "@" + recipe.version, "port",
+                              /*job=*/true);
+        std::optional<Result<FetchedSource>> fallback;
+        if (substitutable[index]) {
+          BuildTrace::Span phase(trace.get(), "build", "substitute", "phase");
+          auto substituted = substituter->fetch(
+              entry, root / entry.store, logPathFor(logs_dir, recipe));
+          if (substituted.ok()) {
+            if (auto s = markStoreComplete(root / entry.store); !s.ok()) {
+              substituted = s;
+            }
+          }
+          if (substituted.ok()) {
+            entry.status = "substituted";
+            span.arg("status", entry.status);
+            std::cout << "substitute: " << entry.name << "@" << entry.version
+                      << ": " << substituted.value().describe() << "\n";
+            checkpoint(entry);
+            return Status::Ok();
+          }
+          std::cerr << "warning: " << substituted.status().message()
+                    << "; building " << entry.name << " instead\n";
+          // Its source was left out of the fetch stage, so fetch it here.
+          if (Fetcher::needsFetch(recipe)) {
+            FetchRequest request;
+            request.recipe = &recipe;
+            request.src_dir = sourceDirFor(root, cfg, recipe);
+            request.log_path = logPathFor(logs_dir, recipe);
+            request.unpack = true;
+            fallback.emplace(fetcher.fetch(request));
+            if (fallback->ok()) {
+              auto s = prepareSource(recipe, fallback->value(),
+                                     request.src_dir, request.log_path);
+              if (!s.ok()) {
+                fallback.emplace(s);
+              }
+            }
+            printFetchResult(entry, *fallback);
+          }
+        }
+        const auto& fetched = [&]() -> const Result<FetchedSource>& {
+          BuildTrace::Span wait(trace.get(), "build", "wait for source",
+                                "wait");
+          const auto& queued = fetches.take(index);
+          return fallback ? *fallback : queued;
+        }();
+        const auto started = std::chrono::steady_clock::now();
+        const auto timing = fetches.timing(index);
+        entry.fetch_wait_ms = timing.queued_ms;
+        entry.build_wait_ms = std::max<std::int64_t>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                   started - timing.ready_at)
+                   .count());
+        if (!fetched.ok()) {
+          entry.status = "failed";
+          span.arg("status", "fetch failed");
+          failures[index] = fetched.status();
+          checkpoint(entry);
+          return fetched.status();
+        }
+        auto s = buildPort(recipe, entry, ctx);
+        span.arg("status", s.ok() ? entry.status : "failed");
+        durations_ms[index] =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started)
+                .count();
+        if (!s.ok()) {
+          entry.status = "failed";
+          failures[index] = s;
+        }
+        checkpoint(entry);
+        return s;
+      },
+      schedule_options);
 
-    if (!patch_script.empty()) {
-      auto s = runScript(patch_script, log_path, recipe, root, src_dir, build_dir,
-                         store_dir, jobs);
-      if (!s.ok()) {
-        entry.status = "failed";
-        has_failure = true;
-        ++failed_count;
-        continue;
-      }
-    }
-    {
-      auto s = runScript(build_script, log_path, recipe, root, src_dir, build_dir,
-                         store_dir, jobs);
-      if (!s.ok()) {
-        entry.status = "failed";
-        has_failure = true;
-        ++failed_count;
-        continue;
+  fetches.cancel();
+
+  for (size_t i = 0; i < lock.entries.size(); ++i) {
+    const auto& entry = lock.entries[i];
+    if (entry.status == "built" && !done[i]) {
+      std::int64_t cpu_ms = 0;
+      std::int64_t max_rss_kb = 0;
+      for (const auto& phase : entry.phases) {
+        cpu_ms += phase.user_ms + phase.sys_ms;
+        max_rss_kb = std::max(max_rss_kb, phase.max_rss_kb);
       }
+      history.value().record(entry.name, entry.version, durations_ms[i],
+                             cpu_ms, max_rss_kb);
     }
-    {
-      auto s = runScript(install_script, log_path, recipe, root, src_dir,
-                         build_dir, store_dir, jobs);
-      if (!s.ok()) {
-        entry.status = "failed";
-        has_failure = true;
-        ++failed_count;
-        continue;
-      }
+  }
+  auto history_save = BuildHistoryStore::save(root, cfg, history.value());
+  if (!history_save.ok()) {
+    printStatusError(history_save);
+  }
+  auto prune = downloads.prune();
+  if (!prune.ok()) {
+    printStatusError(prune);
+  }
+
+  bool has_failure = false;
+  int built_count = 0;
+  int substituted_count = 0;
+  int reused_count = 0;
+  int failed_count = 0;
+  int skipped_count = 0;
+  int planned_count = 0;
+  for (size_t i = 0; i < lock.entries.size(); ++i) {
+    auto& entry = lock.entries[i];
+    if (states[i] == NodeState::kSkipped) {
+      entry.status = "skipped";
     }
-    if (!check_script.empty()) {
-      auto s = runScript(check_script, log_path, recipe, root, src_dir, build_dir,
-                         store_dir, jobs);
-      if (!s.ok()) {
-        entry.status = "failed";
-        has_failure = true;
-        ++failed_count;
-        continue;
-      }
+    if (entry.status == "built") {
+      ++built_count;
+    } else if (entry.status == "substituted") {
+      ++substituted_count;
+    } else if (entry.status == "reused") {
+      ++reused_count;
+    } else if (entry.status == "failed") {
+      has_failure = true;
+      ++failed_count;
+      std::cerr << "build: " << entry.name << " failed: "
+                << failures[i].message() << "\n";
+    } else if (entry.status == "skipped") {
+      ++skipped_count;
     }
-
-    entry.status = "built";
-    ++built_count;
   }
 
   for (const auto& entry : lock.entries) {
@@ -469,8 +975,17 @@ int runBuild(const std::filesystem::path& root,
     }
   }
 
+  if (trace) {
+    auto trace_save = trace->save(trace_path);
+    if (!trace_save.ok()) {
+      printStatusError(trace_save);
+    } else {
+      std::cout << "build: trace written to " << trace_path.string() << "\n";
+    }
+  }
+
   lock.state = has_failure ? "failed" : "done";
-  auto save = LockfileStore::save(root, cfg, lock);
+  auto save = journal.value()->compact(lock);
   if (!save.ok()) {
     printStatusError(save);
     return 1;
@@ -479,6 +994,7 @@ int runBuild(const std::filesystem::path& root,
   std::cout << "build: processed " << lock.entries.size() << " ports into "
             << (root / cfg.layout.lockfile).string() << "\n";
   std::cout << "build: built=" << built_count
+            << " substituted=" << substituted_count
             << " reused=" << reused_count
             << " failed=" << failed_count
             << " skipped=" << skipped_count
@@ -486,6 +1002,203 @@ int runBuild(const std::filesystem::path& root,
   return has_failure ? 1 : 0;
 }
 
+int runFetch(const std::filesystem::path& root,
+             const std::vector<std::string>& args) {
+  Config cfg;
+  auto resolved = resolveFromArgs(root, args, &cfg, nullptr);
+  if (!resolved.ok()) {
+    printStatusError(resolved.status());
+    return 1;
+  }
+
+  const auto logs_dir = root / cfg.layout.build_dir / "logs";
+  std::error_code ec;
+  std::filesystem::create_directories(logs_dir, ec);
+  if (ec) {
+    printStatusError(Status{StatusCode::kIoError,
+                            "Failed to create logs dir: " + logs_dir.string()});
+    return 1;
+  }
+
+  const auto& order = resolved.value().order;
+  std::vector<FetchRequest> requests(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const auto& recipe = resolved.value().nodes.at(order[i]).recipe;
+    if (!Fetcher::needsFetch(recipe)) {
+      continue;
+    }
+    requests[i].recipe = &recipe;
+    requests[i].src_dir = sourceDirFor(root, cfg, recipe);
+    requests[i].log_path = logPathFor(logs_dir, recipe);
+  }
+
+  const DownloadCache downloads(
+      root / cfg.layout.build_dir / "downloads",
+      static_cast<std::uint64_t>(cfg.fetch.cache_max_mb) * 1024 * 1024);
+  const Fetcher fetcher(cfg, downloads);
+  int fetched_count = 0;
+  int cached_count = 0;
+  int failed_count = 0;
+  std::uint64_t total_bytes = 0;
+  const auto started = std::chrono::steady_clock::now();
+  {
+    FetchQueue::Options options;
+    options.parallel = cfg.fetch.parallel;
+    options.on_done = [&](std::size_t index, const Result<FetchedSource>& r) {
+      const auto& recipe = resolved.value().nodes.at(order[index]).recipe;
+      LockEntry entry;
+      entry.name = recipe.name;
+      entry.version = recipe.version;
+      printFetchResult(entry, r);
+      if (!r.ok()) {
+        ++failed_count;
+      } else if (r.value().cached) {
+        ++cached_count;
+      } else {
+        ++fetched_count;
+        total_bytes += r.value().bytes;
+      }
+    };
+    FetchQueue queue(fetcher, std::move(requests), {}, std::move(options));
+    for (size_t i = 0; i < order.size(); ++i) {
+      queue.wait(i);
+    }
+  }
+  const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - started)
+                              .count();
+
+  auto prune = downloads.prune();
+  if (!prune.ok()) {
+    printStatusError(prune);
+  }
+
+  std::cout << "fetch: fetched=" << fetched_count << " cached=" << cached_count
+            << " failed=" << failed_count << " bytes=" << total_bytes
+            << " elapsed_ms=" << elapsed_ms << "\n";
+  return failed_count > 0 ? 1 : 0;
+}
+
+// A port whose last build took at least this many times its usual time, and
+// at least kSlowdownMinMs longer, is called out by `pkg stats`. The floor
+// keeps millisecond-scale ports from being reported over scheduling noise.
+constexpr double kSlowdownFactor = 2.0;
+constexpr std::int64_t kSlowdownMinMs = 1000;
+
+// Summarizes the per-phase usage recorded in the lockfile by the last build,
+// next to the running averages kept in the build history.
+int runStats(const std::filesystem::path& root) {
+  auto cfg = ConfigStore::load(root);
+  if (!cfg.ok()) {
+    printStatusError(cfg.status());
+    return 1;
+  }
+  auto lock = LockfileStore::load(root, cfg.value());
+  if (!lock.ok()) {
+    printStatusError(lock.status());
+    return 1;
+  }
+  auto history = BuildHistoryStore::load(root, cfg.value());
+  if (!history.ok()) {
+    printStatusError(history.status());
+    return 1;
+  }
+
+  struct Row {
+    const LockEntry* entry;
+    std::int64_t wall_ms = 0;
+    std::int64_t cpu_ms = 0;
+    std::int64_t max_rss_kb = 0;
+    std::int64_t read_bytes = 0;
+    std::int64_t write_bytes = 0;
+  };
+  std::vector<Row> rows;
+  Row total{nullptr};
+  for (const auto& entry : lock.value().entries) {
+    if (entry.phases.empty()) {
+      continue;
+    }
+    Row row{&entry};
+    for (const auto& phase : entry.phases) {
+      row.wall_ms += phase.wall_ms;
+      row.cpu_ms += phase.user_ms + phase.sys_ms;
+      row.max_rss_kb = std::max(row.max_rss_kb, phase.max_rss_kb);
+      row.read_bytes += phase.read_bytes;
+      row.write_bytes += phase.write_bytes;
+    }
+    total.wall_ms += row.wall_ms;
+    total.cpu_ms += row.cpu_ms;
+    total.max_rss_kb = std::max(total.max_rss_kb, row.max_rss_kb);
+    total.read_bytes += row.read_bytes;
+    total.write_bytes += row.write_bytes;
+    rows.push_back(row);
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    return a.wall_ms > b.wall_ms;
+  });
+
+  std::cout << "stats: " << rows.size() << " of "
+            << lock.value().entries.size()
+            << " ports ran phase scripts in the last build (state "
+            << lock.value().state << ")\n";
+  if (rows.empty()) {
+    return 0;
+  }
+  std::cout << "stats: script wall_ms=" << total.wall_ms
+            << " cpu_ms=" << total.cpu_ms
+            << " peak_rss_kb=" << total.max_rss_kb
+            << " read_kb=" << total.read_bytes / 1024
+            << " write_kb=" << total.write_bytes / 1024 << "\n";
+
+  std::cout << std::left << std::setw(32) << "port" << std::right
+            << std::setw(10) << "wall_ms" << std::setw(10) << "cpu_ms"
+            << std::setw(11) << "rss_kb" << std::setw(11) << "read_kb"
+            << std::setw(11) << "write_kb" << std::setw(6) << "runs"
+            << std::setw(10) << "avg_ms" << std::setw(9) << "vs_avg"
+            << "\n";
+  std::vector<std::string> slower;
+  for (const auto& row : rows) {
+    const auto& entry = *row.entry;
+    std::cout << std::left << std::setw(32)
+              << (entry.name + "@" + entry.version) << std::right
+              << std::setw(10) << row.wall_ms << std::setw(10) << row.cpu_ms
+              << std::setw(11) << row.max_rss_kb << std::setw(11)
+              << row.read_bytes / 1024 << std::setw(11)
+              << row.write_bytes / 1024;
+    const auto it = history.value().ports.find(entry.name);
+    if (it == history.value().ports.end() || it->second.runs == 0) {
+      std::cout << std::setw(6) << 0 << std::setw(10) << "-" << std::setw(9)
+                << "-" << "\n";
+      continue;
+    }
+    const auto& timing = it->second;
+    std::cout << std::setw(6) << timing.runs << std::setw(10) << timing.avg_ms;
+    // avg_ms already folds in the last run; undo that step of the moving
+    // average to compare the last run against the ones before it.
+    const std::int64_t before_ms =
+        timing.runs > 1 ? (timing.avg_ms * 4 - timing.last_ms) / 3 : 0;
+    if (before_ms <= 0) {
+      std::cout << std::setw(9) << "-" << "\n";
+      continue;
+    }
+    const double ratio = static_cast<double>(timing.last_ms) /
+                         static_cast<double>(before_ms);
+    std::ostringstream cell;
+    cell << std::fixed << std::setprecision(2) << ratio << "x";
+    std::cout << std::setw(9) << cell.str() << "\n";
+    if (ratio >= kSlowdownFactor &&
+        timing.last_ms - before_ms >= kSlowdownMinMs) {
+      slower.push_back(entry.name + " took " + cell.str() +
+                       " its average (" + std::to_string(timing.last_ms) +
+                       " ms vs " + std::to_string(before_ms) + " ms)");
+    }
+  }
+  for (const auto& line : slower) {
+    std::cout << "stats: slower: " << line << "\n";
+  }
+  return 0;
+}
+
 int runApply(const std::filesystem::path& root) {
   auto cfg = ConfigStore::load(root);
   if (!cfg.ok()) {
@@ -523,14 +1236,20 @@ int Commands::run(int argc, char** argv) {
   const auto root = parseRoot(args);
 
   if (command == "validate") {
-    return runValidate(root);
+    return runValidate(root, args);
   }
   if (command == "resolve") {
     return runResolve(root, args);
   }
+  if (command == "fetch") {
+    return runFetch(root, args);
+  }
   if (command == "build") {
     return runBuild(root, args);
   }
+  if (command == "stats") {
+    return runStats(root);
+  }
   if (command == "apply") {
     return runApply(root);
   }
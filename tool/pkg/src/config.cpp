@@ -30,12 +30,44 @@ Result<Config> ConfigStore::load(const std::filesystem::path& root) {
     if (auto v = toml_util::getString(*resolver, "strategy")) cfg.resolver.strategy = *v;
   }
 
+  if (auto fetch = top.get("fetch"); fetch.has_value() && fetch->is_table()) {
+    if (auto v = toml_util::getString(*fetch, "user_agent")) cfg.fetch.user_agent = *v;
+    if (auto v = toml_util::getInt(*fetch, "parallel")) cfg.fetch.parallel = *v;
+    if (auto v = toml_util::getInt(*fetch, "retry_max")) cfg.fetch.retry_max = *v;
+    if (auto v = toml_util::getInt(*fetch, "retry_backoff_ms")) cfg.fetch.retry_backoff_ms = *v;
+    if (auto v = toml_util::getInt(*fetch, "cache_max_mb")) cfg.fetch.cache_max_mb = *v;
+  }
+
+  if (auto build = top.get("build"); build.has_value() && build->is_table()) {
+    if (auto v = toml_util::getInt(*build, "jobs")) cfg.build.jobs = *v;
+    if (auto v = toml_util::getString(*build, "backend_default")) cfg.build.backend_default = *v;
+    auto passthrough = toml_util::getStringArray(*build, "env_passthrough");
+    if (!passthrough.ok()) {
+      return Status{StatusCode::kParseError,
+                    "build.env_passthrough in " + path.string() + ": " +
+                        passthrough.status().message()};
+    }
+    cfg.build.env_passthrough = std::move(passthrough.value());
+    if (auto backends = build->get("backends"); backends.has_value()) {
+      toml_util::appendCanonical(*backends, cfg.build.backends);
+    }
+  }
+
   if (auto profile = top.get("profile"); profile.has_value() && profile->is_table()) {
     if (auto v = toml_util::getString(*profile, "activate_symlink")) cfg.profile.activate_symlink = *v;
     if (auto v = toml_util::getString(*profile, "activate_target")) cfg.profile.activate_target = *v;
     if (auto v = toml_util::getInt(*profile, "generations_to_keep")) cfg.profile.generations_to_keep = *v;
   }
 
+  if (auto integrity = top.get("integrity"); integrity.has_value() && integrity->is_table()) {
+    if (auto v = toml_util::getString(*integrity, "hash_algo")) cfg.integrity.hash_algo = *v;
+  }
+
+  if (auto substitute = top.get("substitute"); substitute.has_value() && substitute->is_table()) {
+    if (auto v = toml_util::getString(*substitute, "dir")) cfg.substitute.dir = *v;
+    if (auto v = toml_util::getBool(*substitute, "push")) cfg.substitute.push = *v;
+  }
+
   return cfg;
 }
 
@@ -46,7 +78,7 @@ Status ConfigStore::validate(const std::filesystem::path& root) {
   }
 
   const auto& cfg = loaded.value();
-  const auto layout_status = toml_util::requireNonEmpty(cfg.layout.ports_dir, "layout.ports_dir", root / kConfigFilename);
+  const auto layout_status = toml_util::requireNonEmpty(cfg.layout.ports_dir, "layout.ports_dir", (root / kConfigFilename).native());
   if (!layout_status.ok()) {
     return layout_status;
   }
@@ -56,6 +88,42 @@ Status ConfigStore::validate(const std::filesystem::path& root) {
                   "Only resolver.strategy='strict' is currently supported"};
   }
 
+  if (cfg.integrity.hash_algo != "sha256") {
+    return Status{StatusCode::kInvalidArgument,
+                  "Unsupported integrity.hash_algo: '" + cfg.integrity.hash_algo +
+                      "' (only 'sha256' is supported)"};
+  }
+
+  if (cfg.fetch.parallel < 1) {
+    return Status{StatusCode::kInvalidArgument, "fetch.parallel must be >= 1"};
+  }
+  if (cfg.fetch.retry_max < 0 || cfg.fetch.retry_backoff_ms < 0) {
+    return Status{StatusCode::kInvalidArgument,
+                  "fetch.retry_max and fetch.retry_backoff_ms must be >= 0"};
+  }
+  if (cfg.fetch.cache_max_mb < 0) {
+    return Status{StatusCode::kInvalidArgument,
+                  "fetch.cache_max_mb must be >= 0 (0 disables pruning)"};
+  }
+
+  if (cfg.build.jobs < 0) {
+    return Status{StatusCode::kInvalidArgument,
+                  "build.jobs must be >= 0 (0 selects the CPU count)"};
+  }
+  for (const auto& name : cfg.build.env_passthrough) {
+    if (name.empty() || name.find('=') != std::string::npos ||
+        name.rfind("PKG_", 0) == 0 || name == "MAKEFLAGS") {
+      return Status{StatusCode::kInvalidArgument,
+                    "build.env_passthrough: '" + name +
+                        "' is not a variable scripts may inherit"};
+    }
+  }
+
+  if (cfg.substitute.push && cfg.substitute.dir.empty()) {
+    return Status{StatusCode::kInvalidArgument,
+                  "substitute.push requires substitute.dir"};
+  }
+
   return Status::Ok();
 }
 
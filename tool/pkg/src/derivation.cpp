@@ -0,0 +1,169 @@
+#include "pkg/derivation.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "pkg/sha256.hpp"
+
+namespace pkg {
+namespace {
+
+// Bump when the preimage layout changes so old store entries are not
+// mistaken for current ones.
+constexpr const char* kFormat = "npkg-drv-2";
+
+// Length-prefixed so that no value can be confused with a neighbour.
+void addField(Sha256& hasher, std::string_view key, std::string_view value) {
+  hasher.update(key);
+  hasher.update(" " + std::to_string(value.size()) + ":");
+  hasher.update(value);
+  hasher.update("\n");
+}
+
+Status addRecipeFiles(Sha256& hasher, const std::filesystem::path& dir) {
+  std::vector<std::filesystem::path> files;
+  std::error_code ec;
+  for (auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+       !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    if (it->is_symlink(ec) || it->is_regular_file(ec)) {
+      files.push_back(std::filesystem::relative(it->path(), dir, ec));
+    }
+  }
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to list recipe dir " + dir.string() + ": " +
+                      ec.message()};
+  }
+  std::sort(files.begin(), files.end());
+
+  for (const auto& rel : files) {
+    // pkg.toml enters through its canonical form instead.
+    if (rel == "pkg.toml") {
+      continue;
+    }
+    const auto full = dir / rel;
+    if (std::filesystem::is_symlink(full, ec)) {
+      addField(hasher, "link", rel.generic_string());
+      addField(hasher, "target", std::filesystem::read_symlink(full, ec).string());
+      continue;
+    }
+    auto digest = Sha256::hashFileHex(full);
+    if (!digest.ok()) {
+      return digest.status();
+    }
+    addField(hasher, "file", rel.generic_string());
+    addField(hasher, "sha256", digest.value());
+  }
+  return Status::Ok();
+}
+
+}  // namespace
+
+BuildEnvironment BuildEnvironment::capture(const std::filesystem::path& root,
+                                           const Config& config) {
+  BuildEnvironment env;
+  Sha256 hasher;
+  addField(hasher, "store_dir",
+           std::filesystem::absolute(root / config.layout.store_dir)
+               .lexically_normal()
+               .string());
+  addField(hasher, "backend_default", config.build.backend_default);
+  addField(hasher, "backends", config.build.backends);
+  for (const auto& name : config.build.env_passthrough) {
+    const char* value = std::getenv(name.c_str());
+    // Unset and empty are told apart; some tools treat them differently.
+    addField(hasher, value != nullptr ? "set" : "unset", name);
+    if (value != nullptr) {
+      addField(hasher, "value", value);
+      env.hashed_.emplace_back(name, std::string(value));
+    } else {
+      env.hashed_.emplace_back(name, std::nullopt);
+    }
+  }
+  for (const char* name : kUnhashedVariables) {
+    const bool listed =
+        std::find(config.build.env_passthrough.begin(),
+                  config.build.env_passthrough.end(),
+                  name) != config.build.env_passthrough.end();
+    const char* value = std::getenv(name);
+    if (!listed && value != nullptr) {
+      env.unhashed_.emplace_back(name, value);
+    }
+  }
+  env.digest_ = hasher.finishHex();
+  return env;
+}
+
+std::vector<std::string> BuildEnvironment::scriptEnv() const {
+  std::vector<std::string> out;
+  out.reserve(hashed_.size() + unhashed_.size());
+  for (const auto& [name, value] : unhashed_) {
+    out.push_back(name + "=" + value);
+  }
+  for (const auto& [name, value] : hashed_) {
+    if (value) {
+      out.push_back(name + "=" + *value);
+    }
+  }
+  return out;
+}
+
+Result<std::string> Derivation::hash(const PortRecipe& recipe,
+                                     const DerivationMap& deps,
+                                     const BuildEnvironment& env) {
+  Sha256 hasher;
+  addField(hasher, "format", kFormat);
+  addField(hasher, "env", env.digest());
+  addField(hasher, "name", recipe.name);
+  addField(hasher, "version", recipe.version);
+  addField(hasher, "manifest", recipe.manifest_sha256);
+  addField(hasher, "src.type", recipe.src.type);
+  addField(hasher, "src.url", recipe.src.url);
+  addField(hasher, "src.sha256", recipe.src.sha256);
+  addField(hasher, "src.rev", recipe.src.rev);
+
+  auto s = addRecipeFiles(hasher, recipe.recipe_path.parent_path());
+  if (!s.ok()) {
+    return s;
+  }
+
+  std::vector<std::string> dep_names = recipe.deps;
+  std::sort(dep_names.begin(), dep_names.end());
+  for (const auto& dep : dep_names) {
+    const auto it = deps.find(dep);
+    if (it == deps.end()) {
+      return Status{StatusCode::kInternalError,
+                    "Derivation of " + recipe.name + " needs " + dep +
+                        " to be hashed first"};
+    }
+    addField(hasher, "dep", dep);
+    addField(hasher, "drv", it->second);
+  }
+  return hasher.finishHex();
+}
+
+Result<DerivationMap> Derivation::hashAll(const ResolveResult& resolved,
+                                          const BuildEnvironment& env) {
+  DerivationMap out;
+  out.reserve(resolved.order.size());
+  for (const auto& name : resolved.order) {
+    auto drv = hash(resolved.nodes.at(name).recipe, out, env);
+    if (!drv.ok()) {
+      return drv.status();
+    }
+    out.emplace(name, std::move(drv.value()));
+  }
+  return out;
+}
+
+std::string Derivation::storeName(const PortRecipe& recipe,
+                                  std::string_view drv) {
+  return std::string(drv.substr(0, kStorePrefixLength)) + "-" + recipe.name +
+         "-" + recipe.version;
+}
+
+}  // namespace pkg
@@ -0,0 +1,154 @@
+#include "pkg/download_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace pkg {
+namespace {
+
+constexpr const char* kObjectsDir = "sha256";
+constexpr const char* kStagingDir = "tmp";
+
+bool isHexDigest(std::string_view value) {
+  return value.size() == 64 &&
+         std::all_of(value.begin(), value.end(), [](char c) {
+           return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+         });
+}
+
+Status syncPath(const std::filesystem::path& path, int flags) {
+  const int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+  if (fd < 0) {
+    return Status{StatusCode::kIoError,
+                  "Failed to open " + path.string() + " for sync: " +
+                      std::strerror(errno)};
+  }
+  const int rc = ::fsync(fd);
+  const int err = errno;
+  ::close(fd);
+  if (rc != 0) {
+    return Status{StatusCode::kIoError,
+                  "fsync failed for " + path.string() + ": " + std::strerror(err)};
+  }
+  return Status::Ok();
+}
+
+}  // namespace
+
+DownloadCache::DownloadCache(std::filesystem::path dir, std::uint64_t max_bytes)
+    : dir_(std::move(dir)), max_bytes_(max_bytes) {}
+
+std::filesystem::path DownloadCache::objectPath(std::string_view sha256) const {
+  return dir_ / kObjectsDir / std::string(sha256);
+}
+
+std::optional<std::filesystem::path> DownloadCache::find(
+    std::string_view sha256) const {
+  if (!isHexDigest(sha256)) {
+    return std::nullopt;
+  }
+  const auto path = objectPath(sha256);
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec)) {
+    return std::nullopt;
+  }
+  // mtime doubles as the LRU clock.
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), ec);
+  return path;
+}
+
+std::filesystem::path DownloadCache::stagingPath(std::string_view sha256) const {
+  static std::atomic<unsigned> counter{0};
+  std::error_code ec;
+  std::filesystem::create_directories(dir_ / kStagingDir, ec);
+  return dir_ / kStagingDir /
+         (std::string(sha256) + "." + std::to_string(::getpid()) + "." +
+          std::to_string(counter.fetch_add(1)) + ".part");
+}
+
+Result<std::filesystem::path> DownloadCache::commit(
+    const std::filesystem::path& staged,
+    std::string_view sha256) const {
+  if (!isHexDigest(sha256)) {
+    return Status{StatusCode::kInvalidArgument,
+                  "Not a sha256 digest: " + std::string(sha256)};
+  }
+  const auto target = objectPath(sha256);
+  std::error_code ec;
+  std::filesystem::create_directories(target.parent_path(), ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create cache dir: " + target.parent_path().string()};
+  }
+  auto s = syncPath(staged, O_RDONLY);
+  if (!s.ok()) {
+    return s;
+  }
+  std::filesystem::rename(staged, target, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to move " + staged.string() + " into cache: " +
+                      ec.message()};
+  }
+  s = syncPath(target.parent_path(), O_RDONLY | O_DIRECTORY);
+  if (!s.ok()) {
+    return s;
+  }
+  return target;
+}
+
+Status DownloadCache::prune() const {
+  if (max_bytes_ == 0) {
+    return Status::Ok();
+  }
+  const auto objects = dir_ / kObjectsDir;
+  std::error_code ec;
+  if (!std::filesystem::is_directory(objects, ec)) {
+    return Status::Ok();
+  }
+
+  struct Object {
+    std::filesystem::path path;
+    std::filesystem::file_time_type mtime;
+    std::uintmax_t size;
+  };
+  std::vector<Object> found;
+  std::uint64_t total = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(objects, ec)) {
+    if (!entry.is_regular_file(ec)) {
+      continue;
+    }
+    Object obj{entry.path(), entry.last_write_time(ec), entry.file_size(ec)};
+    if (ec) {
+      ec.clear();
+      continue;
+    }
+    total += obj.size;
+    found.push_back(std::move(obj));
+  }
+  if (total <= max_bytes_) {
+    return Status::Ok();
+  }
+
+  std::sort(found.begin(), found.end(),
+            [](const Object& a, const Object& b) { return a.mtime < b.mtime; });
+  for (const auto& obj : found) {
+    if (total <= max_bytes_) {
+      break;
+    }
+    if (std::filesystem::remove(obj.path, ec)) {
+      total -= obj.size;
+    }
+  }
+  return Status::Ok();
+}
+
+}  // namespace pkg
@@ -0,0 +1,489 @@
+#include "pkg/fetch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <numeric>
+
+#include "pkg/archive.hpp"
+#include "pkg/process.hpp"
+#include "pkg/sha256.hpp"
+
+namespace pkg {
+namespace {
+
+Result<std::vector<std::string>> fetchToStdoutArgv(const std::string& url,
+                                                   const std::string& user_agent) {
+  if (Process::findExecutable("fetch")) {
+    std::vector<std::string> argv{"fetch", "-q"};
+    if (!user_agent.empty()) {
+      argv.push_back("--user-agent=" + user_agent);
+    }
+    argv.insert(argv.end(), {"-o", "-", url});
+    return argv;
+  }
+  if (Process::findExecutable("curl")) {
+    std::vector<std::string> argv{"curl", "-LfsS"};
+    if (!user_agent.empty()) {
+      argv.insert(argv.end(), {"-A", user_agent});
+    }
+    argv.push_back(url);
+    return argv;
+  }
+  return Status{StatusCode::kNotFound,
+                "Neither fetch nor curl is available to download " + url};
+}
+
+// Streams url into `partial` and hashes the bytes as they arrive, so the
+// archive is never re-read for verification. The file is removed on failure.
+// With an `unpack` extractor the same chunks are also unpacked; if that
+// fails part way, unpacking is abandoned and `unpacked` stays false.
+Status downloadVerified(const std::string& url,
+                        const std::string& user_agent,
+                        const std::filesystem::path& partial,
+                        const std::string& expected_sha256,
+                        const std::filesystem::path& log_path,
+                        ArchiveExtractor* unpack,
+                        std::uint64_t& bytes,
+                        bool& unpacked) {
+  auto argv = fetchToStdoutArgv(url, user_agent);
+  if (!argv.ok()) {
+    return argv.status();
+  }
+  std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return Status{StatusCode::kIoError,
+                  "Failed to open download target: " + partial.string()};
+  }
+
+  Sha256 hasher;
+  bool unpacking = unpack != nullptr;
+  ProcessSpec spec;
+  spec.argv = std::move(argv.value());
+  spec.stdout_mode = Redirect::kPipe;
+  spec.stderr_mode = Redirect::kFile;
+  spec.log_path = log_path;
+  spec.on_stdout = [&](std::string_view chunk) {
+    hasher.update(chunk);
+    bytes += chunk.size();
+    out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    if (!out) {
+      return Status{StatusCode::kIoError,
+                    "Failed while writing " + partial.string()};
+    }
+    if (unpacking) {
+      unpacking = unpack->write(chunk).ok();
+    }
+    return Status::Ok();
+  };
+  auto result = Process::run(spec);
+  out.close();
+  unpacked = unpacking && result.ok() && result.value().ok() &&
+             unpack->finish().ok();
+
+  std::error_code ec;
+  if (!result.ok() || !result.value().ok()) {
+    std::filesystem::remove(partial, ec);
+    if (!result.ok()) {
+      return result.status();
+    }
+    return Status{StatusCode::kInternalError,
+                  "Download failed: " + url + " (" + result.value().describe() +
+                      ", see " + log_path.string() + ")"};
+  }
+
+  const std::string actual = hasher.finishHex();
+  if (!expected_sha256.empty() && actual != expected_sha256) {
+    std::filesystem::remove(partial, ec);
+    return Status{StatusCode::kConflict,
+                  "sha256 mismatch for " + url + ": expected " +
+                      expected_sha256 + " got " + actual};
+  }
+  return Status::Ok();
+}
+
+Status fetchGit(const std::string& url,
+                const std::string& rev,
+                const std::filesystem::path& src_dir,
+                const std::filesystem::path& log_path) {
+  std::error_code ec;
+  if (!std::filesystem::exists(src_dir / ".git")) {
+    // A failed earlier clone may have left a partial tree behind.
+    std::filesystem::remove_all(src_dir, ec);
+    std::filesystem::create_directories(src_dir.parent_path(), ec);
+    auto s = Process::runToLog(
+        {"git", "clone", "--depth", "1", url, src_dir.string()}, log_path);
+    if (!s.ok() || rev.empty()) {
+      return s;
+    }
+  } else if (rev.empty()) {
+    auto s = Process::runToLog(
+        {"git", "-C", src_dir.string(), "fetch", "--depth", "1", "origin"},
+        log_path);
+    if (!s.ok()) {
+      return s;
+    }
+    return Process::runToLog(
+        {"git", "-C", src_dir.string(), "reset", "--hard", "origin/HEAD"},
+        log_path);
+  }
+  // A pinned rev is fetched by name, which also works for commit ids on
+  // servers that allow fetching reachable commits.
+  auto s = Process::runToLog(
+      {"git", "-C", src_dir.string(), "fetch", "--depth", "1", "origin", rev},
+      log_path);
+  if (!s.ok()) {
+    return s;
+  }
+  return Process::runToLog({"git", "-C", src_dir.string(), "checkout",
+                            "--force", "--detach", "FETCH_HEAD"},
+                           log_path);
+}
+
+// Empties src_dir and returns an extractor for it, or null when the request
+// does not ask for unpacking or the directory cannot be prepared.
+std::unique_ptr<ArchiveExtractor> startUnpack(const FetchRequest& request) {
+  if (!request.unpack || request.src_dir.empty()) {
+    return nullptr;
+  }
+  std::error_code ec;
+  std::filesystem::remove_all(request.src_dir, ec);
+  ec.clear();
+  std::filesystem::create_directories(request.src_dir, ec);
+  if (ec) {
+    return nullptr;
+  }
+  ExtractOptions options;
+  options.strip_components = 1;
+  return std::make_unique<ArchiveExtractor>(request.src_dir, options);
+}
+
+// Unverified archive contents must not outlive a failed download.
+void discardUnpacked(const FetchRequest& request,
+                     const ArchiveExtractor* unpack) {
+  if (unpack != nullptr) {
+    std::error_code ec;
+    std::filesystem::remove_all(request.src_dir, ec);
+  }
+}
+
+std::string formatBytes(double bytes) {
+  static constexpr const char* kUnits[] = {"B", "KiB", "MiB", "GiB"};
+  int unit = 0;
+  while (bytes >= 1024.0 && unit < 3) {
+    bytes /= 1024.0;
+    ++unit;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f %s", bytes, kUnits[unit]);
+  return buf;
+}
+
+}  // namespace
+
+std::string FetchedSource::describe() const {
+  if (cached) {
+    return "cached";
+  }
+  const double seconds = static_cast<double>(elapsed_ms) / 1000.0;
+  char elapsed[32];
+  std::snprintf(elapsed, sizeof(elapsed), "%.1fs", seconds);
+  std::string out;
+  if (archive.empty()) {
+    out = std::string("updated in ") + elapsed;
+  } else {
+    out = formatBytes(static_cast<double>(bytes)) + " in " + elapsed;
+    if (elapsed_ms > 0) {
+      out += " (" + formatBytes(static_cast<double>(bytes) / seconds) + "/s)";
+    }
+  }
+  if (attempts > 1) {
+    out += ", " + std::to_string(attempts) + " attempts";
+  }
+  return out;
+}
+
+Fetcher::Fetcher(const Config& config, const DownloadCache& cache)
+    : config_(config), cache_(cache) {}
+
+bool Fetcher::needsFetch(const PortRecipe& recipe) {
+  if (recipe.src.type.empty()) {
+    return false;
+  }
+  if (recipe.src.type == "url" || recipe.src.type == "git") {
+    return !recipe.src.url.empty();
+  }
+  // Unknown types are handed to the fetcher so it can report them.
+  return true;
+}
+
+Result<FetchedSource> Fetcher::fetch(const FetchRequest& request) const {
+  const auto started = std::chrono::steady_clock::now();
+  const int max_attempts = std::max(0, config_.fetch.retry_max) + 1;
+  for (int attempt = 1;; ++attempt) {
+    auto result = fetchOnce(request);
+    // A hash mismatch or bad recipe will not fix itself on retry.
+    const bool permanent =
+        !result.ok() && (result.status().code() == StatusCode::kConflict ||
+                         result.status().code() == StatusCode::kInvalidArgument ||
+                         result.status().code() == StatusCode::kNotFound);
+    if (result.ok() || permanent || attempt >= max_attempts) {
+      if (result.ok()) {
+        result.value().attempts = attempt;
+        result.value().elapsed_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started)
+                .count();
+      }
+      return result;
+    }
+    const std::int64_t backoff =
+        static_cast<std::int64_t>(config_.fetch.retry_backoff_ms)
+        << std::min(attempt - 1, 16);
+    std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+  }
+}
+
+Result<FetchedSource> Fetcher::fetchOnce(const FetchRequest& request) const {
+  FetchedSource out;
+  if (request.recipe == nullptr) {
+    return out;
+  }
+  const PortRecipe& recipe = *request.recipe;
+
+  if (recipe.src.type == "git") {
+    if (!recipe.src.url.empty()) {
+      auto s = fetchGit(recipe.src.url, recipe.src.rev, request.src_dir,
+                        request.log_path);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return out;
+  }
+
+  if (recipe.src.type != "url") {
+    if (recipe.src.type.empty()) {
+      return out;
+    }
+    return Status{StatusCode::kInvalidArgument,
+                  "Unsupported src.type for " + recipe.name + ": " +
+                      recipe.src.type};
+  }
+  if (recipe.src.url.empty()) {
+    return out;
+  }
+  if (config_.integrity.hash_algo != "sha256") {
+    return Status{StatusCode::kInvalidArgument,
+                  "Unsupported integrity.hash_algo: " +
+                      config_.integrity.hash_algo};
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(cache_.dir(), ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create downloads dir: " + cache_.dir().string()};
+  }
+
+  // Archives with a known sha256 come from the download cache and are only
+  // fetched on a miss; unhashed ones are fetched every time under their
+  // upstream file name.
+  if (!recipe.src.sha256.empty()) {
+    if (auto hit = cache_.find(recipe.src.sha256)) {
+      out.archive = *hit;
+      out.cached = true;
+      return out;
+    }
+    const auto staged = cache_.stagingPath(recipe.src.sha256);
+    auto unpack = startUnpack(request);
+    auto s = downloadVerified(recipe.src.url, config_.fetch.user_agent, staged,
+                              recipe.src.sha256, request.log_path, unpack.get(),
+                              out.bytes, out.unpacked);
+    if (!s.ok()) {
+      discardUnpacked(request, unpack.get());
+      return s;
+    }
+    auto committed = cache_.commit(staged, recipe.src.sha256);
+    if (!committed.ok()) {
+      return committed.status();
+    }
+    out.archive = committed.value();
+    return out;
+  }
+
+  std::string filename = "source.tar";
+  const auto slash = recipe.src.url.find_last_of('/');
+  if (slash != std::string::npos && slash + 1 < recipe.src.url.size()) {
+    filename = recipe.src.url.substr(slash + 1);
+  }
+  const auto archive_path =
+      cache_.dir() / (recipe.name + "-" + recipe.version + "-" + filename);
+  const auto partial = std::filesystem::path(archive_path.string() + ".part");
+  auto unpack = startUnpack(request);
+  auto s = downloadVerified(recipe.src.url, config_.fetch.user_agent, partial,
+                            {}, request.log_path, unpack.get(), out.bytes,
+                            out.unpacked);
+  if (!s.ok()) {
+    discardUnpacked(request, unpack.get());
+    return s;
+  }
+  std::filesystem::rename(partial, archive_path, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to move download into place: " + archive_path.string()};
+  }
+  out.archive = archive_path;
+  return out;
+}
+
+FetchQueue::FetchQueue(const Fetcher& fetcher,
+                       std::vector<FetchRequest> requests,
+                       std::vector<std::size_t> order,
+                       Options options)
+    : fetcher_(fetcher),
+      requests_(std::move(requests)),
+      order_(std::move(order)),
+      options_(std::move(options)),
+      results_(requests_.size()),
+      timings_(requests_.size()),
+      released_(requests_.size(), false),
+      holding_(requests_.size(), false),
+      created_(std::chrono::steady_clock::now()) {
+  if (order_.empty()) {
+    order_.resize(requests_.size());
+    std::iota(order_.begin(), order_.end(), std::size_t{0});
+  }
+  // Requests with nothing to fetch are complete from the start and never
+  // count against the ready bound.
+  std::vector<std::size_t> pending;
+  pending.reserve(order_.size());
+  for (std::size_t index : order_) {
+    if (requests_[index].recipe == nullptr) {
+      results_[index].emplace(FetchedSource{});
+      timings_[index].ready_at = created_;
+      released_[index] = true;
+    } else {
+      pending.push_back(index);
+    }
+  }
+  order_ = std::move(pending);
+
+  const std::size_t workers = std::min<std::size_t>(
+      order_.size(), static_cast<std::size_t>(std::max(1, options_.parallel)));
+  threads_.reserve(workers);
+  for (std::size_t i = 0; i < workers; ++i) {
+    threads_.emplace_back([this] { worker(); });
+  }
+}
+
+FetchQueue::~FetchQueue() {
+  cancel();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void FetchQueue::cancel() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (cancelled_) {
+    return;
+  }
+  cancelled_ = true;
+  const auto now = std::chrono::steady_clock::now();
+  for (std::size_t i = next_; i < order_.size(); ++i) {
+    results_[order_[i]].emplace(
+        Status{StatusCode::kInternalError, "fetch cancelled"});
+    timings_[order_[i]].ready_at = now;
+  }
+  next_ = order_.size();
+  cv_.notify_all();
+}
+
+const Result<FetchedSource>& FetchQueue::wait(std::size_t index) {
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&] { return results_[index].has_value(); });
+  return *results_[index];
+}
+
+const Result<FetchedSource>& FetchQueue::take(std::size_t index) {
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&] { return results_[index].has_value(); });
+  releaseLocked(index);
+  return *results_[index];
+}
+
+void FetchQueue::release(std::size_t index) {
+  std::lock_guard<std::mutex> lock(mu_);
+  releaseLocked(index);
+}
+
+void FetchQueue::releaseLocked(std::size_t index) {
+  released_[index] = true;
+  if (holding_[index]) {
+    holding_[index] = false;
+    --held_;
+    cv_.notify_all();
+  }
+}
+
+FetchQueue::StageTiming FetchQueue::timing(std::size_t index) {
+  std::lock_guard<std::mutex> lock(mu_);
+  return timings_[index];
+}
+
+void FetchQueue::worker() {
+  for (;;) {
+    std::size_t index = 0;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [&] {
+        return next_ >= order_.size() || options_.max_ready == 0 ||
+               held_ < options_.max_ready;
+      });
+      if (next_ >= order_.size()) {
+        return;
+      }
+      index = order_[next_++];
+      timings_[index].queued_ms =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - created_)
+              .count();
+      if (!released_[index]) {
+        holding_[index] = true;
+        ++held_;
+      }
+    }
+    const PortRecipe& recipe = *requests_[index].recipe;
+    BuildTrace::Span port_span(options_.trace, "fetch",
+                               recipe.name + "@" + recipe.version, "port",
+                               /*job=*/true);
+    auto result = [&] {
+      BuildTrace::Span span(options_.trace, "fetch", "fetch", "phase");
+      return fetcher_.fetch(requests_[index]);
+    }();
+    if (result.ok()) {
+      port_span.arg("source", result.value().describe());
+    }
+    if (result.ok() && options_.prepare) {
+      auto s = options_.prepare(index, result.value());
+      if (!s.ok()) {
+        result = Result<FetchedSource>(std::move(s));
+      }
+    }
+    if (!result.ok()) {
+      port_span.arg("error", result.status().message());
+    }
+    if (options_.on_done) {
+      std::lock_guard<std::mutex> lock(callback_mu_);
+      options_.on_done(index, result);
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    results_[index].emplace(std::move(result));
+    timings_[index].ready_at = std::chrono::steady_clock::now();
+    cv_.notify_all();
+  }
+}
+
+}  // namespace pkg
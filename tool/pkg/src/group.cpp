@@ -1,8 +1,10 @@
 #include "pkg/group.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <vector>
 
+#include "pkg/parallel.hpp"
 #include "toml_util.hpp"
 
 namespace pkg {
@@ -70,33 +72,47 @@ Result<Group> GroupStore::loadByName(const std::filesystem::path& root,
                 "Group file not found. searched: " + searched};
 }
 
-Status GroupStore::validateAll(const std::filesystem::path& root,
-                               const Config& config) {
+std::vector<Status> GroupStore::validateAll(const std::filesystem::path& root,
+                                            const Config& config) {
   bool found_any_dir = false;
+  std::vector<std::filesystem::path> files;
   for (const auto& groups_dir : candidateGroupDirs(root, config)) {
     if (!std::filesystem::exists(groups_dir) ||
         !std::filesystem::is_directory(groups_dir)) {
       continue;
     }
     found_any_dir = true;
+    const auto first = files.size();
     for (const auto& entry : std::filesystem::directory_iterator(groups_dir)) {
-      if (!entry.is_regular_file() || entry.path().extension() != ".toml") {
-        continue;
-      }
-      auto group = loadGroupFromPath(entry.path());
-      if (!group.ok()) {
-        return group.status();
+      if (entry.is_regular_file() && entry.path().extension() == ".toml") {
+        files.push_back(entry.path());
       }
     }
+    std::sort(files.begin() + static_cast<std::ptrdiff_t>(first), files.end());
   }
   if (!found_any_dir) {
-    return Status{StatusCode::kNotFound,
-                  "No group directory found (checked: " +
-                      (root / config.layout.groups_dir).string() + ", " +
-                      (root / "groups").string() + ", " +
-                      (root / "group").string() + ")"};
+    return {Status{StatusCode::kNotFound,
+                   "No group directory found (checked: " +
+                       (root / config.layout.groups_dir).string() + ", " +
+                       (root / "groups").string() + ", " +
+                       (root / "group").string() + ")"}};
+  }
+
+  std::vector<Status> results(files.size());
+  Parallel::forEach(files.size(), 0, [&](std::size_t i) {
+    auto group = loadGroupFromPath(files[i]);
+    if (!group.ok()) {
+      results[i] = group.status();
+    }
+  });
+
+  std::vector<Status> errors;
+  for (auto& status : results) {
+    if (!status.ok()) {
+      errors.push_back(std::move(status));
+    }
   }
-  return Status::Ok();
+  return errors;
 }
 
 }  // namespace pkg
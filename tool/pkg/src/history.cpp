@@ -0,0 +1,129 @@
+#include "pkg/history.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "toml_util.hpp"
+
+namespace pkg {
+namespace {
+
+std::filesystem::path historyPath(const std::filesystem::path& root,
+                                  const Config& config) {
+  return root / config.layout.build_dir / BuildHistoryStore::kHistoryFilename;
+}
+
+}  // namespace
+
+void BuildHistory::record(const std::string& name,
+                          const std::string& version,
+                          std::int64_t duration_ms,
+                          std::int64_t cpu_ms,
+                          std::int64_t max_rss_kb) {
+  auto& timing = ports[name];
+  if (timing.runs == 0) {
+    timing.avg_ms = duration_ms;
+    timing.avg_cpu_ms = cpu_ms;
+  } else {
+    // Exponential moving average so one odd run does not dominate.
+    timing.avg_ms = (timing.avg_ms * 3 + duration_ms) / 4;
+    timing.avg_cpu_ms = (timing.avg_cpu_ms * 3 + cpu_ms) / 4;
+  }
+  timing.version = version;
+  timing.last_ms = duration_ms;
+  timing.last_cpu_ms = cpu_ms;
+  timing.peak_rss_kb = std::max(timing.peak_rss_kb, max_rss_kb);
+  ++timing.runs;
+}
+
+Result<BuildHistory> BuildHistoryStore::load(const std::filesystem::path& root,
+                                             const Config& config) {
+  const auto path = historyPath(root, config);
+  BuildHistory history;
+  if (!std::filesystem::exists(path)) {
+    return history;
+  }
+
+  auto parsed = toml_util::parseFile(path);
+  if (!parsed.ok()) {
+    return parsed.status();
+  }
+
+  const toml::Datum top = parsed.value().toptab();
+  if (auto schema = toml_util::getInt(top, "schema")) {
+    history.schema = *schema;
+  }
+
+  auto port_arr = top.get("port");
+  if (port_arr.has_value() && port_arr->is_array()) {
+    auto rows = port_arr->as_vector();
+    if (!rows.has_value()) {
+      return Status{StatusCode::kParseError,
+                    "Invalid [[port]] array in " + path.string()};
+    }
+    for (const auto& row : *rows) {
+      if (!row.is_table()) {
+        continue;
+      }
+      const auto name = toml_util::getString(row, "name").value_or(std::string{});
+      if (name.empty()) {
+        continue;
+      }
+      PortTiming timing;
+      timing.version = toml_util::getString(row, "version").value_or(std::string{});
+      timing.runs = toml_util::getInt(row, "runs").value_or(0);
+      timing.last_ms = toml_util::getInt(row, "last_ms").value_or(0);
+      timing.avg_ms = toml_util::getInt(row, "avg_ms").value_or(0);
+      timing.last_cpu_ms = toml_util::getInt64(row, "last_cpu_ms").value_or(0);
+      timing.avg_cpu_ms = toml_util::getInt64(row, "avg_cpu_ms").value_or(0);
+      timing.peak_rss_kb = toml_util::getInt64(row, "peak_rss_kb").value_or(0);
+      history.ports[name] = std::move(timing);
+    }
+  }
+
+  return history;
+}
+
+Status BuildHistoryStore::save(const std::filesystem::path& root,
+                               const Config& config,
+                               const BuildHistory& history) {
+  const auto path = historyPath(root, config);
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  std::ofstream out(path);
+  if (!out) {
+    return Status{StatusCode::kIoError,
+                  "Failed to open history for write: " + path.string()};
+  }
+
+  std::vector<std::string> names;
+  names.reserve(history.ports.size());
+  for (const auto& [name, timing] : history.ports) {
+    names.push_back(name);
+  }
+  std::sort(names.begin(), names.end());
+
+  out << "schema = " << history.schema << "\n\n";
+  for (const auto& name : names) {
+    const auto& timing = history.ports.at(name);
+    out << "[[port]]\n";
+    out << "name = \"" << name << "\"\n";
+    out << "version = \"" << timing.version << "\"\n";
+    out << "runs = " << timing.runs << "\n";
+    out << "last_ms = " << timing.last_ms << "\n";
+    out << "avg_ms = " << timing.avg_ms << "\n";
+    out << "last_cpu_ms = " << timing.last_cpu_ms << "\n";
+    out << "avg_cpu_ms = " << timing.avg_cpu_ms << "\n";
+    out << "peak_rss_kb = " << timing.peak_rss_kb << "\n\n";
+  }
+
+  if (!out.good()) {
+    return Status{StatusCode::kIoError,
+                  "Failed while writing history: " + path.string()};
+  }
+  return Status::Ok();
+}
+
+}  // namespace pkg
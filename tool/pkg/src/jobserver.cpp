@@ -0,0 +1,112 @@
+#include "pkg/jobserver.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pkg {
+namespace {
+
+constexpr char kToken = '+';
+
+}  // namespace
+
+Jobserver::Jobserver(std::filesystem::path fifo_path, int fd, int jobs)
+    : fifo_path_(std::move(fifo_path)), fd_(fd), jobs_(jobs) {}
+
+Jobserver::~Jobserver() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  std::error_code ec;
+  std::filesystem::remove(fifo_path_, ec);
+}
+
+Result<std::unique_ptr<Jobserver>> Jobserver::create(
+    const std::filesystem::path& fifo_path, int jobs) {
+  if (jobs < 1) {
+    jobs = 1;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(fifo_path.parent_path(), ec);
+  std::filesystem::remove(fifo_path, ec);
+  if (::mkfifo(fifo_path.c_str(), 0600) != 0) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create jobserver fifo " + fifo_path.string() +
+                      ": " + std::strerror(errno)};
+  }
+  // O_RDWR keeps the FIFO open for writing so reads never see EOF while
+  // children come and go.
+  const int fd = ::open(fifo_path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    const int err = errno;
+    std::filesystem::remove(fifo_path, ec);
+    return Status{StatusCode::kIoError,
+                  "Failed to open jobserver fifo " + fifo_path.string() +
+                      ": " + std::strerror(err)};
+  }
+
+  std::unique_ptr<Jobserver> server(new Jobserver(fifo_path, fd, jobs));
+  const std::vector<char> tokens(static_cast<std::size_t>(jobs - 1), kToken);
+  std::size_t written = 0;
+  while (written < tokens.size()) {
+    const ssize_t n =
+        ::write(fd, tokens.data() + written, tokens.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return Status{StatusCode::kIoError,
+                    "Failed to fill jobserver fifo: " +
+                        std::string(std::strerror(errno))};
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  return server;
+}
+
+Jobserver::Slot Jobserver::acquire() {
+  bool expected = true;
+  if (implicit_free_.compare_exchange_strong(expected, false)) {
+    return Slot::kImplicit;
+  }
+  char token = 0;
+  for (;;) {
+    const ssize_t n = ::read(fd_, &token, 1);
+    if (n == 1) {
+      return Slot::kToken;
+    }
+    if (n == 0 || errno != EINTR) {
+      // The pool is unusable; run without a token rather than stall.
+      return Slot::kNone;
+    }
+  }
+}
+
+void Jobserver::release(Slot slot) {
+  if (slot == Slot::kNone) {
+    return;
+  }
+  if (slot == Slot::kImplicit) {
+    implicit_free_.store(true);
+    return;
+  }
+  for (;;) {
+    const ssize_t n = ::write(fd_, &kToken, 1);
+    if (n == 1 || (n < 0 && errno != EINTR)) {
+      return;
+    }
+  }
+}
+
+std::string Jobserver::makeflags() const {
+  return "-j" + std::to_string(jobs_) +
+         " --jobserver-auth=fifo:" + fifo_path_.string();
+}
+
+}  // namespace pkg
@@ -1,32 +1,175 @@
 #include "pkg/lockfile.hpp"
 
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "toml_util.hpp"
 
 namespace pkg {
+namespace {
 
-Result<Lockfile> LockfileStore::load(const std::filesystem::path& root,
-                                     const Config& config) {
-  const auto path = root / config.layout.lockfile;
-  if (!std::filesystem::exists(path)) {
-    return Status{StatusCode::kNotFound,
-                  "Lockfile not found: " + path.string()};
+// Ends the journal's initial snapshot and every record appended after it.
+// A TOML comment, so the journal still parses as a lockfile; anything after
+// the last one was torn by a crash, even if it happens to parse.
+constexpr std::string_view kRecordEnd = "\n# end\n";
+
+std::filesystem::path journalPath(const std::filesystem::path& lock_path) {
+  return lock_path.string() + LockfileStore::kJournalSuffix;
+}
+
+void appendEntry(std::ostream& out, const LockEntry& e) {
+  out << "[[entry]]\n";
+  out << "name = \"" << e.name << "\"\n";
+  out << "version = \"" << e.version << "\"\n";
+  out << "status = \"" << e.status << "\"\n";
+  out << "recipe = \"" << e.recipe << "\"\n";
+  out << "drv = \"" << e.drv << "\"\n";
+  out << "store = \"" << e.store << "\"\n";
+  out << "deps = [";
+  for (size_t i = 0; i < e.deps.size(); ++i) {
+    out << "\"" << e.deps[i] << "\"";
+    if (i + 1 != e.deps.size()) {
+      out << ", ";
+    }
+  }
+  out << "]\n";
+  out << "fetch_wait_ms = " << e.fetch_wait_ms << "\n";
+  out << "build_wait_ms = " << e.build_wait_ms << "\n\n";
+  for (const auto& p : e.phases) {
+    out << "[[entry.phase]]\n";
+    out << "name = \"" << p.phase << "\"\n";
+    out << "exit_code = " << p.exit_code << "\n";
+    if (p.term_signal != 0) {
+      out << "signal = " << p.term_signal << "\n";
+    }
+    out << "wall_ms = " << p.wall_ms << "\n";
+    out << "user_ms = " << p.user_ms << "\n";
+    out << "sys_ms = " << p.sys_ms << "\n";
+    out << "max_rss_kb = " << p.max_rss_kb << "\n";
+    out << "read_bytes = " << p.read_bytes << "\n";
+    out << "write_bytes = " << p.write_bytes << "\n\n";
+  }
+}
+
+std::string serialize(const Lockfile& lockfile) {
+  std::ostringstream out;
+  out << "schema = " << lockfile.schema << "\n";
+  out << "state = \"" << lockfile.state << "\"\n\n";
+  for (const auto& e : lockfile.entries) {
+    appendEntry(out, e);
   }
+  return out.str();
+}
+
+Status ioError(const std::string& what, const std::filesystem::path& path) {
+  return Status{StatusCode::kIoError,
+                what + " " + path.string() + ": " + std::strerror(errno)};
+}
+
+Status writeAll(int fd, std::string_view data, const std::filesystem::path& path) {
+  while (!data.empty()) {
+    const ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ioError("Failed while writing", path);
+    }
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  return Status::Ok();
+}
+
+// Writes `data` to a temporary file next to `path`, syncs it and renames it
+// into place, so readers see either the old contents or the new ones.
+Status writeAtomically(const std::filesystem::path& path, std::string_view data) {
+  const auto tmp = std::filesystem::path(path.string() + "." +
+                                         std::to_string(::getpid()) + ".tmp");
+  const int fd =
+      ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return ioError("Failed to open for write:", tmp);
+  }
+  auto s = writeAll(fd, data, tmp);
+  if (s.ok() && ::fsync(fd) != 0) {
+    s = ioError("fsync failed for", tmp);
+  }
+  ::close(fd);
+  if (s.ok() && ::rename(tmp.c_str(), path.c_str()) != 0) {
+    s = ioError("Failed to replace", path);
+  }
+  if (!s.ok()) {
+    ::unlink(tmp.c_str());
+    return s;
+  }
+  // Make the rename itself durable.
+  const auto dir = path.has_parent_path() ? path.parent_path()
+                                          : std::filesystem::path(".");
+  const int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return Status::Ok();
+}
 
-  auto parsed = toml_util::parseFile(path);
+// Cuts a journal whose last record was torn by a crash back to the end of
+// the last complete one. Returns false if the journal cannot be read.
+bool truncateTornRecord(const std::filesystem::path& path) {
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  std::string contents(size, '\0');
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  const ssize_t n = ::read(fd, contents.data(), contents.size());
+  ::close(fd);
+  if (n != static_cast<ssize_t>(size)) {
+    return false;
+  }
+  // begin() writes the snapshot and its marker atomically, so a journal
+  // without any marker predates them and is left to the parser.
+  const auto pos = contents.rfind(kRecordEnd);
+  if (pos == std::string::npos) {
+    return true;
+  }
+  const auto end = pos + kRecordEnd.size();
+  if (end == contents.size()) {
+    return true;
+  }
+  return ::truncate(path.c_str(), static_cast<off_t>(end)) == 0;
+}
+
+Result<Lockfile> parse(const std::filesystem::path& path) {
+  // The parse tree is only needed until the entries are copied out.
+  Arena arena;
+  auto parsed = toml_util::parseFile(path.native(), arena);
   if (!parsed.ok()) {
     return parsed.status();
   }
 
   Lockfile lock;
-  const toml::Datum top = parsed.value().toptab();
+  const toml::Datum& top = parsed.value();
   if (auto schema = toml_util::getInt(top, "schema")) {
     lock.schema = *schema;
   }
   lock.state = toml_util::getString(top, "state").value_or(std::string{});
 
+  // A journal repeats an entry each time it changes; the last copy wins
+  // and keeps the position of the first.
+  std::unordered_map<std::string, std::size_t> position;
   auto entry_arr = top.get("entry");
   if (entry_arr.has_value() && entry_arr->is_array()) {
     auto rows = entry_arr->as_vector();
@@ -42,54 +185,139 @@ Result<Lockfile> LockfileStore::load(const std::filesystem::path& root,
       e.version = toml_util::getString(row, "version").value_or(std::string{});
       e.status = toml_util::getString(row, "status").value_or(std::string{});
       e.recipe = toml_util::getString(row, "recipe").value_or(std::string{});
+      e.drv = toml_util::getString(row, "drv").value_or(std::string{});
       e.store = toml_util::getString(row, "store").value_or(std::string{});
       auto deps = toml_util::getStringArray(row, "deps");
       if (!deps.ok()) {
         return deps.status();
       }
       e.deps = std::move(deps.value());
-      lock.entries.push_back(std::move(e));
+      e.fetch_wait_ms = toml_util::getInt(row, "fetch_wait_ms").value_or(0);
+      e.build_wait_ms = toml_util::getInt(row, "build_wait_ms").value_or(0);
+      auto phase_arr = row.get("phase");
+      if (phase_arr.has_value() && phase_arr->is_array()) {
+        auto phases = phase_arr->as_vector();
+        if (!phases.has_value()) {
+          return Status{StatusCode::kParseError,
+                        "Invalid [[entry.phase]] array in lockfile"};
+        }
+        for (const auto& p : *phases) {
+          PhaseUsage usage;
+          usage.phase = toml_util::getString(p, "name").value_or(std::string{});
+          usage.exit_code = toml_util::getInt(p, "exit_code").value_or(0);
+          usage.term_signal = toml_util::getInt(p, "signal").value_or(0);
+          usage.wall_ms = toml_util::getInt64(p, "wall_ms").value_or(0);
+          usage.user_ms = toml_util::getInt64(p, "user_ms").value_or(0);
+          usage.sys_ms = toml_util::getInt64(p, "sys_ms").value_or(0);
+          usage.max_rss_kb = toml_util::getInt64(p, "max_rss_kb").value_or(0);
+          usage.read_bytes = toml_util::getInt64(p, "read_bytes").value_or(0);
+          usage.write_bytes = toml_util::getInt64(p, "write_bytes").value_or(0);
+          e.phases.push_back(std::move(usage));
+        }
+      }
+      const auto [it, inserted] = position.try_emplace(e.name, lock.entries.size());
+      if (inserted) {
+        lock.entries.push_back(std::move(e));
+      } else {
+        lock.entries[it->second] = std::move(e);
+      }
     }
   }
 
   return lock;
 }
 
+}  // namespace
+
+Result<Lockfile> LockfileStore::load(const std::filesystem::path& root,
+                                     const Config& config) {
+  const auto path = root / config.layout.lockfile;
+  const auto journal = journalPath(path);
+  std::error_code ec;
+  const bool have_lock = std::filesystem::exists(path, ec);
+  const bool have_journal = std::filesystem::exists(journal, ec);
+  if (!have_lock && !have_journal) {
+    return Status{StatusCode::kNotFound,
+                  "Lockfile not found: " + path.string()};
+  }
+  // compact() renames the lockfile into place before removing the journal,
+  // so a journal that is not older than the lockfile is the newer record.
+  if (have_journal &&
+      (!have_lock || std::filesystem::last_write_time(journal, ec) >=
+                         std::filesystem::last_write_time(path, ec))) {
+    if (!truncateTornRecord(journal)) {
+      return Status{StatusCode::kIoError,
+                    "Failed to read journal " + journal.string()};
+    }
+    return parse(journal);
+  }
+  return parse(path);
+}
+
 Status LockfileStore::save(const std::filesystem::path& root,
                            const Config& config,
                            const Lockfile& lockfile) {
-  const auto path = root / config.layout.lockfile;
-  std::ofstream out(path);
-  if (!out) {
-    return Status{StatusCode::kIoError,
-                  "Failed to open lockfile for write: " + path.string()};
-  }
+  return writeAtomically(root / config.layout.lockfile, serialize(lockfile));
+}
 
-  out << "schema = " << lockfile.schema << "\n";
-  out << "state = \"" << lockfile.state << "\"\n\n";
+LockfileJournal::LockfileJournal(std::filesystem::path root,
+                                 const Config& config,
+                                 std::filesystem::path path,
+                                 int fd)
+    : root_(std::move(root)), config_(config), path_(std::move(path)), fd_(fd) {}
 
-  for (const auto& e : lockfile.entries) {
-    out << "[[entry]]\n";
-    out << "name = \"" << e.name << "\"\n";
-    out << "version = \"" << e.version << "\"\n";
-    out << "status = \"" << e.status << "\"\n";
-    out << "recipe = \"" << e.recipe << "\"\n";
-    out << "store = \"" << e.store << "\"\n";
-    out << "deps = [";
-    for (size_t i = 0; i < e.deps.size(); ++i) {
-      out << "\"" << e.deps[i] << "\"";
-      if (i + 1 != e.deps.size()) {
-        out << ", ";
-      }
-    }
-    out << "]\n\n";
+LockfileJournal::~LockfileJournal() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+Result<std::unique_ptr<LockfileJournal>> LockfileJournal::begin(
+    const std::filesystem::path& root,
+    const Config& config,
+    const Lockfile& lockfile) {
+  const auto path = journalPath(root / config.layout.lockfile);
+  Lockfile building = lockfile;
+  building.state = "building";
+  auto s = writeAtomically(path,
+                           serialize(building) + std::string(kRecordEnd));
+  if (!s.ok()) {
+    return s;
   }
+  const int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    return ioError("Failed to open journal", path);
+  }
+  return std::unique_ptr<LockfileJournal>(
+      new LockfileJournal(root, config, path, fd));
+}
 
-  if (!out.good()) {
-    return Status{StatusCode::kIoError,
-                  "Failed while writing lockfile: " + path.string()};
+Status LockfileJournal::record(const LockEntry& entry) {
+  std::ostringstream out;
+  out << "\n";
+  appendEntry(out, entry);
+  out << kRecordEnd;
+  const std::string record = out.str();
+  std::lock_guard<std::mutex> lock(mu_);
+  // With O_APPEND and a single write per record, a crash can tear at most
+  // the last record, which load() drops for lacking its end marker.
+  auto s = writeAll(fd_, record, path_);
+  if (s.ok() && ::fdatasync(fd_) != 0) {
+    s = ioError("fdatasync failed for", path_);
   }
+  return s;
+}
 
+Status LockfileJournal::compact(const Lockfile& lockfile) {
+  auto s = LockfileStore::save(root_, config_, lockfile);
+  if (!s.ok()) {
+    return s;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  ::close(fd_);
+  fd_ = -1;
+  std::error_code ec;
+  std::filesystem::remove(path_, ec);
   return Status::Ok();
 }
 
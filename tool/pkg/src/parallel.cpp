@@ -0,0 +1,39 @@
+#include "pkg/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace pkg {
+
+void Parallel::forEach(std::size_t count,
+                       int threads,
+                       const std::function<void(std::size_t index)>& task) {
+  if (threads <= 0) {
+    threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  const std::size_t workers =
+      std::min(count, static_cast<std::size_t>(threads));
+  std::atomic<std::size_t> next{0};
+  const auto drain = [&] {
+    for (std::size_t i = next++; i < count; i = next++) {
+      task(i);
+    }
+  };
+  if (workers <= 1) {
+    drain();
+    return;
+  }
+  std::vector<std::thread> pool;
+  pool.reserve(workers - 1);
+  for (std::size_t i = 1; i < workers; ++i) {
+    pool.emplace_back(drain);
+  }
+  drain();
+  for (auto& t : pool) {
+    t.join();
+  }
+}
+
+}  // namespace pkg
@@ -1,95 +1,137 @@
 #include "pkg/port.hpp"
 
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <filesystem>
 #include <string>
+#include <vector>
 
+#include "pkg/parallel.hpp"
+#include "pkg/recipe_cache.hpp"
+#include "pkg/recipe_index.hpp"
+#include "pkg/resolver.hpp"
+#include "pkg/sha256.hpp"
 #include "toml_util.hpp"
 
 namespace pkg {
 namespace {
 
-Status validateScriptPath(const std::filesystem::path& recipe_path,
-                          const std::string& script,
+// Paths are plain strings here: std::filesystem::path allocates for every
+// component, which dominates the cost of loading a batch of recipes.
+bool fileExists(const std::string& path) {
+  struct stat st {};
+  return ::stat(path.c_str(), &st) == 0;
+}
+
+Status validateScriptPath(const std::string& recipe_path,
+                          std::string_view script,
                           std::string_view field_name,
                           bool required) {
   if (script.empty()) {
     if (required) {
       return Status{StatusCode::kParseError,
                     "Missing required scripts." + std::string(field_name) +
-                        " in " + recipe_path.string()};
+                        " in " + recipe_path};
     }
     return Status::Ok();
   }
-  const auto script_path = recipe_path.parent_path() / script;
-  if (!std::filesystem::exists(script_path)) {
+  thread_local std::string script_path;
+  script_path.assign(recipe_path, 0, recipe_path.rfind('/') + 1);
+  script_path.append(script);
+  struct stat st {};
+  if (::stat(script_path.c_str(), &st) != 0) {
     return Status{StatusCode::kNotFound,
                   "Script not found for scripts." + std::string(field_name) +
-                      ": " + script_path.string()};
+                      ": " + script_path};
   }
-  if (!std::filesystem::is_regular_file(script_path)) {
+  if (!S_ISREG(st.st_mode)) {
     return Status{StatusCode::kInvalidArgument,
                   "Script path is not a file for scripts." + std::string(field_name) +
-                      ": " + script_path.string()};
+                      ": " + script_path};
   }
   return Status::Ok();
 }
 
-Result<VersionPointers> loadVersionsFromPath(const std::filesystem::path& path) {
-  auto parsed = toml_util::parseFile(path);
+// Parses versions.toml into `arena` and checks that `current` is set.
+Result<toml::Datum> parseVersions(const std::string& path, Arena& arena) {
+  auto parsed = toml_util::parseFile(path, arena);
   if (!parsed.ok()) {
     return parsed.status();
   }
-  VersionPointers pointers;
-  const toml::Datum top = parsed.value().toptab();
-  pointers.last = toml_util::getString(top, "last").value_or(std::string{});
-  pointers.current = toml_util::getString(top, "current").value_or(std::string{});
-  pointers.next = toml_util::getString(top, "next").value_or(std::string{});
-
-  const auto required = toml_util::requireNonEmpty(pointers.current, "current", path);
+  const auto current = toml_util::getStringView(parsed.value(), "current")
+                           .value_or(std::string_view{});
+  const auto required = toml_util::requireNonEmpty(current, "current", path);
   if (!required.ok()) {
     return required;
   }
+  return parsed;
+}
 
+Result<VersionPointers> loadVersionsFromPath(const std::filesystem::path& path) {
+  Arena arena;
+  auto parsed = parseVersions(path.native(), arena);
+  if (!parsed.ok()) {
+    return parsed.status();
+  }
+  VersionPointers pointers;
+  const toml::Datum& top = parsed.value();
+  pointers.last = toml_util::getStringView(top, "last").value_or(std::string_view{});
+  pointers.current = toml_util::getStringView(top, "current").value_or(std::string_view{});
+  pointers.next = toml_util::getStringView(top, "next").value_or(std::string_view{});
   return pointers;
 }
 
-Result<PortRecipe> loadRecipeFromPath(const std::filesystem::path& path,
-                                      std::string_view expected_name,
-                                      std::string_view expected_version) {
-  auto parsed = toml_util::parseFile(path);
+Result<PortRecipeView> loadRecipeViewFromPath(const std::string& path,
+                                              std::string_view expected_name,
+                                              std::string_view expected_version,
+                                              Arena& arena) {
+  auto parsed = toml_util::parseFile(path, arena);
   if (!parsed.ok()) {
     return parsed.status();
   }
 
-  PortRecipe recipe;
-  const toml::Datum top = parsed.value().toptab();
+  PortRecipeView recipe;
+  const toml::Datum& top = parsed.value();
 
-  recipe.name = toml_util::getString(top, "name").value_or(std::string{});
-  recipe.version = toml_util::getString(top, "version").value_or(std::string{});
-  recipe.summary = toml_util::getString(top, "summary").value_or(std::string{});
-  recipe.license = toml_util::getString(top, "license").value_or(std::string{});
-  recipe.recipe_path = path;
+  recipe.name = toml_util::getStringView(top, "name").value_or(std::string_view{});
+  recipe.version = toml_util::getStringView(top, "version").value_or(std::string_view{});
+  recipe.summary = toml_util::getStringView(top, "summary").value_or(std::string_view{});
+  recipe.license = toml_util::getStringView(top, "license").value_or(std::string_view{});
+  recipe.recipe_path = arena.copy(path);
+
+  // Reused across loads so batches do not reallocate it per recipe.
+  thread_local std::string canonical;
+  canonical.clear();
+  toml_util::appendCanonical(top, canonical);
+  Sha256 manifest;
+  manifest.update(canonical);
+  if (auto* hex = static_cast<char*>(arena.allocate(Sha256::kDigestSize * 2, 1))) {
+    Sha256::toHex(manifest.finish(), hex);
+    recipe.manifest_sha256 = std::string_view(hex, Sha256::kDigestSize * 2);
+  }
 
-  auto deps = toml_util::getStringArray(top, "deps");
+  auto deps = toml_util::getStringArray(top, "deps", arena);
   if (!deps.ok()) {
-    return Status{deps.status().code(), deps.status().message() + " in " + path.string()};
+    return Status{deps.status().code(), deps.status().message() + " in " + path};
   }
-  recipe.deps = std::move(deps.value());
+  recipe.deps = deps.value();
 
   if (auto src = top.get("src"); src.has_value() && src->is_table()) {
-    recipe.src.type = toml_util::getString(*src, "type").value_or(std::string{});
-    recipe.src.url = toml_util::getString(*src, "url").value_or(std::string{});
-    recipe.src.sha256 = toml_util::getString(*src, "sha256").value_or(std::string{});
+    recipe.src.type = toml_util::getStringView(*src, "type").value_or(std::string_view{});
+    recipe.src.url = toml_util::getStringView(*src, "url").value_or(std::string_view{});
+    recipe.src.sha256 = toml_util::getStringView(*src, "sha256").value_or(std::string_view{});
+    recipe.src.rev = toml_util::getStringView(*src, "rev").value_or(std::string_view{});
   }
 
   if (auto build = top.get("build"); build.has_value() && build->is_table()) {
-    recipe.build.system = toml_util::getString(*build, "system").value_or("make");
+    recipe.build.system = toml_util::getStringView(*build, "system").value_or("make");
   }
   if (auto scripts = top.get("scripts"); scripts.has_value() && scripts->is_table()) {
-    recipe.scripts.patch = toml_util::getString(*scripts, "patch").value_or(std::string{});
-    recipe.scripts.build = toml_util::getString(*scripts, "build").value_or(std::string{});
-    recipe.scripts.install = toml_util::getString(*scripts, "install").value_or(std::string{});
-    recipe.scripts.check = toml_util::getString(*scripts, "check").value_or(std::string{});
+    recipe.scripts.patch = toml_util::getStringView(*scripts, "patch").value_or(std::string_view{});
+    recipe.scripts.build = toml_util::getStringView(*scripts, "build").value_or(std::string_view{});
+    recipe.scripts.install = toml_util::getStringView(*scripts, "install").value_or(std::string_view{});
+    recipe.scripts.check = toml_util::getStringView(*scripts, "check").value_or(std::string_view{});
   }
 
   auto status = toml_util::requireNonEmpty(recipe.name, "name", path);
@@ -99,19 +141,22 @@ Result<PortRecipe> loadRecipeFromPath(const std::filesystem::path& path,
 
   if (recipe.name != expected_name) {
     return Status{StatusCode::kParseError,
-                  "Recipe name mismatch in " + path.string() + ": expected '" +
-                      std::string(expected_name) + "' got '" + recipe.name + "'"};
+                  "Recipe name mismatch in " + path + ": expected '" +
+                      std::string(expected_name) + "' got '" +
+                      std::string(recipe.name) + "'"};
   }
   if (recipe.version != expected_version) {
     return Status{StatusCode::kParseError,
-                  "Recipe version mismatch in " + path.string() + ": expected '" +
-                      std::string(expected_version) + "' got '" + recipe.version + "'"};
+                  "Recipe version mismatch in " + path + ": expected '" +
+                      std::string(expected_version) + "' got '" +
+                      std::string(recipe.version) + "'"};
   }
 
   if (recipe.build.system != "make" && recipe.build.system != "gmake" &&
       recipe.build.system != "cmake" && recipe.build.system != "meson") {
     return Status{StatusCode::kInvalidArgument,
-                  "Unsupported build.system in " + path.string() + ": " + recipe.build.system};
+                  "Unsupported build.system in " + path + ": " +
+                      std::string(recipe.build.system)};
   }
 
   auto script_status =
@@ -138,6 +183,177 @@ Result<PortRecipe> loadRecipeFromPath(const std::filesystem::path& path,
   return recipe;
 }
 
+Result<PortRecipe> loadRecipeFromPath(const std::filesystem::path& path,
+                                      std::string_view expected_name,
+                                      std::string_view expected_version) {
+  // One short-lived arena holds the file and the whole parse tree; the
+  // recipe copies out what it keeps.
+  Arena arena;
+  auto view =
+      loadRecipeViewFromPath(path.native(), expected_name, expected_version, arena);
+  if (!view.ok()) {
+    return view.status();
+  }
+  return view.value().toRecipe();
+}
+
+Result<std::vector<std::string>> listPorts(const std::filesystem::path& ports_dir) {
+  if (!std::filesystem::exists(ports_dir)) {
+    return Status{StatusCode::kNotFound,
+                  "Ports directory not found: " + ports_dir.string()};
+  }
+  std::vector<std::string> port_names;
+  std::error_code ec;
+  for (const auto& port_dir :
+       std::filesystem::directory_iterator(ports_dir, ec)) {
+    if (port_dir.is_directory() &&
+        std::filesystem::exists(port_dir.path() / "versions.toml")) {
+      port_names.push_back(port_dir.path().filename().string());
+    }
+  }
+  if (ec) {
+    return Status{StatusCode::kIoError, "Failed to list ports directory " +
+                                            ports_dir.string() + ": " +
+                                            ec.message()};
+  }
+  // Errors are reported in port name order regardless of which thread
+  // finished first.
+  std::sort(port_names.begin(), port_names.end());
+  return port_names;
+}
+
+Status checkDeps(const PortRecipe& recipe,
+                 const std::vector<std::string>& port_names) {
+  std::string missing;
+  for (const auto& dep : recipe.deps) {
+    if (!std::binary_search(port_names.begin(), port_names.end(), dep)) {
+      missing += (missing.empty() ? "" : ", ") + dep;
+    }
+  }
+  if (missing.empty()) {
+    return Status::Ok();
+  }
+  return Status{StatusCode::kNotFound,
+                "Port '" + recipe.name + "' depends on unknown port(s): " +
+                    missing + " in " + recipe.recipe_path.string()};
+}
+
+// Validates the tree against build/validated.bin. A port is unchanged when
+// the snapshot still holds current records for its versions.toml and its
+// current pkg.toml (whose stamps cover the scripts). With `incremental`
+// off every port counts as changed. Changed ports are loaded and
+// dep-checked, as are the ports that depend on a changed or removed port,
+// since a dependency list can break without its own recipe changing.
+std::vector<Status> validateTree(const std::filesystem::path& root,
+                                 const Config& config,
+                                 bool incremental,
+                                 std::size_t* checked) {
+  const auto ports_dir = root / config.layout.ports_dir;
+  auto listed = listPorts(ports_dir);
+  if (!listed.ok()) {
+    return {listed.status()};
+  }
+  const auto& port_names = listed.value();
+  auto snapshot = RecipeIndex::open(root / config.layout.build_dir /
+                                    PortStore::kValidatedFilename);
+
+  // Deps of every port: from the snapshot when unchanged, freshly loaded
+  // otherwise. `recipes[i]` is only set once port i has been loaded.
+  std::vector<std::vector<std::string>> deps(port_names.size());
+  std::vector<const PortRecipe*> recipes(port_names.size(), nullptr);
+  std::vector<char> changed(port_names.size(), 0);
+  std::vector<Status> results(port_names.size());
+  Parallel::forEach(port_names.size(), 0, [&](std::size_t i) {
+    const auto port_dir = ports_dir / port_names[i];
+    if (incremental) {
+      if (auto versions =
+              snapshot->findVersions(RecipeIndex::versionsKey(port_dir))) {
+        if (auto recipe = snapshot->findRecipe(
+                RecipeIndex::recipeKey(port_dir, versions->current))) {
+          deps[i] = std::move(recipe->deps);
+          return;
+        }
+      }
+    }
+    changed[i] = 1;
+    auto recipe = RecipeCache::global().current(root, config, port_names[i]);
+    if (!recipe.ok()) {
+      results[i] = recipe.status();
+      return;
+    }
+    recipes[i] = recipe.value();
+    deps[i] = recipe.value()->deps;
+  });
+
+  std::vector<std::string> dirty;
+  for (std::size_t i = 0; i < port_names.size(); ++i) {
+    if (changed[i]) {
+      dirty.push_back(port_names[i]);
+    }
+  }
+  for (const auto& key : snapshot->portKeys()) {
+    const auto name = std::filesystem::path(key).filename().string();
+    if (!std::binary_search(port_names.begin(), port_names.end(), name)) {
+      dirty.push_back(name);
+    }
+  }
+  std::sort(dirty.begin(), dirty.end());
+
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < port_names.size(); ++i) {
+    bool affected = changed[i] != 0;
+    for (std::size_t d = 0; !affected && d < deps[i].size(); ++d) {
+      affected = std::binary_search(dirty.begin(), dirty.end(), deps[i][d]);
+    }
+    if (!affected) {
+      continue;
+    }
+    ++count;
+    if (!results[i].ok()) {
+      continue;
+    }
+    if (recipes[i] == nullptr) {
+      auto recipe = RecipeCache::global().current(root, config, port_names[i]);
+      if (!recipe.ok()) {
+        results[i] = recipe.status();
+        continue;
+      }
+      recipes[i] = recipe.value();
+    }
+    results[i] = checkDeps(*recipes[i], port_names);
+  }
+  *checked = count;
+
+  std::vector<Status> errors;
+  for (auto& status : results) {
+    if (!status.ok()) {
+      errors.push_back(std::move(status));
+    }
+  }
+  if (!errors.empty()) {
+    return errors;
+  }
+
+  // Only a fully valid tree is recorded, so failures are re-checked on
+  // every run until fixed.
+  for (std::size_t i = 0; i < port_names.size(); ++i) {
+    if (!changed[i]) {
+      continue;
+    }
+    const auto port_dir = ports_dir / port_names[i];
+    auto versions = RecipeCache::global().versions(root, config, port_names[i]);
+    if (versions.ok()) {
+      snapshot->putVersions(RecipeIndex::versionsKey(port_dir),
+                            *versions.value(), port_dir / "versions.toml");
+    }
+    snapshot->putRecipe(
+        RecipeIndex::recipeKey(port_dir, recipes[i]->version), *recipes[i]);
+  }
+  // The snapshot only saves work; failing to write it is not an error.
+  snapshot->save();
+  return errors;
+}
+
 }  // namespace
 
 Result<VersionPointers> PortStore::loadVersions(const std::filesystem::path& root,
@@ -161,6 +377,74 @@ Result<PortRecipe> PortStore::loadCurrentRecipe(const std::filesystem::path& roo
   return loadRecipeAtVersion(root, config, port_name, versions.value().current);
 }
 
+PortRecipe PortRecipeView::toRecipe() const {
+  PortRecipe recipe;
+  recipe.name = name;
+  recipe.version = version;
+  recipe.summary = summary;
+  recipe.license = license;
+  recipe.deps.assign(deps.begin(), deps.end());
+  recipe.src.type = src.type;
+  recipe.src.url = src.url;
+  recipe.src.sha256 = src.sha256;
+  recipe.src.rev = src.rev;
+  recipe.build.system = build.system;
+  recipe.scripts.patch = scripts.patch;
+  recipe.scripts.build = scripts.build;
+  recipe.scripts.install = scripts.install;
+  recipe.scripts.check = scripts.check;
+  recipe.recipe_path = recipe_path;
+  recipe.manifest_sha256 = manifest_sha256;
+  return recipe;
+}
+
+Result<PortRecipeView> PortStore::loadRecipeViewAtVersion(
+    const std::filesystem::path& root,
+    const Config& config,
+    std::string_view port_name,
+    std::string_view version,
+    Arena& arena) {
+  const auto path = root / config.layout.ports_dir / std::string(port_name) /
+                    std::string(version) / "pkg.toml";
+  if (!std::filesystem::exists(path)) {
+    return Status{StatusCode::kNotFound,
+                  "pkg.toml not found: " + path.string()};
+  }
+  return loadRecipeViewFromPath(path.native(), port_name, version, arena);
+}
+
+std::vector<Result<PortRecipeView>> PortStore::loadCurrentViews(
+    const std::filesystem::path& root,
+    const Config& config,
+    const std::vector<std::string>& port_names,
+    Arena& arena) {
+  std::vector<Result<PortRecipeView>> out;
+  out.reserve(port_names.size());
+  const std::string ports_dir = (root / config.layout.ports_dir).native() + "/";
+  std::string path;
+  for (const auto& name : port_names) {
+    path.assign(ports_dir).append(name).append("/versions.toml");
+    if (!fileExists(path)) {
+      out.emplace_back(Status{StatusCode::kNotFound,
+                              "versions.toml not found for port '" + name + "'"});
+      continue;
+    }
+    auto versions = parseVersions(path, arena);
+    if (!versions.ok()) {
+      out.emplace_back(versions.status());
+      continue;
+    }
+    const auto current = *toml_util::getStringView(versions.value(), "current");
+    path.assign(ports_dir).append(name).append("/").append(current).append("/pkg.toml");
+    if (!fileExists(path)) {
+      out.emplace_back(Status{StatusCode::kNotFound, "pkg.toml not found: " + path});
+      continue;
+    }
+    out.push_back(loadRecipeViewFromPath(path, name, current, arena));
+  }
+  return out;
+}
+
 Result<PortRecipe> PortStore::loadRecipeAtVersion(const std::filesystem::path& root,
                                                   const Config& config,
                                                   std::string_view port_name,
@@ -174,32 +458,56 @@ Result<PortRecipe> PortStore::loadRecipeAtVersion(const std::filesystem::path& r
   return loadRecipeFromPath(path, port_name, version);
 }
 
-Status PortStore::validateAll(const std::filesystem::path& root,
-                              const Config& config) {
-  const auto ports_dir = root / config.layout.ports_dir;
-  if (!std::filesystem::exists(ports_dir)) {
-    return Status{StatusCode::kNotFound,
-                  "Ports directory not found: " + ports_dir.string()};
+std::vector<Status> PortStore::validateAll(const std::filesystem::path& root,
+                                           const Config& config) {
+  std::size_t checked = 0;
+  return validateTree(root, config, /*incremental=*/false, &checked);
+}
+
+std::vector<Status> PortStore::validateChanged(const std::filesystem::path& root,
+                                               const Config& config,
+                                               std::size_t* checked) {
+  std::size_t count = 0;
+  auto errors = validateTree(root, config, /*incremental=*/true, &count);
+  if (checked != nullptr) {
+    *checked = count;
   }
+  return errors;
+}
 
-  for (const auto& port_dir : std::filesystem::directory_iterator(ports_dir)) {
-    if (!port_dir.is_directory()) {
-      continue;
-    }
-    const std::string port_name = port_dir.path().filename().string();
-    if (!std::filesystem::exists(port_dir.path() / "versions.toml")) {
-      continue;
+std::vector<Status> PortStore::validateGraph(const std::filesystem::path& root,
+                                             const Config& config) {
+  auto listed = listPorts(root / config.layout.ports_dir);
+  if (!listed.ok()) {
+    return {listed.status()};
+  }
+  // Ports that fail to load are reported by validateAll; the graph check
+  // covers the rest.
+  std::vector<const PortRecipe*> recipes;
+  recipes.reserve(listed.value().size());
+  for (const auto& name : listed.value()) {
+    auto recipe = RecipeCache::global().current(root, config, name);
+    if (recipe.ok()) {
+      recipes.push_back(recipe.value());
     }
-    auto versions = loadVersions(root, config, port_name);
-    if (!versions.ok()) {
-      return versions.status();
+  }
+
+  std::vector<Status> errors;
+  for (const auto& cycle : Resolver::findCycles(recipes)) {
+    std::string ports;
+    for (const auto& name : cycle.ports) {
+      ports += (ports.empty() ? "" : ", ") + name;
     }
-    auto recipe = loadRecipeAtVersion(root, config, port_name, versions.value().current);
-    if (!recipe.ok()) {
-      return recipe.status();
+    std::string path;
+    for (const auto& name : cycle.path) {
+      path += (path.empty() ? "" : " -> ") + name;
     }
+    errors.push_back(Status{
+        StatusCode::kConflict,
+        "Dependency cycle among " + std::to_string(cycle.ports.size()) +
+            " port(s) [" + ports + "]: " + path});
   }
-  return Status::Ok();
+  return errors;
 }
 
 }  // namespace pkg
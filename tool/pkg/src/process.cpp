@@ -0,0 +1,299 @@
+#include "pkg/process.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace pkg {
+namespace {
+
+std::int64_t toMillis(const timeval& tv) {
+  return static_cast<std::int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+std::vector<std::string> buildEnvironment(const ProcessSpec& spec) {
+  std::vector<std::string> out;
+  std::unordered_set<std::string> overridden;
+  for (const auto& kv : spec.env) {
+    overridden.insert(kv.substr(0, kv.find('=')));
+  }
+  if (spec.inherit_env) {
+    for (char** e = environ; e != nullptr && *e != nullptr; ++e) {
+      std::string_view kv(*e);
+      if (!overridden.count(std::string(kv.substr(0, kv.find('='))))) {
+        out.emplace_back(kv);
+      }
+    }
+  }
+  out.insert(out.end(), spec.env.begin(), spec.env.end());
+  return out;
+}
+
+std::vector<char*> toCArray(std::vector<std::string>& values) {
+  std::vector<char*> out;
+  out.reserve(values.size() + 1);
+  for (auto& v : values) {
+    out.push_back(v.data());
+  }
+  out.push_back(nullptr);
+  return out;
+}
+
+class FdGuard {
+ public:
+  explicit FdGuard(int fd = -1) : fd_(fd) {}
+  ~FdGuard() { reset(); }
+  FdGuard(const FdGuard&) = delete;
+  FdGuard& operator=(const FdGuard&) = delete;
+
+  int get() const noexcept { return fd_; }
+  void reset(int fd = -1) {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    fd_ = fd;
+  }
+
+ private:
+  int fd_;
+};
+
+std::string commandName(const ProcessSpec& spec) {
+  return spec.argv.empty() ? std::string("<empty>") : spec.argv.front();
+}
+
+}  // namespace
+
+std::string ProcessResult::describe() const {
+  if (term_signal != 0) {
+    return "killed by signal " + std::to_string(term_signal);
+  }
+  return "exit status " + std::to_string(exit_code);
+}
+
+Result<ProcessResult> Process::run(const ProcessSpec& spec) {
+  if (spec.argv.empty()) {
+    return Status{StatusCode::kInvalidArgument, "Empty argv for process"};
+  }
+
+  FdGuard log_fd;
+  if (spec.stdout_mode == Redirect::kFile || spec.stderr_mode == Redirect::kFile) {
+    log_fd.reset(::open(spec.log_path.c_str(),
+                        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644));
+    if (log_fd.get() < 0) {
+      return Status{StatusCode::kIoError,
+                    "Failed to open log " + spec.log_path.string() + ": " +
+                        std::strerror(errno)};
+    }
+  }
+
+  FdGuard pipe_read;
+  FdGuard pipe_write;
+  if (spec.stdout_mode == Redirect::kPipe) {
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) != 0) {
+      return Status{StatusCode::kIoError,
+                    "Failed to create pipe: " + std::string(std::strerror(errno))};
+    }
+    pipe_read.reset(fds[0]);
+    pipe_write.reset(fds[1]);
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  auto redirect = [&](Redirect mode, int target) {
+    switch (mode) {
+      case Redirect::kInherit:
+        break;
+      case Redirect::kNull:
+        posix_spawn_file_actions_addopen(&actions, target, "/dev/null",
+                                         O_RDWR, 0);
+        break;
+      case Redirect::kFile:
+        posix_spawn_file_actions_adddup2(&actions, log_fd.get(), target);
+        break;
+      case Redirect::kPipe:
+        posix_spawn_file_actions_adddup2(&actions, pipe_write.get(), target);
+        break;
+      case Redirect::kStdout:
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, target);
+        break;
+    }
+  };
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  redirect(spec.stdout_mode == Redirect::kStdout ? Redirect::kInherit
+                                                 : spec.stdout_mode,
+           STDOUT_FILENO);
+  redirect(spec.stderr_mode == Redirect::kPipe ? Redirect::kInherit
+                                               : spec.stderr_mode,
+           STDERR_FILENO);
+  if (!spec.cwd.empty()) {
+    posix_spawn_file_actions_addchdir_np(&actions, spec.cwd.c_str());
+  }
+
+  std::vector<std::string> argv_storage = spec.argv;
+  std::vector<std::string> env_storage = buildEnvironment(spec);
+  auto argv = toCArray(argv_storage);
+  auto envp = toCArray(env_storage);
+
+  const auto started = std::chrono::steady_clock::now();
+  pid_t pid = -1;
+  const bool search_path = spec.argv.front().find('/') == std::string::npos;
+  const int spawn_rc =
+      search_path
+          ? ::posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), envp.data())
+          : ::posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), envp.data());
+  posix_spawn_file_actions_destroy(&actions);
+  pipe_write.reset();
+  if (spawn_rc != 0) {
+    return Status{StatusCode::kIoError,
+                  "Failed to spawn " + commandName(spec) + ": " +
+                      std::strerror(spawn_rc)};
+  }
+
+  Status read_status = Status::Ok();
+  if (pipe_read.get() >= 0) {
+    char buf[64 * 1024];
+    for (;;) {
+      const ssize_t n = ::read(pipe_read.get(), buf, sizeof(buf));
+      if (n == 0) {
+        break;
+      }
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        read_status = Status{StatusCode::kIoError,
+                             "Failed reading output of " + commandName(spec)};
+        break;
+      }
+      if (read_status.ok() && spec.on_stdout) {
+        read_status = spec.on_stdout(std::string_view(buf, static_cast<size_t>(n)));
+        if (!read_status.ok()) {
+          break;
+        }
+      }
+    }
+    pipe_read.reset();
+  }
+
+  int wstatus = 0;
+  rusage usage{};
+  for (;;) {
+    const pid_t waited = ::wait4(pid, &wstatus, 0, &usage);
+    if (waited == pid) {
+      break;
+    }
+    if (waited < 0 && errno != EINTR) {
+      return Status{StatusCode::kInternalError,
+                    "wait4 failed for " + commandName(spec) + ": " +
+                        std::strerror(errno)};
+    }
+  }
+  if (!read_status.ok()) {
+    return read_status;
+  }
+
+  ProcessResult result;
+  result.wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+  if (WIFEXITED(wstatus)) {
+    result.exit_code = WEXITSTATUS(wstatus);
+  } else if (WIFSIGNALED(wstatus)) {
+    result.term_signal = WTERMSIG(wstatus);
+  }
+  result.user_ms = toMillis(usage.ru_utime);
+  result.sys_ms = toMillis(usage.ru_stime);
+  result.max_rss_kb = usage.ru_maxrss;
+  result.read_blocks = usage.ru_inblock;
+  result.write_blocks = usage.ru_oublock;
+  return result;
+}
+
+Result<ProcessResult> Process::capture(const ProcessSpec& spec,
+                                       std::string& output) {
+  ProcessSpec piped = spec;
+  piped.stdout_mode = Redirect::kPipe;
+  piped.on_stdout = [&output](std::string_view chunk) {
+    output.append(chunk);
+    return Status::Ok();
+  };
+  return run(piped);
+}
+
+Status Process::runToLog(ProcessSpec spec,
+                         const std::filesystem::path& log_path,
+                         ProcessResult* out) {
+  spec.stdout_mode = Redirect::kFile;
+  spec.stderr_mode = Redirect::kStdout;
+  spec.log_path = log_path;
+  auto result = run(spec);
+  if (!result.ok()) {
+    return result.status();
+  }
+  if (out != nullptr) {
+    *out = result.value();
+  }
+  if (!result.value().ok()) {
+    return Status{StatusCode::kInternalError,
+                  "Command failed: " + commandLine(spec.argv) + " (" +
+                      result.value().describe() + ", see " +
+                      log_path.string() + ")"};
+  }
+  return Status::Ok();
+}
+
+Status Process::runToLog(std::vector<std::string> argv,
+                         const std::filesystem::path& log_path) {
+  ProcessSpec spec;
+  spec.argv = std::move(argv);
+  return runToLog(std::move(spec), log_path);
+}
+
+std::string Process::commandLine(const std::vector<std::string>& argv) {
+  std::string out;
+  for (const auto& arg : argv) {
+    if (!out.empty()) {
+      out.push_back(' ');
+    }
+    out += arg;
+  }
+  return out;
+}
+
+std::optional<std::filesystem::path> Process::findExecutable(
+    std::string_view name) {
+  const char* path_env = std::getenv("PATH");
+  std::string_view path = path_env != nullptr ? path_env : "/usr/bin:/bin";
+  while (!path.empty()) {
+    const auto colon = path.find(':');
+    const std::string_view dir = path.substr(0, colon);
+    path = colon == std::string_view::npos ? std::string_view{}
+                                           : path.substr(colon + 1);
+    if (dir.empty()) {
+      continue;
+    }
+    const auto candidate = std::filesystem::path(dir) / name;
+    if (::access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace pkg
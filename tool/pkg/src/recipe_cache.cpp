@@ -0,0 +1,121 @@
+#include "pkg/recipe_cache.hpp"
+
+#include <utility>
+
+namespace pkg {
+namespace {
+
+std::filesystem::path portDir(const std::filesystem::path& root,
+                              const Config& config,
+                              std::string_view port_name) {
+  return root / config.layout.ports_dir / std::string(port_name);
+}
+
+}  // namespace
+
+RecipeCache& RecipeCache::global() {
+  static RecipeCache cache;
+  return cache;
+}
+
+template <typename T, typename Load>
+Result<const T*> RecipeCache::lookup(
+    std::unordered_map<std::string, std::unique_ptr<const T>>& map,
+    const std::string& key,
+    Load load) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    const auto it = map.find(key);
+    if (it != map.end()) {
+      return it->second.get();
+    }
+  }
+  // Parse outside the lock so distinct recipes load in parallel. Two
+  // threads racing on the same key both parse; the first insert wins.
+  auto loaded = load();
+  if (!loaded.ok()) {
+    return loaded.status();
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  auto [it, inserted] = map.try_emplace(key);
+  if (inserted) {
+    it->second = std::make_unique<const T>(std::move(loaded).value());
+  }
+  return it->second.get();
+}
+
+Result<const VersionPointers*> RecipeCache::versions(
+    const std::filesystem::path& root,
+    const Config& config,
+    std::string_view port_name) {
+  const std::string key =
+      RecipeIndex::versionsKey(portDir(root, config, port_name));
+  return lookup(versions_, key, [&]() -> Result<VersionPointers> {
+    if (index_) {
+      if (auto hit = index_->findVersions(key)) {
+        return std::move(*hit);
+      }
+    }
+    auto loaded = PortStore::loadVersions(root, config, port_name);
+    if (loaded.ok() && index_) {
+      std::lock_guard<std::mutex> lock(mu_);
+      index_->putVersions(
+          key, loaded.value(),
+          portDir(root, config, port_name) / "versions.toml");
+    }
+    return loaded;
+  });
+}
+
+Result<const PortRecipe*> RecipeCache::current(
+    const std::filesystem::path& root,
+    const Config& config,
+    std::string_view port_name) {
+  auto versions = this->versions(root, config, port_name);
+  if (!versions.ok()) {
+    return versions.status();
+  }
+  return atVersion(root, config, port_name, versions.value()->current);
+}
+
+Result<const PortRecipe*> RecipeCache::atVersion(
+    const std::filesystem::path& root,
+    const Config& config,
+    std::string_view port_name,
+    std::string_view version) {
+  const std::string key =
+      RecipeIndex::recipeKey(portDir(root, config, port_name), version);
+  return lookup(recipes_, key, [&]() -> Result<PortRecipe> {
+    if (index_) {
+      if (auto hit = index_->findRecipe(key)) {
+        return std::move(*hit);
+      }
+    }
+    auto loaded =
+        PortStore::loadRecipeAtVersion(root, config, port_name, version);
+    if (loaded.ok() && index_) {
+      std::lock_guard<std::mutex> lock(mu_);
+      index_->putRecipe(key, loaded.value());
+    }
+    return loaded;
+  });
+}
+
+void RecipeCache::useIndex(const std::filesystem::path& path) {
+  auto index = RecipeIndex::open(path);
+  std::lock_guard<std::mutex> lock(mu_);
+  index_ = std::move(index);
+}
+
+Status RecipeCache::saveIndex() {
+  std::lock_guard<std::mutex> lock(mu_);
+  return index_ ? index_->save() : Status::Ok();
+}
+
+void RecipeCache::clear() {
+  std::lock_guard<std::mutex> lock(mu_);
+  versions_.clear();
+  recipes_.clear();
+}
+
+}  // namespace pkg
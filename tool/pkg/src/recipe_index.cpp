@@ -0,0 +1,398 @@
+#include "pkg/recipe_index.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+namespace pkg {
+namespace {
+
+constexpr char kMagic[8] = {'N', 'P', 'K', 'G', 'I', 'D', 'X', '\0'};
+// Bump whenever the record layout or the PortRecipe fields change.
+constexpr std::uint32_t kFormatVersion = 1;
+constexpr std::size_t kHeaderSize = sizeof(kMagic) + 4 + 4;
+
+constexpr char kVersionsRecord = 'V';
+constexpr char kRecipeRecord = 'R';
+
+// Host byte order: the index never leaves the machine that wrote it.
+class Writer {
+ public:
+  template <typename T>
+  void num(T value) {
+    char buf[sizeof(T)];
+    std::memcpy(buf, &value, sizeof(T));
+    out_.append(buf, sizeof(T));
+  }
+  void str(std::string_view s) {
+    num(static_cast<std::uint32_t>(s.size()));
+    out_.append(s);
+  }
+  void strs(const std::vector<std::string>& v) {
+    num(static_cast<std::uint32_t>(v.size()));
+    for (const auto& s : v) {
+      str(s);
+    }
+  }
+  std::string take() { return std::move(out_); }
+
+ private:
+  std::string out_;
+};
+
+// Bounds-checked decoder; any overrun clears ok() and yields zero values.
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T num() {
+    T value{};
+    if (data_.size() < sizeof(T)) {
+      ok_ = false;
+      return value;
+    }
+    std::memcpy(&value, data_.data(), sizeof(T));
+    data_.remove_prefix(sizeof(T));
+    return value;
+  }
+  std::string_view view() {
+    const auto len = num<std::uint32_t>();
+    if (!ok_ || data_.size() < len) {
+      ok_ = false;
+      return {};
+    }
+    const auto out = data_.substr(0, len);
+    data_.remove_prefix(len);
+    return out;
+  }
+  std::string str() { return std::string(view()); }
+  std::vector<std::string> strs() {
+    std::vector<std::string> out;
+    const auto n = num<std::uint32_t>();
+    for (std::uint32_t i = 0; ok_ && i < n; ++i) {
+      out.push_back(str());
+    }
+    return out;
+  }
+  bool ok() const noexcept { return ok_; }
+  std::string_view rest() const noexcept { return data_; }
+
+ private:
+  std::string_view data_;
+  bool ok_ = true;
+};
+
+void writeStamp(Writer& w, const FileStamp& stamp) {
+  w.str(stamp.path);
+  w.num(stamp.mtime_ns);
+  w.num(stamp.size);
+  w.num(stamp.inode);
+}
+
+FileStamp readStamp(Reader& r) {
+  FileStamp stamp;
+  stamp.path = r.str();
+  stamp.mtime_ns = r.num<std::int64_t>();
+  stamp.size = r.num<std::uint64_t>();
+  stamp.inode = r.num<std::uint64_t>();
+  return stamp;
+}
+
+std::string encode(char kind,
+                   const std::string& key,
+                   const std::vector<FileStamp>& stamps,
+                   const std::string& payload) {
+  Writer w;
+  w.num(kind);
+  w.str(key);
+  w.num(static_cast<std::uint32_t>(stamps.size()));
+  for (const auto& stamp : stamps) {
+    writeStamp(w, stamp);
+  }
+  return w.take() + payload;
+}
+
+}  // namespace
+
+std::optional<FileStamp> FileStamp::of(const std::filesystem::path& path) {
+  struct stat st {};
+  if (::stat(path.c_str(), &st) != 0) {
+    return std::nullopt;
+  }
+  FileStamp stamp;
+  stamp.path = path.string();
+  stamp.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                   st.st_mtim.tv_nsec;
+  stamp.size = static_cast<std::uint64_t>(st.st_size);
+  stamp.inode = static_cast<std::uint64_t>(st.st_ino);
+  return stamp;
+}
+
+bool FileStamp::current() const {
+  const auto now = of(path);
+  return now && now->mtime_ns == mtime_ns && now->size == size &&
+         now->inode == inode;
+}
+
+RecipeIndex::RecipeIndex(std::filesystem::path path) : path_(std::move(path)) {}
+
+RecipeIndex::~RecipeIndex() {
+  if (map_ != nullptr) {
+    ::munmap(map_, map_size_);
+  }
+}
+
+std::unique_ptr<RecipeIndex> RecipeIndex::open(std::filesystem::path path) {
+  std::unique_ptr<RecipeIndex> index(new RecipeIndex(std::move(path)));
+  const int fd = ::open(index->path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return index;
+  }
+  struct stat st {};
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) < kHeaderSize) {
+    ::close(fd);
+    return index;
+  }
+  void* map = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return index;
+  }
+  index->map_ = map;
+  index->map_size_ = static_cast<std::size_t>(st.st_size);
+
+  const std::string_view data(static_cast<const char*>(map), index->map_size_);
+  if (data.substr(0, sizeof(kMagic)) != std::string_view(kMagic, sizeof(kMagic))) {
+    return index;
+  }
+  Reader header(data.substr(sizeof(kMagic)));
+  const auto version = header.num<std::uint32_t>();
+  const auto count = header.num<std::uint32_t>();
+  if (version != kFormatVersion) {
+    return index;
+  }
+  Reader body(data.substr(kHeaderSize));
+  std::unordered_map<std::string_view, std::string_view> records;
+  records.reserve(count);
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const auto record = body.view();
+    Reader r(record);
+    r.num<char>();
+    const auto key = r.view();
+    if (!body.ok() || !r.ok()) {
+      // Truncated or corrupt: start over rather than trust part of it.
+      return index;
+    }
+    records.emplace(key, record);
+  }
+  index->records_ = std::move(records);
+  return index;
+}
+
+std::optional<std::string_view> RecipeIndex::findCurrent(const std::string& key,
+                                                         char kind) const {
+  const auto it = records_.find(key);
+  if (it == records_.end()) {
+    return std::nullopt;
+  }
+  Reader r(it->second);
+  if (r.num<char>() != kind) {
+    return std::nullopt;
+  }
+  r.view();
+  const auto stamps = r.num<std::uint32_t>();
+  for (std::uint32_t i = 0; i < stamps; ++i) {
+    if (!readStamp(r).current() || !r.ok()) {
+      return std::nullopt;
+    }
+  }
+  if (!r.ok()) {
+    return std::nullopt;
+  }
+  return r.rest();
+}
+
+std::optional<VersionPointers> RecipeIndex::findVersions(
+    const std::string& key) const {
+  const auto payload = findCurrent(key, kVersionsRecord);
+  if (!payload) {
+    return std::nullopt;
+  }
+  Reader r(*payload);
+  VersionPointers versions;
+  versions.last = r.str();
+  versions.current = r.str();
+  versions.next = r.str();
+  if (!r.ok()) {
+    return std::nullopt;
+  }
+  return versions;
+}
+
+std::optional<PortRecipe> RecipeIndex::findRecipe(const std::string& key) const {
+  const auto payload = findCurrent(key, kRecipeRecord);
+  if (!payload) {
+    return std::nullopt;
+  }
+  Reader r(*payload);
+  PortRecipe recipe;
+  recipe.name = r.str();
+  recipe.version = r.str();
+  recipe.summary = r.str();
+  recipe.license = r.str();
+  recipe.deps = r.strs();
+  recipe.src.type = r.str();
+  recipe.src.url = r.str();
+  recipe.src.sha256 = r.str();
+  recipe.src.rev = r.str();
+  recipe.build.system = r.str();
+  recipe.scripts.patch = r.str();
+  recipe.scripts.build = r.str();
+  recipe.scripts.install = r.str();
+  recipe.scripts.check = r.str();
+  recipe.recipe_path = r.str();
+  recipe.manifest_sha256 = r.str();
+  if (!r.ok()) {
+    return std::nullopt;
+  }
+  return recipe;
+}
+
+std::string RecipeIndex::versionsKey(const std::filesystem::path& port_dir) {
+  return port_dir.string();
+}
+
+std::string RecipeIndex::recipeKey(const std::filesystem::path& port_dir,
+                                   std::string_view version) {
+  return port_dir.string() + "/" + std::string(version);
+}
+
+std::vector<std::string> RecipeIndex::portKeys() const {
+  std::vector<std::string> keys;
+  for (const auto& [key, record] : records_) {
+    if (!record.empty() && record.front() == kVersionsRecord) {
+      keys.emplace_back(key);
+    }
+  }
+  return keys;
+}
+
+void RecipeIndex::putVersions(const std::string& key,
+                              const VersionPointers& versions,
+                              const std::filesystem::path& file) {
+  auto stamp = FileStamp::of(file);
+  if (!stamp) {
+    return;
+  }
+  Writer w;
+  w.str(versions.last);
+  w.str(versions.current);
+  w.str(versions.next);
+  fresh_[key] = encode(kVersionsRecord, key, {*stamp}, w.take());
+}
+
+void RecipeIndex::putRecipe(const std::string& key, const PortRecipe& recipe) {
+  std::vector<FileStamp> stamps;
+  const auto dir = recipe.recipe_path.parent_path();
+  for (const auto& file :
+       {recipe.recipe_path.string(), recipe.scripts.patch, recipe.scripts.build,
+        recipe.scripts.install, recipe.scripts.check}) {
+    if (file.empty()) {
+      continue;
+    }
+    auto stamp = FileStamp::of(stamps.empty() ? std::filesystem::path(file)
+                                              : dir / file);
+    if (!stamp) {
+      return;
+    }
+    stamps.push_back(std::move(*stamp));
+  }
+
+  Writer w;
+  w.str(recipe.name);
+  w.str(recipe.version);
+  w.str(recipe.summary);
+  w.str(recipe.license);
+  w.strs(recipe.deps);
+  w.str(recipe.src.type);
+  w.str(recipe.src.url);
+  w.str(recipe.src.sha256);
+  w.str(recipe.src.rev);
+  w.str(recipe.build.system);
+  w.str(recipe.scripts.patch);
+  w.str(recipe.scripts.build);
+  w.str(recipe.scripts.install);
+  w.str(recipe.scripts.check);
+  w.str(recipe.recipe_path.string());
+  w.str(recipe.manifest_sha256);
+  fresh_[key] = encode(kRecipeRecord, key, stamps, w.take());
+}
+
+Status RecipeIndex::save() const {
+  if (fresh_.empty()) {
+    return Status::Ok();
+  }
+  std::vector<std::string_view> records;
+  records.reserve(fresh_.size() + records_.size());
+  for (const auto& [key, record] : fresh_) {
+    records.push_back(record);
+  }
+  for (const auto& [key, record] : records_) {
+    if (fresh_.count(std::string(key)) != 0) {
+      continue;
+    }
+    // Drop ports that were deleted from the tree.
+    Reader r(record);
+    r.num<char>();
+    r.view();
+    if (r.num<std::uint32_t>() > 0) {
+      const auto stamp = readStamp(r);
+      std::error_code ec;
+      if (!r.ok() || !std::filesystem::exists(stamp.path, ec)) {
+        continue;
+      }
+    }
+    records.push_back(record);
+  }
+
+  Writer w;
+  w.num(kFormatVersion);
+  w.num(static_cast<std::uint32_t>(records.size()));
+  for (const auto record : records) {
+    w.str(record);
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(path_.parent_path(), ec);
+  const auto tmp = std::filesystem::path(path_.string() + "." +
+                                         std::to_string(::getpid()) + ".tmp");
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(kMagic, sizeof(kMagic));
+    const std::string body = w.take();
+    out.write(body.data(), static_cast<std::streamsize>(body.size()));
+    if (!out) {
+      std::filesystem::remove(tmp, ec);
+      return Status{StatusCode::kIoError,
+                    "Failed to write recipe index: " + tmp.string()};
+    }
+  }
+  // Readers keep their own mapping of the old file across the rename.
+  std::filesystem::rename(tmp, path_, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return Status{StatusCode::kIoError,
+                  "Failed to replace recipe index: " + path_.string()};
+  }
+  return Status::Ok();
+}
+
+}  // namespace pkg
@@ -1,77 +1,302 @@
 #include "pkg/resolver.hpp"
 
-#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
 
 #include "pkg/port.hpp"
+#include "pkg/recipe_cache.hpp"
 
 namespace pkg {
 namespace {
 
-Status dfsResolve(const std::filesystem::path& root,
-                  const Config& config,
-                  std::string_view port_name,
-                  std::unordered_map<std::string, int>& visit_state,
-                  std::unordered_map<std::string, std::string>& selected_versions,
-                  ResolveResult& out) {
-  const std::string key(port_name);
-  const int state = visit_state[key];
-  if (state == 1) {
-    return Status{StatusCode::kConflict,
-                  "Dependency cycle detected at port: " + key};
+enum class VisitState : std::uint8_t { kNew, kOnPath, kDone };
+
+// Depth-first post-order walk over interned port IDs. Names are hashed
+// once, when first seen; after that the walk touches only flat arrays:
+// each port's deps become a contiguous run of IDs in `edges_` when it is
+// entered, and `stack_` replaces recursion so deep chains cannot overflow
+// the thread's stack. Visit order, and therefore `order` and which error
+// is reported first, matches a recursive walk of the same graph.
+class Walk {
+ public:
+  Walk(const std::filesystem::path& root, const Config& config, ResolveResult& out)
+      : root_(root), config_(config), out_(out) {}
+
+  Status visit(std::string_view port_name) {
+    const int start = intern(port_name);
+    if (state_[start] == VisitState::kDone) {
+      return Status::Ok();
+    }
+    auto status = enter(start);
+    while (status.ok() && !stack_.empty()) {
+      Frame& top = stack_.back();
+      if (top.next == edge_end_[top.node]) {
+        finish(top.node);
+        stack_.pop_back();
+        continue;
+      }
+      const int dep = edges_[top.next++];
+      if (state_[dep] == VisitState::kOnPath) {
+        return cycleError(dep);
+      }
+      if (state_[dep] == VisitState::kNew) {
+        status = enter(dep);
+      }
+    }
+    return status;
   }
-  if (state == 2) {
-    return Status::Ok();
+
+ private:
+  struct Frame {
+    int node;
+    std::size_t next;
+  };
+
+  int intern(std::string_view name) {
+    const auto [it, inserted] =
+        ids_.try_emplace(name, static_cast<int>(names_.size()));
+    if (inserted) {
+      names_.push_back(name);
+      state_.push_back(VisitState::kNew);
+      recipes_.push_back(nullptr);
+      edge_begin_.push_back(0);
+      edge_end_.push_back(0);
+      path_pos_.push_back(0);
+    }
+    return it->second;
   }
 
-  auto recipe_result = PortStore::loadCurrentRecipe(root, config, key);
-  if (!recipe_result.ok()) {
-    return recipe_result.status();
+  Status enter(int node) {
+    auto recipe_result =
+        RecipeCache::global().current(root_, config_, names_[node]);
+    if (!recipe_result.ok()) {
+      return recipe_result.status();
+    }
+    const PortRecipe& recipe = *recipe_result.value();
+    const auto [it, inserted] = selected_versions_.try_emplace(
+        std::string_view(recipe.name), std::string_view(recipe.version));
+    if (!inserted && it->second != recipe.version) {
+      return Status{StatusCode::kConflict,
+                    "Version conflict for port '" + recipe.name + "': '" +
+                        std::string(it->second) + "' vs '" + recipe.version + "'"};
+    }
+    recipes_[node] = &recipe;
+    state_[node] = VisitState::kOnPath;
+
+    edge_begin_[node] = edges_.size();
+    for (const std::string& dep : recipe.deps) {
+      edges_.push_back(intern(dep));
+    }
+    edge_end_[node] = edges_.size();
+    path_pos_[node] = stack_.size();
+    stack_.push_back(Frame{node, edge_begin_[node]});
+    return Status::Ok();
   }
 
-  const PortRecipe& recipe = recipe_result.value();
-  auto it = selected_versions.find(recipe.name);
-  if (it != selected_versions.end() && it->second != recipe.version) {
+  // `dep` is on the current path, so the frames from its own up to the
+  // top of the stack are the cycle.
+  Status cycleError(int dep) const {
+    std::string path;
+    for (std::size_t i = path_pos_[dep]; i < stack_.size(); ++i) {
+      path += std::string(names_[stack_[i].node]) + " -> ";
+    }
+    path += names_[dep];
     return Status{StatusCode::kConflict,
-                  "Version conflict for port '" + recipe.name + "': '" +
-                      it->second + "' vs '" + recipe.version + "'"};
+                  "Dependency cycle detected at port: " + std::string(names_[dep]) +
+                      " (" + path + ")"};
   }
-  selected_versions[recipe.name] = recipe.version;
 
-  visit_state[key] = 1;
-
-  for (const std::string& dep : recipe.deps) {
-    auto dep_status = dfsResolve(root, config, dep, visit_state, selected_versions, out);
-    if (!dep_status.ok()) {
-      return dep_status;
+  void finish(int node) {
+    state_[node] = VisitState::kDone;
+    const PortRecipe& recipe = *recipes_[node];
+    if (out_.nodes.emplace(recipe.name, ResolvedNode{recipe}).second) {
+      out_.order.push_back(recipe.name);
     }
   }
 
-  visit_state[key] = 2;
+  const std::filesystem::path& root_;
+  const Config& config_;
+  ResolveResult& out_;
 
-  if (out.nodes.find(recipe.name) == out.nodes.end()) {
-    out.order.push_back(recipe.name);
-    out.nodes.emplace(recipe.name, ResolvedNode{recipe});
-  }
+  // Keys view the group's port list and the cached recipes' deps, both of
+  // which outlive the walk.
+  std::unordered_map<std::string_view, int> ids_;
+  std::vector<std::string_view> names_;
+  std::vector<VisitState> state_;
+  std::vector<const PortRecipe*> recipes_;
+  std::vector<std::size_t> edge_begin_;
+  std::vector<std::size_t> edge_end_;
+  std::vector<int> edges_;
+  std::vector<Frame> stack_;
+  // Index in `stack_` of each port while it is on the path.
+  std::vector<std::size_t> path_pos_;
+  std::unordered_map<std::string_view, std::string_view> selected_versions_;
+};
 
-  return Status::Ok();
+// Shortest cycle from `start` back to itself using only edges inside
+// its component, by breadth-first search. `parent` is all -1 on entry
+// and is restored before returning, so it can be shared across calls.
+std::vector<int> shortestCycle(int start,
+                               const std::vector<std::size_t>& edge_begin,
+                               const std::vector<int>& edges,
+                               const std::vector<int>& component,
+                               std::vector<int>& parent) {
+  const int id = component[start];
+  std::vector<int> queue{start};
+  std::vector<int> cycle;
+  for (std::size_t head = 0; head < queue.size() && cycle.empty(); ++head) {
+    const int v = queue[head];
+    for (std::size_t e = edge_begin[v]; e < edge_begin[v + 1]; ++e) {
+      const int w = edges[e];
+      if (component[w] != id) {
+        continue;
+      }
+      if (w == start) {
+        cycle.push_back(start);
+        for (int u = v; u != start; u = parent[u]) {
+          cycle.push_back(u);
+        }
+        std::reverse(cycle.begin() + 1, cycle.end());
+        cycle.push_back(start);
+        break;
+      }
+      if (parent[w] < 0) {
+        parent[w] = v;
+        queue.push_back(w);
+      }
+    }
+  }
+  for (int v : queue) {
+    parent[v] = -1;
+  }
+  return cycle;
 }
 
 }  // namespace
 
+std::vector<DependencyCycle> Resolver::findCycles(
+    const std::vector<const PortRecipe*>& recipes) {
+  const int n = static_cast<int>(recipes.size());
+  std::unordered_map<std::string_view, int> ids;
+  ids.reserve(recipes.size());
+  for (int i = 0; i < n; ++i) {
+    ids.emplace(recipes[i]->name, i);
+  }
+  std::vector<std::size_t> edge_begin(recipes.size() + 1, 0);
+  std::vector<int> edges;
+  for (int i = 0; i < n; ++i) {
+    for (const auto& dep : recipes[i]->deps) {
+      const auto it = ids.find(dep);
+      if (it != ids.end()) {
+        edges.push_back(it->second);
+      }
+    }
+    edge_begin[i + 1] = edges.size();
+  }
+
+  // Iterative Tarjan: `index` is the DFS discovery number (0 = unvisited),
+  // `low` the smallest index reachable through the subtree, and `members`
+  // the stack of visited ports not yet assigned to a component.
+  std::vector<int> index(recipes.size(), 0);
+  std::vector<int> low(recipes.size(), 0);
+  std::vector<char> on_members(recipes.size(), 0);
+  std::vector<int> component(recipes.size(), -1);
+  std::vector<int> members;
+  struct Frame {
+    int node;
+    std::size_t next;
+  };
+  std::vector<Frame> stack;
+  std::vector<std::vector<int>> components;
+  int counter = 0;
+
+  for (int root = 0; root < n; ++root) {
+    if (index[root] != 0) {
+      continue;
+    }
+    index[root] = low[root] = ++counter;
+    members.push_back(root);
+    on_members[root] = 1;
+    stack.push_back(Frame{root, edge_begin[root]});
+    while (!stack.empty()) {
+      Frame& top = stack.back();
+      const int v = top.node;
+      if (top.next < edge_begin[v + 1]) {
+        const int w = edges[top.next++];
+        if (index[w] == 0) {
+          index[w] = low[w] = ++counter;
+          members.push_back(w);
+          on_members[w] = 1;
+          stack.push_back(Frame{w, edge_begin[w]});
+        } else if (on_members[w]) {
+          low[v] = std::min(low[v], index[w]);
+        }
+        continue;
+      }
+      stack.pop_back();
+      if (!stack.empty()) {
+        const int parent = stack.back().node;
+        low[parent] = std::min(low[parent], low[v]);
+      }
+      if (low[v] != index[v]) {
+        continue;
+      }
+      std::vector<int> scc;
+      int w = -1;
+      do {
+        w = members.back();
+        members.pop_back();
+        on_members[w] = 0;
+        component[w] = static_cast<int>(components.size());
+        scc.push_back(w);
+      } while (w != v);
+      components.push_back(std::move(scc));
+    }
+  }
+
+  std::vector<DependencyCycle> cycles;
+  std::vector<int> parent(recipes.size(), -1);
+  for (auto& scc : components) {
+    // A single port is only a cycle if it depends on itself.
+    if (scc.size() == 1 &&
+        std::find(edges.begin() + edge_begin[scc[0]],
+                  edges.begin() + edge_begin[scc[0] + 1],
+                  scc[0]) == edges.begin() + edge_begin[scc[0] + 1]) {
+      continue;
+    }
+    std::sort(scc.begin(), scc.end(), [&](int a, int b) {
+      return recipes[a]->name < recipes[b]->name;
+    });
+    const auto path =
+        shortestCycle(scc.front(), edge_begin, edges, component, parent);
+    DependencyCycle cycle;
+    for (int v : scc) {
+      cycle.ports.push_back(recipes[v]->name);
+    }
+    for (int v : path) {
+      cycle.path.push_back(recipes[v]->name);
+    }
+    cycles.push_back(std::move(cycle));
+  }
+  std::sort(cycles.begin(), cycles.end(),
+            [](const DependencyCycle& a, const DependencyCycle& b) {
+              return a.ports.front() < b.ports.front();
+            });
+  return cycles;
+}
+
 Result<ResolveResult> Resolver::resolveGroup(const std::filesystem::path& root,
                                              const Config& config,
                                              const Group& group) {
   ResolveResult out;
-  std::unordered_map<std::string, int> visit_state;
-  std::unordered_map<std::string, std::string> selected_versions;
-
+  Walk walk(root, config, out);
   for (const std::string& root_port : group.ports) {
-    auto status = dfsResolve(root, config, root_port, visit_state, selected_versions, out);
+    auto status = walk.visit(root_port);
     if (!status.ok()) {
       return status;
     }
   }
-
   return out;
 }
 
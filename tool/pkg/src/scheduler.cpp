@@ -0,0 +1,167 @@
+#include "pkg/scheduler.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace pkg {
+
+std::vector<std::int64_t> BuildScheduler::criticalPath(
+    const std::vector<ScheduleNode>& nodes) {
+  const std::size_t n = nodes.size();
+  std::vector<std::vector<std::size_t>> dependents(n);
+  std::vector<std::size_t> pending(n, 0);
+  for (std::size_t i = 0; i < n; ++i) {
+    for (std::size_t dep : nodes[i].deps) {
+      dependents[dep].push_back(i);
+    }
+  }
+
+  // Reverse topological sweep: a node is final once all dependents are.
+  std::vector<std::size_t> stack;
+  for (std::size_t i = 0; i < n; ++i) {
+    pending[i] = dependents[i].size();
+    if (pending[i] == 0) {
+      stack.push_back(i);
+    }
+  }
+  std::vector<std::int64_t> path(n, 0);
+  while (!stack.empty()) {
+    const std::size_t index = stack.back();
+    stack.pop_back();
+    std::int64_t tail = 0;
+    for (std::size_t next : dependents[index]) {
+      tail = std::max(tail, path[next]);
+    }
+    path[index] = nodes[index].weight + tail;
+    for (std::size_t dep : nodes[index].deps) {
+      if (--pending[dep] == 0) {
+        stack.push_back(dep);
+      }
+    }
+  }
+  return path;
+}
+
+std::vector<NodeState> BuildScheduler::run(const std::vector<ScheduleNode>& nodes,
+                                           int jobs,
+                                           const Task& task,
+                                           const ScheduleOptions& options) {
+  const std::size_t n = nodes.size();
+  std::vector<NodeState> states(n, NodeState::kPending);
+  if (n == 0) {
+    return states;
+  }
+
+  std::vector<std::vector<std::size_t>> dependents(n);
+  std::vector<std::size_t> waiting_on(n, 0);
+  for (std::size_t i = 0; i < n; ++i) {
+    for (std::size_t dep : nodes[i].deps) {
+      dependents[dep].push_back(i);
+      ++waiting_on[i];
+    }
+  }
+
+  // Ready nodes are ranked by critical path; ties fall back to the lowest
+  // index so equal-weight graphs keep the resolver order.
+  const auto path = criticalPath(nodes);
+  auto by_priority = [&path](std::size_t a, std::size_t b) {
+    if (path[a] != path[b]) {
+      return path[a] > path[b];
+    }
+    return a < b;
+  };
+  std::set<std::size_t, decltype(by_priority)> ready(by_priority);
+  for (std::size_t i = 0; i < n; ++i) {
+    if (waiting_on[i] == 0) {
+      ready.insert(i);
+    }
+  }
+
+  std::mutex mu;
+  std::condition_variable cv;
+  std::size_t running = 0;
+  bool stopped = false;
+
+  // Marks every not yet skipped transitive dependent of `failed` as
+  // kSkipped and returns them. None of them can be ready or running, since
+  // each waits on `failed` directly or through another of them.
+  auto skipDependents = [&](std::size_t failed) {
+    std::vector<std::size_t> skipped;
+    std::vector<std::size_t> stack{failed};
+    while (!stack.empty()) {
+      const std::size_t index = stack.back();
+      stack.pop_back();
+      for (std::size_t next : dependents[index]) {
+        if (states[next] == NodeState::kPending) {
+          states[next] = NodeState::kSkipped;
+          skipped.push_back(next);
+          stack.push_back(next);
+        }
+      }
+    }
+    return skipped;
+  };
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(mu);
+    for (;;) {
+      cv.wait(lock, [&] { return stopped || !ready.empty() || running == 0; });
+      if (stopped || ready.empty()) {
+        return;
+      }
+      const std::size_t index = *ready.begin();
+      ready.erase(ready.begin());
+      ++running;
+
+      lock.unlock();
+      const Status status = task(index);
+      lock.lock();
+
+      --running;
+      if (status.ok()) {
+        states[index] = NodeState::kDone;
+        for (std::size_t next : dependents[index]) {
+          if (--waiting_on[next] == 0) {
+            ready.insert(next);
+          }
+        }
+      } else {
+        states[index] = NodeState::kFailed;
+        if (!options.keep_going) {
+          stopped = true;
+        } else if (auto skipped = skipDependents(index);
+                   !skipped.empty() && options.on_skipped) {
+          lock.unlock();
+          for (std::size_t s : skipped) {
+            options.on_skipped(s);
+          }
+          lock.lock();
+        }
+      }
+      cv.notify_all();
+    }
+  };
+
+  const std::size_t workers =
+      std::min<std::size_t>(n, static_cast<std::size_t>(std::max(1, jobs)));
+  std::vector<std::thread> threads;
+  threads.reserve(workers);
+  for (std::size_t i = 0; i < workers; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (auto& state : states) {
+    if (state == NodeState::kPending) {
+      state = NodeState::kSkipped;
+    }
+  }
+  return states;
+}
+
+}  // namespace pkg
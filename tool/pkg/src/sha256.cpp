@@ -0,0 +1,254 @@
+#include "pkg/sha256.hpp"
+
+#include <cstring>
+#include <fstream>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PKG_SHA256_X86 1
+#include <immintrin.h>
+#endif
+
+namespace pkg {
+namespace {
+
+constexpr std::uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+using BlockFn = void (*)(std::uint32_t state[8], const std::uint8_t* data,
+                         std::size_t blocks);
+
+inline std::uint32_t rotr(std::uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+void blocksPortable(std::uint32_t state[8], const std::uint8_t* data,
+                    std::size_t blocks) {
+  std::uint32_t w[64];
+  for (; blocks > 0; --blocks, data += 64) {
+    for (int i = 0; i < 16; ++i) {
+      w[i] = (static_cast<std::uint32_t>(data[i * 4]) << 24) |
+             (static_cast<std::uint32_t>(data[i * 4 + 1]) << 16) |
+             (static_cast<std::uint32_t>(data[i * 4 + 2]) << 8) |
+             static_cast<std::uint32_t>(data[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+      const std::uint32_t s0 =
+          rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const std::uint32_t s1 =
+          rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      const std::uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+      const std::uint32_t ch = (e & f) ^ (~e & g);
+      const std::uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+      const std::uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+      const std::uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      const std::uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#if defined(PKG_SHA256_X86)
+__attribute__((target("sha,sse4.1,ssse3"))) void blocksShaNi(
+    std::uint32_t state[8], const std::uint8_t* data, std::size_t blocks) {
+  const __m128i byte_swap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // The SHA instructions keep the state as ABEF/CDGH.
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+  __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);
+  state1 = _mm_shuffle_epi32(state1, 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (; blocks > 0; --blocks, data += 64) {
+    const __m128i abef_save = state0;
+    const __m128i cdgh_save = state1;
+    __m128i msg[4];
+
+    for (int group = 0; group < 16; ++group) {
+      __m128i& w = msg[group & 3];
+      if (group < 4) {
+        w = _mm_shuffle_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + group * 16)),
+            byte_swap);
+      } else {
+        // w[t..t+3] from w[t-16..t-1]; msg[group & 3] still holds t-16.
+        const __m128i& prev1 = msg[(group - 1) & 3];
+        const __m128i& prev2 = msg[(group - 2) & 3];
+        const __m128i& prev3 = msg[(group - 3) & 3];
+        __m128i next = _mm_sha256msg1_epu32(w, prev3);
+        next = _mm_add_epi32(next, _mm_alignr_epi8(prev1, prev2, 4));
+        w = _mm_sha256msg2_epu32(next, prev1);
+      }
+      __m128i k = _mm_add_epi32(
+          w, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                 &kRoundConstants[group * 4])));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+      k = _mm_shuffle_epi32(k, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, k);
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+#endif
+
+struct Dispatch {
+  BlockFn blocks = blocksPortable;
+  const char* name = "portable";
+
+  Dispatch() {
+#if defined(PKG_SHA256_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1") &&
+        __builtin_cpu_supports("ssse3")) {
+      blocks = blocksShaNi;
+      name = "sha-ni";
+    }
+#endif
+  }
+};
+
+const Dispatch& dispatch() {
+  static const Dispatch d;
+  return d;
+}
+
+}  // namespace
+
+Sha256::Sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::update(const void* data, std::size_t len) {
+  const auto* p = static_cast<const std::uint8_t*>(data);
+  length_ += len;
+  if (buffered_ > 0) {
+    const std::size_t take = std::min(len, sizeof(buffer_) - buffered_);
+    std::memcpy(buffer_ + buffered_, p, take);
+    buffered_ += take;
+    p += take;
+    len -= take;
+    if (buffered_ < sizeof(buffer_)) {
+      return;
+    }
+    dispatch().blocks(state_, buffer_, 1);
+    buffered_ = 0;
+  }
+  const std::size_t whole = len / 64;
+  if (whole > 0) {
+    dispatch().blocks(state_, p, whole);
+    p += whole * 64;
+    len -= whole * 64;
+  }
+  if (len > 0) {
+    std::memcpy(buffer_, p, len);
+    buffered_ = len;
+  }
+}
+
+Sha256::Digest Sha256::finish() {
+  const std::uint64_t bit_length = length_ * 8;
+  std::uint8_t pad[72] = {0x80};
+  const std::size_t pad_len =
+      (buffered_ < 56 ? 56 - buffered_ : 120 - buffered_);
+  for (int i = 0; i < 8; ++i) {
+    pad[pad_len + i] = static_cast<std::uint8_t>(bit_length >> (56 - 8 * i));
+  }
+  update(pad, pad_len + 8);
+
+  Digest digest;
+  for (int i = 0; i < 8; ++i) {
+    digest[i * 4] = static_cast<std::uint8_t>(state_[i] >> 24);
+    digest[i * 4 + 1] = static_cast<std::uint8_t>(state_[i] >> 16);
+    digest[i * 4 + 2] = static_cast<std::uint8_t>(state_[i] >> 8);
+    digest[i * 4 + 3] = static_cast<std::uint8_t>(state_[i]);
+  }
+  return digest;
+}
+
+std::string Sha256::finishHex() { return toHex(finish()); }
+
+std::string Sha256::toHex(const Digest& digest) {
+  std::string out(digest.size() * 2, '\0');
+  toHex(digest, out.data());
+  return out;
+}
+
+void Sha256::toHex(const Digest& digest, char* out) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  for (std::uint8_t b : digest) {
+    *out++ = kHex[b >> 4];
+    *out++ = kHex[b & 0x0f];
+  }
+}
+
+std::string Sha256::hashHex(std::string_view data) {
+  Sha256 h;
+  h.update(data);
+  return h.finishHex();
+}
+
+Result<std::string> Sha256::hashFileHex(const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return Status{StatusCode::kIoError,
+                  "Failed to open file for hashing: " + path.string()};
+  }
+  Sha256 h;
+  std::string buf(1 << 20, '\0');
+  while (in) {
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    h.update(buf.data(), static_cast<std::size_t>(in.gcount()));
+  }
+  if (in.bad()) {
+    return Status{StatusCode::kIoError,
+                  "Failed while reading file for hashing: " + path.string()};
+  }
+  return h.finishHex();
+}
+
+const char* Sha256::implementation() { return dispatch().name; }
+
+}  // namespace pkg
@@ -0,0 +1,304 @@
+#include "pkg/substituter.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "pkg/archive.hpp"
+#include "pkg/process.hpp"
+#include "pkg/sha256.hpp"
+#include "toml_util.hpp"
+
+namespace pkg {
+namespace {
+
+std::string formatBytes(double bytes) {
+  static constexpr const char* kUnits[] = {"B", "KiB", "MiB", "GiB"};
+  int unit = 0;
+  while (bytes >= 1024.0 && unit < 3) {
+    bytes /= 1024.0;
+    ++unit;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f %s", bytes, kUnits[unit]);
+  return buf;
+}
+
+std::string hostName() {
+  char buf[HOST_NAME_MAX + 1] = {};
+  if (::gethostname(buf, sizeof(buf) - 1) != 0 || buf[0] == '\0') {
+    return "localhost";
+  }
+  return buf;
+}
+
+Status syncPath(const std::filesystem::path& path, int flags) {
+  const int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+  if (fd < 0) {
+    return Status{StatusCode::kIoError,
+                  "Failed to open " + path.string() + " for sync: " +
+                      std::strerror(errno)};
+  }
+  const int rc = ::fsync(fd);
+  const int err = errno;
+  ::close(fd);
+  if (rc != 0) {
+    return Status{StatusCode::kIoError,
+                  "fsync failed for " + path.string() + ": " + std::strerror(err)};
+  }
+  return Status::Ok();
+}
+
+struct Metadata {
+  std::string name;
+  std::string version;
+  std::string drv;
+  std::string archive;
+  std::string sha256;
+  std::string env;
+};
+
+Result<Metadata> loadMetadata(const std::filesystem::path& path) {
+  auto parsed = toml_util::parseFile(path);
+  if (!parsed.ok()) {
+    return parsed.status();
+  }
+  const toml::Datum top = parsed.value().toptab();
+  Metadata meta;
+  meta.name = toml_util::getString(top, "name").value_or(std::string{});
+  meta.version = toml_util::getString(top, "version").value_or(std::string{});
+  meta.drv = toml_util::getString(top, "drv").value_or(std::string{});
+  meta.archive = toml_util::getString(top, "archive").value_or(std::string{});
+  meta.sha256 = toml_util::getString(top, "sha256").value_or(std::string{});
+  meta.env = toml_util::getString(top, "env").value_or(std::string{});
+  if (meta.drv.empty() || meta.sha256.empty() || meta.archive.empty() ||
+      meta.archive.find('/') != std::string::npos) {
+    return Status{StatusCode::kParseError,
+                  "Substitute metadata lacks drv, archive or sha256: " +
+                      path.string()};
+  }
+  return meta;
+}
+
+}  // namespace
+
+std::string Substitution::describe() const {
+  char elapsed[32];
+  std::snprintf(elapsed, sizeof(elapsed), "%.1fs",
+                static_cast<double>(elapsed_ms) / 1000.0);
+  return formatBytes(static_cast<double>(bytes)) + " in " + elapsed;
+}
+
+std::unique_ptr<Substituter> Substituter::fromConfig(
+    const std::filesystem::path& root,
+    const Config& config,
+    const BuildEnvironment& env) {
+  if (config.substitute.dir.empty()) {
+    return nullptr;
+  }
+  std::filesystem::path dir = config.substitute.dir;
+  if (dir.is_relative()) {
+    dir = root / dir;
+  }
+  return std::make_unique<DirectorySubstituter>(std::move(dir), env.digest());
+}
+
+DirectorySubstituter::DirectorySubstituter(std::filesystem::path dir,
+                                           std::string env_digest)
+    : dir_(std::move(dir)), env_digest_(std::move(env_digest)) {}
+
+std::filesystem::path DirectorySubstituter::archivePath(
+    const std::string& drv,
+    const std::string& sha256) const {
+  return dir_ / (drv + "-" + sha256.substr(0, 16) + kArchiveSuffix);
+}
+
+std::filesystem::path DirectorySubstituter::metadataPath(
+    const std::string& drv) const {
+  return dir_ / (drv + kMetadataSuffix);
+}
+
+std::filesystem::path DirectorySubstituter::stagingPath(
+    const std::filesystem::path& path) const {
+  static std::atomic<unsigned> counter{0};
+  static const std::string host = hostName();
+  return path.string() + "." + host + "." + std::to_string(::getpid()) + "." +
+         std::to_string(counter.fetch_add(1)) + ".part";
+}
+
+std::string DirectorySubstituter::describe() const {
+  return dir_.string();
+}
+
+bool DirectorySubstituter::has(const LockEntry& entry) const {
+  std::error_code ec;
+  if (entry.drv.empty() ||
+      !std::filesystem::exists(metadataPath(entry.drv), ec)) {
+    return false;
+  }
+  // Entries from another environment would only be refused by fetch().
+  auto meta = loadMetadata(metadataPath(entry.drv));
+  return meta.ok() && meta.value().drv == entry.drv &&
+         meta.value().env == env_digest_;
+}
+
+Result<Substitution> DirectorySubstituter::fetch(
+    const LockEntry& entry,
+    const std::filesystem::path& store_dir,
+    const std::filesystem::path& log_path) const {
+  const auto started = std::chrono::steady_clock::now();
+  std::error_code ec;
+  if (entry.drv.empty() ||
+      !std::filesystem::exists(metadataPath(entry.drv), ec)) {
+    return Status{StatusCode::kNotFound,
+                  "No substitute for " + entry.name + " in " + dir_.string()};
+  }
+  auto meta = loadMetadata(metadataPath(entry.drv));
+  if (!meta.ok()) {
+    return meta.status();
+  }
+  if (meta.value().drv != entry.drv) {
+    return Status{StatusCode::kConflict,
+                  "Substitute metadata for " + entry.name +
+                      " names another derivation: " + meta.value().drv};
+  }
+  if (meta.value().env != env_digest_) {
+    return Status{StatusCode::kConflict,
+                  "Substitute for " + entry.name +
+                      " was built in another environment (" +
+                      (meta.value().env.empty() ? "unrecorded"
+                                                : meta.value().env) +
+                      ")"};
+  }
+
+  // Unpacked beside the store dir and renamed over it, so an interrupted
+  // substitution never leaves a store dir that looks populated.
+  const auto staging = stagingPath(store_dir);
+  std::filesystem::create_directories(staging, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create store dir: " + staging.string()};
+  }
+  const auto archive = dir_ / meta.value().archive;
+  ExtractOptions options;
+  options.expected_sha256 = meta.value().sha256;
+  options.log_path = log_path;
+  auto extracted = ArchiveExtractor::extractFile(archive, staging, options);
+  if (!extracted.ok()) {
+    std::filesystem::remove_all(staging, ec);
+    return Status{extracted.status().code(),
+                  "Failed to unpack substitute " + archive.string() + ": " +
+                      extracted.status().message()};
+  }
+  std::filesystem::remove_all(store_dir, ec);
+  ec.clear();
+  std::filesystem::rename(staging, store_dir, ec);
+  if (ec) {
+    std::filesystem::remove_all(staging, ec);
+    return Status{StatusCode::kIoError,
+                  "Failed to move substitute into " + store_dir.string()};
+  }
+
+  Substitution out;
+  out.bytes = extracted.value().input_bytes;
+  out.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+  return out;
+}
+
+Status DirectorySubstituter::push(const LockEntry& entry,
+                                  const std::filesystem::path& store_dir,
+                                  const std::filesystem::path& log_path) const {
+  if (has(entry)) {
+    return Status::Ok();
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  if (ec) {
+    return Status{StatusCode::kIoError,
+                  "Failed to create substitute dir: " + dir_.string()};
+  }
+
+  const auto staged_archive =
+      stagingPath(dir_ / (entry.drv + kArchiveSuffix));
+  auto s = Process::runToLog({"tar", "-czf", staged_archive.string(), "-C",
+                              store_dir.string(), "."},
+                             log_path);
+  if (!s.ok()) {
+    std::filesystem::remove(staged_archive, ec);
+    return s;
+  }
+  // Durable before any metadata can point at it: a crash must not publish
+  // an entry whose archive is truncated.
+  s = syncPath(staged_archive, O_RDONLY);
+  if (!s.ok()) {
+    std::filesystem::remove(staged_archive, ec);
+    return s;
+  }
+  auto sha256 = Sha256::hashFileHex(staged_archive);
+  if (!sha256.ok()) {
+    std::filesystem::remove(staged_archive, ec);
+    return sha256.status();
+  }
+  const auto archive = archivePath(entry.drv, sha256.value());
+
+  const auto metadata = metadataPath(entry.drv);
+  const auto staged_metadata = stagingPath(metadata);
+  {
+    std::ofstream out(staged_metadata);
+    out << "name = \"" << entry.name << "\"\n";
+    out << "version = \"" << entry.version << "\"\n";
+    out << "drv = \"" << entry.drv << "\"\n";
+    out << "archive = \"" << archive.filename().string() << "\"\n";
+    out << "sha256 = \"" << sha256.value() << "\"\n";
+    out << "env = \"" << env_digest_ << "\"\n";
+    out.close();
+    if (!out) {
+      std::filesystem::remove(staged_archive, ec);
+      std::filesystem::remove(staged_metadata, ec);
+      return Status{StatusCode::kIoError,
+                    "Failed to write " + staged_metadata.string()};
+    }
+  }
+  s = syncPath(staged_metadata, O_RDONLY);
+  if (!s.ok()) {
+    std::filesystem::remove(staged_archive, ec);
+    std::filesystem::remove(staged_metadata, ec);
+    return s;
+  }
+
+  // The archive goes first: readers only find it through the metadata.
+  // Archives are named by digest, so a concurrent push of the same drv
+  // never replaces the archive another host's metadata points at.
+  // The directory is synced between the renames so the archive's name is
+  // durable before the metadata's.
+  std::filesystem::rename(staged_archive, archive, ec);
+  if (!ec) {
+    s = syncPath(dir_, O_RDONLY | O_DIRECTORY);
+    if (!s.ok()) {
+      std::filesystem::remove(staged_metadata, ec);
+      return s;
+    }
+    std::filesystem::rename(staged_metadata, metadata, ec);
+  }
+  if (ec) {
+    std::error_code ignored;
+    std::filesystem::remove(staged_archive, ignored);
+    std::filesystem::remove(staged_metadata, ignored);
+    return Status{StatusCode::kIoError,
+                  "Failed to publish " + entry.name + " to " + dir_.string() +
+                      ": " + ec.message()};
+  }
+  return syncPath(dir_, O_RDONLY | O_DIRECTORY);
+}
+
+}  // namespace pkg
@@ -1,25 +1,202 @@
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <new>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "pkg/arena.hpp"
 #include "pkg/result.hpp"
 #include "tomlcpp.hpp"
 
 namespace pkg::toml_util {
 
+namespace detail {
+
+// tomlc17 takes its allocator from a process-wide toml_option_t, so the
+// hooks below route a parse to the arena set for the calling thread and
+// fall back to realloc/free everywhere else. Arena blocks carry their
+// capacity in a header because tomlc17 reallocs without passing the old
+// size. tomlc17 grows arrays and tables eight slots at a time, so a block
+// that has to move is given twice the room to keep appends linear.
+inline thread_local Arena* tls_arena = nullptr;
+constexpr std::size_t kBlockHeader = alignof(std::max_align_t);
+
+inline void* arenaRealloc(void* ptr, std::size_t size) {
+  Arena* arena = tls_arena;
+  if (arena == nullptr) {
+    return std::realloc(ptr, size);
+  }
+  char* block = nullptr;
+  std::size_t capacity = size;
+  if (ptr == nullptr) {
+    block = static_cast<char*>(arena->allocate(size + kBlockHeader));
+  } else {
+    char* old = static_cast<char*>(ptr) - kBlockHeader;
+    std::size_t old_capacity = 0;
+    std::memcpy(&old_capacity, old, sizeof(old_capacity));
+    if (size <= old_capacity) {
+      return ptr;
+    }
+    capacity = std::max(size, old_capacity * 2);
+    block = static_cast<char*>(arena->reallocate(
+        old, old_capacity + kBlockHeader, capacity + kBlockHeader));
+  }
+  if (block == nullptr) {
+    return nullptr;
+  }
+  std::memcpy(block, &capacity, sizeof(capacity));
+  return block + kBlockHeader;
+}
+
+inline void arenaFree(void* ptr) {
+  // Arena memory is released with the arena.
+  if (tls_arena == nullptr) {
+    std::free(ptr);
+  }
+}
+
+inline void installAllocator() {
+  static const bool installed = [] {
+    toml_option_t opt = toml_default_option();
+    opt.mem_realloc = arenaRealloc;
+    opt.mem_free = arenaFree;
+    toml_set_option(opt);
+    return true;
+  }();
+  (void)installed;
+}
+
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena& arena) : prev_(tls_arena) { tls_arena = &arena; }
+  ~ArenaScope() { tls_arena = prev_; }
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+ private:
+  Arena* prev_;
+};
+
+// Files at least this large are mapped rather than read.
+constexpr std::size_t kMapThreshold = 64 * 1024;
+
+// A file's contents followed by the NUL toml_parse requires. Small files
+// are read into `arena`, or the heap without one. Large ones (ports.lock
+// with hundreds of entries) are mapped read-only over an anonymous
+// reservation one byte longer than the file, so the terminator is there
+// even when the size is a multiple of the page size. tomlc17 copies every
+// key and string it keeps, so the source can go once parsing is done.
+class FileSource {
+ public:
+  FileSource() = default;
+  ~FileSource() {
+    if (map_ != nullptr) {
+      ::munmap(map_, map_size_);
+    }
+  }
+  FileSource(const FileSource&) = delete;
+  FileSource& operator=(const FileSource&) = delete;
+
+  Status open(const std::string& path, Arena* arena) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return Status{StatusCode::kIoError, "Failed to open file: " + path};
+    }
+    struct stat st {};
+    bool ok = ::fstat(fd, &st) == 0 && st.st_size < INT_MAX;
+    size_ = ok ? static_cast<std::size_t>(st.st_size) : 0;
+    if (ok) {
+      ok = size_ >= kMapThreshold ? map(fd) : read(fd, arena);
+    }
+    ::close(fd);
+    if (!ok) {
+      return Status{StatusCode::kIoError, "Failed to read file: " + path};
+    }
+    return Status::Ok();
+  }
+
+  const char* data() const noexcept { return data_; }
+  int size() const noexcept { return static_cast<int>(size_); }
+
+ private:
+  bool map(int fd) {
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    map_size_ = (size_ / page + 1) * page;
+    map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                  -1, 0);
+    if (map_ == MAP_FAILED) {
+      map_ = nullptr;
+      return false;
+    }
+    if (::mmap(map_, size_, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+      return false;
+    }
+    ::madvise(map_, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(map_);
+    return true;
+  }
+
+  bool read(int fd, Arena* arena) {
+    char* buf = nullptr;
+    if (arena != nullptr) {
+      buf = static_cast<char*>(arena->allocate(size_ + 1, 1));
+    } else {
+      heap_.resize(size_);
+      buf = heap_.data();
+    }
+    std::size_t got = 0;
+    while (buf != nullptr && got < size_) {
+      const ssize_t n = ::read(fd, buf + got, size_ - got);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      got += static_cast<std::size_t>(n);
+    }
+    if (buf == nullptr || got != size_) {
+      return false;
+    }
+    buf[size_] = '\0';
+    data_ = buf;
+    return true;
+  }
+
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  void* map_ = nullptr;
+  std::size_t map_size_ = 0;
+  std::string heap_;
+};
+
+}  // namespace detail
+
 inline Result<toml::Result> parseFile(const std::filesystem::path& path) {
-  FILE* fp = std::fopen(path.c_str(), "rb");
-  if (fp == nullptr) {
-    return Status{StatusCode::kIoError,
-                  "Failed to open file: " + path.string()};
+  detail::installAllocator();
+  detail::FileSource source;
+  auto status = source.open(path.native(), nullptr);
+  if (!status.ok()) {
+    return status;
   }
-  toml::Result parsed = toml::parse_file(fp);
-  std::fclose(fp);
+  toml::Result parsed = toml_parse(source.data(), source.size());
   if (!parsed.ok()) {
     return Status{StatusCode::kParseError,
                   "TOML parse error in " + path.string() + ": " + parsed.errmsg()};
@@ -27,6 +204,33 @@ inline Result<toml::Result> parseFile(const std::filesystem::path& path) {
   return parsed;
 }
 
+// Parses `path` with every table, array and string, and the contents of
+// small files, allocated from `arena`. The returned table is never freed
+// on its own; it and any string_view taken from it stay valid until the
+// arena is reset or destroyed.
+//
+// Takes the path as a plain string so batch loaders can build paths
+// without std::filesystem::path's per-component allocations.
+inline Result<toml::Datum> parseFile(const std::string& path, Arena& arena) {
+  detail::installAllocator();
+  detail::FileSource source;
+  auto status = source.open(path, &arena);
+  if (!status.ok()) {
+    return status;
+  }
+
+  toml_result_t parsed{};
+  {
+    detail::ArenaScope scope(arena);
+    parsed = toml_parse(source.data(), source.size());
+  }
+  if (!parsed.ok) {
+    return Status{StatusCode::kParseError,
+                  "TOML parse error in " + path + ": " + parsed.errmsg};
+  }
+  return toml::Datum(parsed.toptab);
+}
+
 inline std::optional<std::string> getString(const toml::Datum& d,
                                             std::string_view key) {
   auto v = d.get(key);
@@ -40,6 +244,16 @@ inline std::optional<std::string> getString(const toml::Datum& d,
   return std::string(*s);
 }
 
+// Like getString, but returns a view into the parsed document.
+inline std::optional<std::string_view> getStringView(const toml::Datum& d,
+                                                     std::string_view key) {
+  auto v = d.get(key);
+  if (!v.has_value()) {
+    return std::nullopt;
+  }
+  return v->as_str();
+}
+
 inline std::optional<int> getInt(const toml::Datum& d, std::string_view key) {
   auto v = d.get(key);
   if (!v.has_value()) {
@@ -52,6 +266,27 @@ inline std::optional<int> getInt(const toml::Datum& d, std::string_view key) {
   return static_cast<int>(*i);
 }
 
+inline std::optional<std::int64_t> getInt64(const toml::Datum& d,
+                                            std::string_view key) {
+  auto v = d.get(key);
+  if (!v.has_value()) {
+    return std::nullopt;
+  }
+  auto i = v->as_int();
+  if (!i.has_value()) {
+    return std::nullopt;
+  }
+  return static_cast<std::int64_t>(*i);
+}
+
+inline std::optional<bool> getBool(const toml::Datum& d, std::string_view key) {
+  auto v = d.get(key);
+  if (!v.has_value()) {
+    return std::nullopt;
+  }
+  return v->as_bool();
+}
+
 inline Result<std::vector<std::string>> getStringArray(const toml::Datum& d,
                                                        std::string_view key) {
   auto v = d.get(key);
@@ -71,15 +306,115 @@ inline Result<std::vector<std::string>> getStringArray(const toml::Datum& d,
   return out;
 }
 
-inline Status requireNonEmpty(const std::string& value,
+// Like getStringArray, but the views and the array holding them live in
+// `arena` and the parsed document, which must outlive the result.
+inline Result<std::span<const std::string_view>> getStringArray(
+    const toml::Datum& d, std::string_view key, Arena& arena) {
+  auto v = d.get(key);
+  if (!v.has_value()) {
+    return std::span<const std::string_view>{};
+  }
+  if (!v->is_array()) {
+    return Status{StatusCode::kParseError,
+                  "Expected string array for key: " + std::string(key)};
+  }
+  const auto n = static_cast<std::size_t>(v->u.arr.size);
+  auto* out = static_cast<std::string_view*>(
+      arena.allocate(n * sizeof(std::string_view), alignof(std::string_view)));
+  for (std::size_t i = 0; i < n; ++i) {
+    const toml::Datum elem(v->u.arr.elem[i]);
+    auto str = elem.as_str();
+    if (!str.has_value() || out == nullptr) {
+      return Status{StatusCode::kParseError,
+                    "Expected string array for key: " + std::string(key)};
+    }
+    new (out + i) std::string_view(*str);
+  }
+  return std::span<const std::string_view>(out, n);
+}
+
+inline Status requireNonEmpty(std::string_view value,
                               std::string_view field_name,
-                              const std::filesystem::path& path) {
+                              std::string_view path) {
   if (value.empty()) {
     return Status{StatusCode::kParseError,
                   "Missing or empty '" + std::string(field_name) + "' in " +
-                      path.string()};
+                      std::string(path)};
   }
   return Status::Ok();
 }
 
+// Appends an unambiguous encoding of `d` to `out`: table keys sorted,
+// strings length-prefixed, numbers in fixed notation. Formatting, comments
+// and key order in the source do not change the result, so it is suitable
+// for hashing a document's content.
+inline void appendCanonical(const toml_datum_t& d, std::string& out) {
+  char buf[64];
+  switch (d.type) {
+    case TOML_STRING:
+      out += "s" + std::to_string(d.u.str.len) + ":";
+      out.append(d.u.str.ptr, static_cast<std::size_t>(d.u.str.len));
+      return;
+    case TOML_INT64:
+      std::snprintf(buf, sizeof(buf), "i%" PRId64 ";", d.u.int64);
+      out += buf;
+      return;
+    case TOML_FP64:
+      std::snprintf(buf, sizeof(buf), "f%a;", d.u.fp64);
+      out += buf;
+      return;
+    case TOML_BOOLEAN:
+      out += d.u.boolean ? "b1" : "b0";
+      return;
+    case TOML_DATE:
+    case TOML_TIME:
+    case TOML_DATETIME:
+    case TOML_DATETIMETZ:
+      std::snprintf(buf, sizeof(buf), "t%d:%d-%d-%dT%d:%d:%d.%dZ%d;",
+                    static_cast<int>(d.type), d.u.ts.year, d.u.ts.month,
+                    d.u.ts.day, d.u.ts.hour, d.u.ts.minute, d.u.ts.second,
+                    static_cast<int>(d.u.ts.usec), d.u.ts.tz);
+      out += buf;
+      return;
+    case TOML_ARRAY:
+      out += "a" + std::to_string(d.u.arr.size) + "[";
+      for (int i = 0; i < d.u.arr.size; ++i) {
+        appendCanonical(d.u.arr.elem[i], out);
+      }
+      out += "]";
+      return;
+    case TOML_TABLE: {
+      // Recipe tables are small; only spill to the heap for large ones.
+      int small[32];
+      std::vector<int> large;
+      int* idx = small;
+      if (d.u.tab.size > 32) {
+        large.resize(static_cast<std::size_t>(d.u.tab.size));
+        idx = large.data();
+      }
+      for (int i = 0; i < d.u.tab.size; ++i) {
+        idx[i] = i;
+      }
+      const auto key = [&](int i) {
+        return std::string_view(d.u.tab.key[i],
+                                static_cast<std::size_t>(d.u.tab.len[i]));
+      };
+      std::sort(idx, idx + d.u.tab.size,
+                [&](int a, int b) { return key(a) < key(b); });
+      out += "T" + std::to_string(d.u.tab.size) + "{";
+      for (int n = 0; n < d.u.tab.size; ++n) {
+        const int i = idx[n];
+        out += std::to_string(d.u.tab.len[i]) + ":";
+        out += key(i);
+        appendCanonical(d.u.tab.value[i], out);
+      }
+      out += "}";
+      return;
+    }
+    default:
+      out += "?";
+      return;
+  }
+}
+
 }  // namespace pkg::toml_util
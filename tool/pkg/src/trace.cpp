@@ -0,0 +1,201 @@
+#include "pkg/trace.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace pkg {
+namespace {
+
+std::string jsonString(std::string_view s) {
+  std::string out = "\"";
+  for (const char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out + "\"";
+}
+
+}  // namespace
+
+BuildTrace::Span::Span(BuildTrace* trace,
+                       const char* pool,
+                       std::string name,
+                       const char* category,
+                       bool job)
+    : trace_(trace),
+      pool_(pool),
+      name_(std::move(name)),
+      category_(category),
+      job_(job) {
+  if (trace_ != nullptr) {
+    lane_ = trace_->begin(pool_, job_, &start_us_);
+  }
+}
+
+BuildTrace::Span::~Span() {
+  if (trace_ == nullptr) {
+    return;
+  }
+  Event event;
+  event.name = std::move(name_);
+  event.category = category_;
+  event.ts_us = start_us_;
+  event.lane = lane_;
+  event.args = std::move(args_);
+  trace_->end(std::move(event), pool_, job_);
+}
+
+void BuildTrace::Span::arg(std::string key, std::string value) {
+  if (trace_ != nullptr) {
+    args_.emplace_back(std::move(key), std::move(value));
+  }
+}
+
+BuildTrace::BuildTrace(std::string process_name)
+    : process_name_(std::move(process_name)),
+      started_(std::chrono::steady_clock::now()) {}
+
+std::int64_t BuildTrace::nowUs() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - started_)
+      .count();
+}
+
+std::size_t BuildTrace::poolLocked(const char* pool) {
+  const auto it = std::find(pools_.begin(), pools_.end(), pool);
+  if (it != pools_.end()) {
+    return static_cast<std::size_t>(it - pools_.begin());
+  }
+  pools_.emplace_back(pool);
+  pool_lanes_.push_back(0);
+  pool_jobs_.push_back(0);
+  return pools_.size() - 1;
+}
+
+int BuildTrace::laneLocked(const char* pool) {
+  const auto [it, inserted] = lane_of_thread_.try_emplace(
+      std::this_thread::get_id(), static_cast<int>(lanes_.size()) + 1);
+  if (!inserted) {
+    return it->second;
+  }
+  const auto p = poolLocked(pool);
+  const int n = ++pool_lanes_[p];
+  // Keep each pool's lanes together, pools in order of first use.
+  lanes_.push_back(Lane{std::string(pool) + " " + std::to_string(n),
+                        static_cast<int>(p) * 1000 + n});
+  return it->second;
+}
+
+int BuildTrace::begin(const char* pool, bool job, std::int64_t* start_us) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const int lane = laneLocked(pool);
+  *start_us = nowUs();
+  if (job) {
+    countLocked(pool, 1, *start_us);
+  }
+  return lane;
+}
+
+void BuildTrace::end(Event event, const char* pool, bool job) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const auto now = nowUs();
+  event.dur_us = now - event.ts_us;
+  events_.push_back(std::move(event));
+  if (job) {
+    countLocked(pool, -1, now);
+  }
+}
+
+// One "jobs" counter track with a series per pool.
+void BuildTrace::countLocked(const char* pool, int delta, std::int64_t ts_us) {
+  const auto p = poolLocked(pool);
+  pool_jobs_[p] += delta;
+  Event counter;
+  counter.phase = 'C';
+  counter.name = "jobs";
+  counter.ts_us = ts_us;
+  for (std::size_t i = 0; i < pools_.size(); ++i) {
+    counter.args.emplace_back(pools_[i], std::to_string(pool_jobs_[i]));
+  }
+  events_.push_back(std::move(counter));
+}
+
+Status BuildTrace::save(const std::filesystem::path& path) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  const auto pid = std::to_string(::getpid());
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out += "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" + pid +
+         ",\"tid\":0,\"args\":{\"name\":" + jsonString(process_name_) + "}}";
+  for (std::size_t i = 0; i < lanes_.size(); ++i) {
+    const auto tid = std::to_string(i + 1);
+    out += ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid +
+           ",\"tid\":" + tid + ",\"args\":{\"name\":" +
+           jsonString(lanes_[i].name) + "}}";
+    out += ",\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":" + pid +
+           ",\"tid\":" + tid + ",\"args\":{\"sort_index\":" +
+           std::to_string(lanes_[i].sort_index) + "}}";
+  }
+  for (const auto& event : events_) {
+    out += ",\n{\"ph\":\"";
+    out += event.phase;
+    out += "\",\"name\":" + jsonString(event.name) + ",\"pid\":" + pid +
+           ",\"ts\":" + std::to_string(event.ts_us);
+    if (event.phase == 'C') {
+      // Counter values are numbers; counters live on the process track.
+      out += ",\"args\":{";
+      for (std::size_t i = 0; i < event.args.size(); ++i) {
+        out += (i == 0 ? "" : ",") + jsonString(event.args[i].first) + ":" +
+               event.args[i].second;
+      }
+      out += "}}";
+      continue;
+    }
+    out += ",\"dur\":" + std::to_string(event.dur_us) +
+           ",\"tid\":" + std::to_string(event.lane) +
+           ",\"cat\":" + jsonString(event.category);
+    if (!event.args.empty()) {
+      out += ",\"args\":{";
+      for (std::size_t i = 0; i < event.args.size(); ++i) {
+        out += (i == 0 ? "" : ",") + jsonString(event.args[i].first) + ":" +
+               jsonString(event.args[i].second);
+      }
+      out += "}";
+    }
+    out += "}";
+  }
+  out += "\n]}\n";
+
+  std::error_code ec;
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path(), ec);
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << out;
+  if (!file) {
+    return Status{StatusCode::kIoError,
+                  "Failed to write trace: " + path.string()};
+  }
+  return Status::Ok();
+}
+
+}  // namespace pkg
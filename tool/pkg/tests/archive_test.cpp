@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "pkg/archive.hpp"
+#include "pkg/sha256.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+// Builds an uncompressed ustar archive in memory.
+class TarBuilder {
+ public:
+  TarBuilder& file(std::string_view name, std::string_view data) {
+    return entry(name, '0', data);
+  }
+  // Extended header for the next entry; records are passed through as is.
+  TarBuilder& pax(std::string_view records) {
+    return entry("PaxHeaders/next", 'x', records);
+  }
+  TarBuilder& dir(std::string_view name) {
+    header(name, '5', 0, "");
+    return *this;
+  }
+  TarBuilder& symlink(std::string_view name, std::string_view target) {
+    header(name, '2', 0, target);
+    return *this;
+  }
+  TarBuilder& hardlink(std::string_view name, std::string_view target) {
+    header(name, '1', 0, target);
+    return *this;
+  }
+  std::string finish() const { return body_ + std::string(1024, '\0'); }
+
+ private:
+  TarBuilder& entry(std::string_view name, char type, std::string_view data) {
+    header(name, type, data.size(), "");
+    body_ += data;
+    body_.append((512 - data.size() % 512) % 512, '\0');
+    return *this;
+  }
+
+  void header(std::string_view name, char type, std::size_t size,
+              std::string_view link) {
+    char h[512] = {};
+    std::memcpy(h, name.data(), std::min<std::size_t>(name.size(), 100));
+    std::snprintf(h + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+    std::snprintf(h + 108, 8, "%07o", 0);
+    std::snprintf(h + 116, 8, "%07o", 0);
+    std::snprintf(h + 124, 12, "%011zo", size);
+    std::snprintf(h + 136, 12, "%011o", 0);
+    h[156] = type;
+    std::memcpy(h + 157, link.data(), std::min<std::size_t>(link.size(), 100));
+    std::memcpy(h + 257, "ustar", 6);
+    std::memcpy(h + 263, "00", 2);
+    unsigned sum = 0;
+    for (int i = 0; i < 512; ++i) {
+      sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(h[i]);
+    }
+    std::snprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+    body_.append(h, sizeof(h));
+  }
+
+  std::string body_;
+};
+
+// Feeds the archive in small uneven chunks, as a download would.
+Status extract(const std::string& archive, const std::filesystem::path& dest,
+               ExtractOptions options = {}) {
+  ArchiveExtractor extractor(dest, std::move(options));
+  for (std::size_t off = 0; off < archive.size(); off += 7) {
+    auto s = extractor.write(std::string_view(archive).substr(off, 7));
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return extractor.finish();
+}
+
+PKG_TEST(archive, extracts_and_strips_components) {
+  test::TempDir dir;
+  const auto tar = TarBuilder()
+                       .dir("top/")
+                       .dir("top/bin/")
+                       .file("top/bin/tool", "#!/bin/sh\n")
+                       .file("top/README", "hello")
+                       .symlink("top/link", "README")
+                       .finish();
+  ExtractOptions options;
+  options.strip_components = 1;
+  REQUIRE_OK(extract(tar, dir.path(), options));
+  CHECK_EQ(test::readFile(dir.path() / "bin/tool"), std::string("#!/bin/sh\n"));
+  CHECK_EQ(test::readFile(dir.path() / "README"), std::string("hello"));
+  CHECK(std::filesystem::is_symlink(dir.path() / "link"));
+  CHECK(!std::filesystem::exists(dir.path() / "top"));
+}
+
+PKG_TEST(archive, rejects_parent_traversal) {
+  test::TempDir dir;
+  const auto dest = dir.path() / "dest";
+  std::filesystem::create_directories(dest);
+  const auto tar = TarBuilder().file("../evil", "x").finish();
+  CHECK(!extract(tar, dest).ok());
+  CHECK(!std::filesystem::exists(dir.path() / "evil"));
+}
+
+PKG_TEST(archive, unpacks_absolute_paths_under_destination) {
+  test::TempDir dir;
+  const auto dest = dir.path() / "dest";
+  const auto tar = TarBuilder().file("/abs/f", "x").finish();
+  REQUIRE_OK(extract(tar, dest));
+  CHECK_EQ(test::readFile(dest / "abs/f"), std::string("x"));
+}
+
+PKG_TEST(archive, rejects_paths_through_symlinks) {
+  test::TempDir dir;
+  const auto dest = dir.path() / "dest";
+  const auto outside = dir.path() / "outside";
+  std::filesystem::create_directories(dest);
+  std::filesystem::create_directories(outside);
+  const auto tar = TarBuilder()
+                       .symlink("a", outside.string())
+                       .file("a/f", "x")
+                       .finish();
+  CHECK(!extract(tar, dest).ok());
+  CHECK(!std::filesystem::exists(outside / "f"));
+}
+
+PKG_TEST(archive, rejects_hard_links_through_symlinks) {
+  test::TempDir dir;
+  const auto dest = dir.path() / "dest";
+  const auto victim = dir.path() / "victim";
+  std::filesystem::create_directories(dest);
+  test::writeFile(victim / "f", "secret");
+  const auto tar = TarBuilder()
+                       .dir("top/")
+                       .symlink("top/a", victim.string())
+                       .hardlink("top/b", "top/a/f")
+                       .finish();
+  ExtractOptions options;
+  options.strip_components = 1;
+  CHECK(!extract(tar, dest, options).ok());
+  CHECK_EQ(std::filesystem::hard_link_count(victim / "f"), 1u);
+  CHECK(!std::filesystem::exists(dest / "b"));
+}
+
+PKG_TEST(archive, rejects_hard_links_to_files_outside_archive) {
+  test::TempDir dir;
+  const auto dest = dir.path() / "dest";
+  test::writeFile(dest / "preexisting", "x");
+  const auto tar = TarBuilder().hardlink("b", "preexisting").finish();
+  CHECK(!extract(tar, dest).ok());
+  CHECK_EQ(std::filesystem::hard_link_count(dest / "preexisting"), 1u);
+}
+
+PKG_TEST(archive, links_files_from_the_same_archive) {
+  test::TempDir dir;
+  const auto tar = TarBuilder()
+                       .file("x", "hello")
+                       .hardlink("y", "x")
+                       .finish();
+  REQUIRE_OK(extract(tar, dir.path()));
+  CHECK_EQ(test::readFile(dir.path() / "y"), std::string("hello"));
+  CHECK_EQ(std::filesystem::hard_link_count(dir.path() / "x"), 2u);
+}
+
+PKG_TEST(archive, applies_pax_paths) {
+  test::TempDir dir;
+  const auto tar = TarBuilder()
+                       .pax("22 path=long/name.txt\n")
+                       .file("short", "data")
+                       .finish();
+  REQUIRE_OK(extract(tar, dir.path()));
+  CHECK_EQ(test::readFile(dir.path() / "long/name.txt"), std::string("data"));
+  CHECK(!std::filesystem::exists(dir.path() / "short"));
+}
+
+PKG_TEST(archive, rejects_malformed_pax_records) {
+  // Lengths shorter than the record's own header, longer than the data,
+  // not ending in a newline, or not followed by a space.
+  for (const char* records : {"1 path=AAAAAAAA\n", "3 path=x\n",
+                              "99 path=AAAAAAAA\n", "14 path=AAAAAA\n",
+                              "12path=AAAAAAAA\n", "16 path=AAAAAAAA"}) {
+    test::TempDir dir;
+    const auto tar = TarBuilder().pax(records).file("f", "x").finish();
+    const auto s = extract(tar, dir.path());
+    CHECK(s.code() == StatusCode::kParseError);
+    CHECK(!std::filesystem::exists(dir.path() / "f"));
+  }
+}
+
+PKG_TEST(archive, rejects_truncated_streams) {
+  test::TempDir dir;
+  const auto tar = TarBuilder().file("f", std::string(2000, 'x')).finish();
+  // Cut inside the file's data.
+  CHECK(!extract(tar.substr(0, 1024), dir.path()).ok());
+}
+
+PKG_TEST(archive, verifies_checksum) {
+  test::TempDir dir;
+  const auto tar = TarBuilder().file("f", "data").finish();
+  ExtractOptions options;
+  options.expected_sha256 = Sha256::hashHex("something else");
+  const auto s = extract(tar, dir.path() / "bad", options);
+  CHECK(s.code() == StatusCode::kConflict);
+
+  options.expected_sha256 = Sha256::hashHex(tar);
+  REQUIRE_OK(extract(tar, dir.path() / "good", options));
+  CHECK_EQ(test::readFile(dir.path() / "good/f"), std::string("data"));
+}
+
+}  // namespace
+}  // namespace pkg
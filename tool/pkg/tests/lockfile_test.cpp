@@ -0,0 +1,140 @@
+#include <fstream>
+#include <string>
+
+#include "pkg/config.hpp"
+#include "pkg/lockfile.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+Lockfile planned() {
+  Lockfile lock;
+  lock.state = "planned";
+  for (const char* name : {"a", "b", "c"}) {
+    LockEntry e;
+    e.name = name;
+    e.version = "1.0";
+    e.status = "planned";
+    e.drv = std::string(64, name[0]);
+    e.store = std::string("store/") + name;
+    lock.entries.push_back(e);
+  }
+  lock.entries[2].deps = {"a", "b"};
+  return lock;
+}
+
+std::filesystem::path journalOf(const std::filesystem::path& root,
+                                const Config& cfg) {
+  return root / (cfg.layout.lockfile + LockfileStore::kJournalSuffix);
+}
+
+PKG_TEST(journal, replays_recorded_progress) {
+  test::TempDir root;
+  const Config cfg;
+  auto lock = planned();
+  auto journal = LockfileJournal::begin(root.path(), cfg, lock);
+  REQUIRE_OK(journal);
+  lock.entries[1].status = "built";
+  PhaseUsage usage;
+  usage.phase = "build";
+  usage.wall_ms = 12;
+  lock.entries[1].phases.push_back(usage);
+  REQUIRE_OK(journal.value()->record(lock.entries[1]));
+  // No compact(): the build "crashed" here.
+
+  auto loaded = LockfileStore::load(root.path(), cfg);
+  REQUIRE_OK(loaded);
+  CHECK_EQ(loaded.value().state, std::string("building"));
+  REQUIRE(loaded.value().entries.size() == 3);
+  CHECK_EQ(loaded.value().entries[0].status, std::string("planned"));
+  CHECK_EQ(loaded.value().entries[1].name, std::string("b"));
+  CHECK_EQ(loaded.value().entries[1].status, std::string("built"));
+  REQUIRE(loaded.value().entries[1].phases.size() == 1);
+  CHECK_EQ(loaded.value().entries[1].phases[0].wall_ms, 12);
+  CHECK(loaded.value().entries[2].deps ==
+        (std::vector<std::string>{"a", "b"}));
+}
+
+PKG_TEST(journal, drops_torn_last_record) {
+  test::TempDir root;
+  const Config cfg;
+  auto lock = planned();
+  auto journal = LockfileJournal::begin(root.path(), cfg, lock);
+  REQUIRE_OK(journal);
+  lock.entries[0].status = "built";
+  REQUIRE_OK(journal.value()->record(lock.entries[0]));
+  {
+    // A record cut short by a crash mid-write.
+    std::ofstream out(journalOf(root.path(), cfg), std::ios::app);
+    out << "\n[[entry]]\nname = \"c\"\nstatus = \"bui";
+  }
+
+  auto loaded = LockfileStore::load(root.path(), cfg);
+  REQUIRE_OK(loaded);
+  REQUIRE(loaded.value().entries.size() == 3);
+  CHECK_EQ(loaded.value().entries[0].status, std::string("built"));
+  CHECK_EQ(loaded.value().entries[2].status, std::string("planned"));
+}
+
+PKG_TEST(journal, drops_record_torn_at_a_line_boundary) {
+  test::TempDir root;
+  const Config cfg;
+  auto lock = planned();
+  auto journal = LockfileJournal::begin(root.path(), cfg, lock);
+  REQUIRE_OK(journal);
+  lock.entries[0].status = "built";
+  REQUIRE_OK(journal.value()->record(lock.entries[0]));
+  {
+    // c's record stopped after the header of its first phase. What made it
+    // to disk parses, but claims c was built with a phase it never ran.
+    std::ofstream out(journalOf(root.path(), cfg), std::ios::app);
+    out << "\n[[entry]]\nname = \"c\"\nversion = \"1.0\"\n"
+        << "status = \"built\"\nrecipe = \"\"\ndrv = \"\"\nstore = \"\"\n"
+        << "deps = []\n\n[[entry.phase]]\nname = \"build\"\n";
+  }
+
+  auto loaded = LockfileStore::load(root.path(), cfg);
+  REQUIRE_OK(loaded);
+  REQUIRE(loaded.value().entries.size() == 3);
+  CHECK_EQ(loaded.value().entries[0].status, std::string("built"));
+  CHECK_EQ(loaded.value().entries[2].status, std::string("planned"));
+  CHECK_EQ(loaded.value().entries[2].drv, std::string(64, 'c'));
+  CHECK(loaded.value().entries[2].deps ==
+        (std::vector<std::string>{"a", "b"}));
+  CHECK(loaded.value().entries[2].phases.empty());
+
+  // The torn tail is gone, so later records append to a clean journal.
+  lock.entries[2].status = "built";
+  REQUIRE_OK(journal.value()->record(lock.entries[2]));
+  loaded = LockfileStore::load(root.path(), cfg);
+  REQUIRE_OK(loaded);
+  CHECK_EQ(loaded.value().entries[2].status, std::string("built"));
+  CHECK_EQ(loaded.value().entries[2].store, std::string("store/c"));
+}
+
+PKG_TEST(journal, compact_replaces_lockfile_and_removes_journal) {
+  test::TempDir root;
+  const Config cfg;
+  auto lock = planned();
+  auto journal = LockfileJournal::begin(root.path(), cfg, lock);
+  REQUIRE_OK(journal);
+  for (auto& e : lock.entries) {
+    e.status = "built";
+    REQUIRE_OK(journal.value()->record(e));
+  }
+  lock.state = "done";
+  REQUIRE_OK(journal.value()->compact(lock));
+  CHECK(!std::filesystem::exists(journalOf(root.path(), cfg)));
+
+  auto loaded = LockfileStore::load(root.path(), cfg);
+  REQUIRE_OK(loaded);
+  CHECK_EQ(loaded.value().state, std::string("done"));
+  REQUIRE(loaded.value().entries.size() == 3);
+  for (const auto& e : loaded.value().entries) {
+    CHECK_EQ(e.status, std::string("built"));
+  }
+}
+
+}  // namespace
+}  // namespace pkg
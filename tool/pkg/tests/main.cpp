@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "test.hpp"
+
+namespace pkg::test {
+namespace {
+
+int failures = 0;
+
+}  // namespace
+
+std::vector<Case>& registry() {
+  static std::vector<Case> cases;
+  return cases;
+}
+
+void fail(const char* file, int line, const std::string& what) {
+  ++failures;
+  std::cerr << file << ":" << line << ": check failed: " << what << "\n";
+}
+
+TempDir::TempDir() {
+  std::string pattern =
+      (std::filesystem::temp_directory_path() / "pkg-test-XXXXXX").string();
+  if (::mkdtemp(pattern.data()) != nullptr) {
+    path_ = pattern;
+  }
+}
+
+TempDir::~TempDir() {
+  if (!path_.empty()) {
+    std::error_code ec;
+    std::filesystem::remove_all(path_, ec);
+  }
+}
+
+void writeFile(const std::filesystem::path& path, std::string_view contents,
+               bool executable) {
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+  out.close();
+  if (executable) {
+    ::chmod(path.c_str(), 0755);
+  }
+}
+
+std::string readFile(const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+}  // namespace pkg::test
+
+// Usage: pkg_tests [<name prefix>]
+int main(int argc, char** argv) {
+  const std::string_view prefix = argc > 1 ? argv[1] : "";
+  int ran = 0;
+  int failed = 0;
+  for (const auto& c : pkg::test::registry()) {
+    if (c.name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    const int before = pkg::test::failures;
+    c.fn();
+    ++ran;
+    const bool ok = pkg::test::failures == before;
+    failed += ok ? 0 : 1;
+    std::cout << (ok ? "ok   " : "FAIL ") << c.name << "\n";
+  }
+  if (ran == 0) {
+    std::cerr << "no test matches '" << prefix << "'\n";
+    return 1;
+  }
+  std::cout << ran - failed << " of " << ran << " passed\n";
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "pkg/resolver.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+PortRecipe recipe(const char* name, std::vector<std::string> deps) {
+  PortRecipe r;
+  r.name = name;
+  r.version = "1.0";
+  r.deps = std::move(deps);
+  return r;
+}
+
+bool hasEdge(const std::vector<PortRecipe>& recipes, const std::string& from,
+             const std::string& to) {
+  for (const auto& r : recipes) {
+    if (r.name == from) {
+      return std::find(r.deps.begin(), r.deps.end(), to) != r.deps.end();
+    }
+  }
+  return false;
+}
+
+PKG_TEST(resolver, finds_every_cycle) {
+  // a -> b -> c -> a and d -> d are cycles; e only reaches one, f is
+  // outside the set.
+  const std::vector<PortRecipe> recipes = {
+      recipe("c", {"a"}),      recipe("a", {"b"}), recipe("b", {"c", "f"}),
+      recipe("d", {"d"}),      recipe("e", {"a"}), recipe("g", {}),
+  };
+  std::vector<const PortRecipe*> ptrs;
+  for (const auto& r : recipes) {
+    ptrs.push_back(&r);
+  }
+  const auto cycles = Resolver::findCycles(ptrs);
+  REQUIRE(cycles.size() == 2);
+
+  CHECK(cycles[0].ports == (std::vector<std::string>{"a", "b", "c"}));
+  CHECK(cycles[1].ports == (std::vector<std::string>{"d"}));
+  for (const auto& cycle : cycles) {
+    REQUIRE(cycle.path.size() >= 2);
+    CHECK_EQ(cycle.path.front(), cycle.ports.front());
+    CHECK_EQ(cycle.path.back(), cycle.ports.front());
+    for (std::size_t i = 0; i + 1 < cycle.path.size(); ++i) {
+      CHECK(hasEdge(recipes, cycle.path[i], cycle.path[i + 1]));
+    }
+  }
+  CHECK(cycles[0].path == (std::vector<std::string>{"a", "b", "c", "a"}));
+  CHECK(cycles[1].path == (std::vector<std::string>{"d", "d"}));
+}
+
+PKG_TEST(resolver, acyclic_graph_has_no_cycles) {
+  const std::vector<PortRecipe> recipes = {
+      recipe("a", {}), recipe("b", {"a"}), recipe("c", {"a", "b"})};
+  std::vector<const PortRecipe*> ptrs;
+  for (const auto& r : recipes) {
+    ptrs.push_back(&r);
+  }
+  CHECK(Resolver::findCycles(ptrs).empty());
+}
+
+}  // namespace
+}  // namespace pkg
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "pkg/scheduler.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+ScheduleNode node(const char* name, std::vector<std::size_t> deps,
+                  std::int64_t weight = 1) {
+  ScheduleNode n;
+  n.name = name;
+  n.deps = std::move(deps);
+  n.weight = weight;
+  return n;
+}
+
+PKG_TEST(scheduler, starts_nodes_after_their_deps) {
+  // 0 <- 1, 0 <- 2, {1, 2} <- 3, 4 on its own.
+  const std::vector<ScheduleNode> nodes = {
+      node("a", {}), node("b", {0}), node("c", {0}), node("d", {1, 2}),
+      node("e", {})};
+  std::mutex mu;
+  std::vector<std::size_t> finished;
+  std::vector<bool> deps_done_at_start(nodes.size(), false);
+  const auto states = BuildScheduler::run(nodes, 3, [&](std::size_t i) {
+    std::lock_guard<std::mutex> lock(mu);
+    deps_done_at_start[i] = std::all_of(
+        nodes[i].deps.begin(), nodes[i].deps.end(), [&](std::size_t dep) {
+          return std::find(finished.begin(), finished.end(), dep) !=
+                 finished.end();
+        });
+    finished.push_back(i);
+    return Status::Ok();
+  });
+  REQUIRE(states.size() == nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    CHECK(states[i] == NodeState::kDone);
+    CHECK(deps_done_at_start[i]);
+  }
+  CHECK_EQ(finished.size(), nodes.size());
+}
+
+PKG_TEST(scheduler, critical_path_sums_heaviest_chain) {
+  const std::vector<ScheduleNode> nodes = {
+      node("a", {}, 1), node("b", {0}, 5), node("c", {0}, 1),
+      node("d", {2}, 2)};
+  const auto path = BuildScheduler::criticalPath(nodes);
+  REQUIRE(path.size() == nodes.size());
+  CHECK_EQ(path[0], 6);
+  CHECK_EQ(path[1], 5);
+  CHECK_EQ(path[2], 3);
+  CHECK_EQ(path[3], 2);
+}
+
+PKG_TEST(scheduler, starts_heaviest_critical_path_first) {
+  // "light" is cheap but heads a long chain; "heavy" is costly on its own.
+  const std::vector<ScheduleNode> nodes = {
+      node("heavy", {}, 10), node("light", {}, 1), node("tail", {1}, 100)};
+  std::vector<std::size_t> order;
+  BuildScheduler::run(nodes, 1, [&](std::size_t i) {
+    order.push_back(i);
+    return Status::Ok();
+  });
+  REQUIRE(order.size() == 3);
+  CHECK_EQ(order[0], 1u);
+}
+
+PKG_TEST(scheduler, keep_going_skips_only_dependents) {
+  // a fails; b and d sit above it, c does not.
+  const std::vector<ScheduleNode> nodes = {
+      node("a", {}), node("b", {0}), node("c", {}), node("d", {1})};
+  std::vector<std::size_t> skipped;
+  ScheduleOptions options;
+  options.keep_going = true;
+  options.on_skipped = [&](std::size_t i) { skipped.push_back(i); };
+  const auto states = BuildScheduler::run(
+      nodes, 1,
+      [&](std::size_t i) {
+        return i == 0 ? Status{StatusCode::kInternalError, "boom"}
+                      : Status::Ok();
+      },
+      options);
+  REQUIRE(states.size() == 4);
+  CHECK(states[0] == NodeState::kFailed);
+  CHECK(states[1] == NodeState::kSkipped);
+  CHECK(states[2] == NodeState::kDone);
+  CHECK(states[3] == NodeState::kSkipped);
+  std::sort(skipped.begin(), skipped.end());
+  CHECK(skipped == (std::vector<std::size_t>{1, 3}));
+}
+
+PKG_TEST(scheduler, stops_starting_nodes_after_failure) {
+  const std::vector<ScheduleNode> nodes = {node("a", {}, 10), node("b", {}, 1)};
+  std::vector<std::size_t> ran;
+  const auto states = BuildScheduler::run(nodes, 1, [&](std::size_t i) {
+    ran.push_back(i);
+    return Status{StatusCode::kInternalError, "boom"};
+  });
+  CHECK_EQ(ran.size(), 1u);
+  CHECK(states[0] == NodeState::kFailed);
+  CHECK(states[1] == NodeState::kSkipped);
+}
+
+}  // namespace
+}  // namespace pkg
@@ -0,0 +1,57 @@
+#include <string>
+
+#include "pkg/sha256.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+// FIPS 180-2 appendix B test vectors.
+PKG_TEST(sha256, known_vectors) {
+  CHECK_EQ(Sha256::hashHex(""),
+           std::string("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+  CHECK_EQ(Sha256::hashHex("abc"),
+           std::string("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+  CHECK_EQ(Sha256::hashHex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+           std::string("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+}
+
+PKG_TEST(sha256, million_a) {
+  Sha256 hasher;
+  const std::string block(1000, 'a');
+  for (int i = 0; i < 1000; ++i) {
+    hasher.update(block);
+  }
+  CHECK_EQ(hasher.finishHex(),
+           std::string("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+PKG_TEST(sha256, chunking_does_not_change_digest) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += static_cast<char>(i * 31 + 7);
+  }
+  const std::string expected = Sha256::hashHex(data);
+  // Chunk sizes that straddle the 64-byte block and the 56-byte padding
+  // boundary in every way.
+  for (std::size_t chunk : {1u, 3u, 55u, 56u, 63u, 64u, 65u, 127u, 999u}) {
+    Sha256 hasher;
+    for (std::size_t off = 0; off < data.size(); off += chunk) {
+      hasher.update(std::string_view(data).substr(off, chunk));
+    }
+    CHECK_EQ(hasher.finishHex(), expected);
+  }
+}
+
+PKG_TEST(sha256, hashes_files) {
+  test::TempDir dir;
+  const auto path = dir.path() / "f";
+  test::writeFile(path, "abc");
+  auto digest = Sha256::hashFileHex(path);
+  REQUIRE_OK(digest);
+  CHECK_EQ(digest.value(), Sha256::hashHex("abc"));
+  CHECK(!Sha256::hashFileHex(dir.path() / "missing").ok());
+}
+
+}  // namespace
+}  // namespace pkg
@@ -0,0 +1,168 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "pkg/commands.hpp"
+#include "pkg/config.hpp"
+#include "pkg/lockfile.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+// Two ports, d depending on c. c's install writes into its store dir and
+// then fails while $PKG_ROOT/fail-c exists.
+void writeTree(const std::filesystem::path& root) {
+  test::writeFile(root / "pkg.toml",
+                  "[build]\njobs = 2\nenv_passthrough = [\"CC\"]\n");
+  test::writeFile(root / "groups/g.toml", "name = \"g\"\nports = [\"d\"]\n");
+  for (const char* name : {"c", "d"}) {
+    const auto dir = root / "ports" / name;
+    test::writeFile(dir / "versions.toml", "current = \"1.0\"\n");
+    test::writeFile(dir / "1.0/pkg.toml",
+                    std::string("name = \"") + name +
+                        "\"\nversion = \"1.0\"\ndeps = [" +
+                        (name[0] == 'd' ? "\"c\"" : "") +
+                        "]\n[scripts]\nbuild = \"build.sh\"\n"
+                        "install = \"install.sh\"\n");
+    test::writeFile(dir / "1.0/build.sh", "#!/bin/sh\ntrue\n", true);
+  }
+  test::writeFile(root / "ports/c/1.0/install.sh",
+                  "#!/bin/sh\n"
+                  "mkdir -p \"$PKG_STORE_DIR/bin\"\n"
+                  "echo c > \"$PKG_STORE_DIR/bin/c\"\n"
+                  "echo \"${PKG_TEST_LEAK:-unset}\" > \"$PKG_STORE_DIR/leak\"\n"
+                  "[ ! -e \"$PKG_ROOT/fail-c\" ]\n",
+                  true);
+  test::writeFile(root / "ports/d/1.0/install.sh",
+                  "#!/bin/sh\nmkdir -p \"$PKG_STORE_DIR\"\n"
+                  "echo d > \"$PKG_STORE_DIR/out\"\n",
+                  true);
+}
+
+int run(std::vector<std::string> args) {
+  std::vector<char*> argv;
+  for (auto& a : args) {
+    argv.push_back(a.data());
+  }
+  return Commands::run(static_cast<int>(argv.size()), argv.data());
+}
+
+int build(const std::filesystem::path& root, bool keep_going = false) {
+  std::vector<std::string> args = {"pkg", "build", "--group", "g",
+                                   "--root", root.string()};
+  if (keep_going) {
+    args.push_back("--keep-going");
+  }
+  return run(std::move(args));
+}
+
+std::string statuses(const std::filesystem::path& root) {
+  auto lock = LockfileStore::load(root, Config{});
+  if (!lock.ok()) {
+    return lock.status().message();
+  }
+  std::string out;
+  for (const auto& e : lock.value().entries) {
+    out += e.name + "=" + e.status + " ";
+  }
+  return out;
+}
+
+bool storeHas(const std::filesystem::path& root, const std::string& suffix) {
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(root / "store", ec)) {
+    const auto name = entry.path().filename().string();
+    if (name.size() >= suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+PKG_TEST(store, failed_build_is_not_reused) {
+  test::TempDir root;
+  writeTree(root.path());
+  test::writeFile(root.path() / "fail-c", "");
+
+  CHECK_EQ(build(root.path(), /*keep_going=*/true), 1);
+  CHECK_EQ(statuses(root.path()), std::string("c=failed d=skipped "));
+  // The partial output c's install left behind is gone.
+  CHECK(!storeHas(root.path(), "-c-1.0"));
+
+  std::filesystem::remove(root.path() / "fail-c");
+  CHECK_EQ(build(root.path()), 0);
+  CHECK_EQ(statuses(root.path()), std::string("c=built d=built "));
+
+  CHECK_EQ(build(root.path()), 0);
+  CHECK_EQ(statuses(root.path()), std::string("c=reused d=reused "));
+}
+
+PKG_TEST(store, passthrough_environment_is_hashed_and_scoped) {
+  test::TempDir root;
+  writeTree(root.path());
+  ::unsetenv("CC");
+  ::setenv("PKG_TEST_LEAK", "leaked", 1);
+  CHECK_EQ(build(root.path()), 0);
+  CHECK_EQ(statuses(root.path()), std::string("c=built d=built "));
+
+  // Variables outside build.env_passthrough never reach the scripts.
+  auto lock = LockfileStore::load(root.path(), Config{});
+  REQUIRE_OK(lock);
+  CHECK_EQ(test::readFile(root.path() / lock.value().entries[0].store / "leak"),
+           std::string("unset\n"));
+
+  // A different compiler is a different derivation for every port.
+  ::setenv("CC", "some-other-cc", 1);
+  CHECK_EQ(build(root.path()), 0);
+  CHECK_EQ(statuses(root.path()), std::string("c=built d=built "));
+  ::unsetenv("CC");
+  ::unsetenv("PKG_TEST_LEAK");
+  CHECK_EQ(build(root.path()), 0);
+  CHECK_EQ(statuses(root.path()), std::string("c=reused d=reused "));
+}
+
+PKG_TEST(store, refuses_passthrough_of_pkg_variables) {
+  test::TempDir root;
+  writeTree(root.path());
+  test::writeFile(root.path() / "fail-c", "");
+  CHECK_EQ(build(root.path(), /*keep_going=*/true), 1);
+  std::filesystem::remove(root.path() / "fail-c");
+
+  // Neither a fresh build nor a resume hands scripts a second, conflicting
+  // copy of a variable pkg sets itself.
+  for (const char* name : {"MAKEFLAGS", "PKG_STORE_DIR"}) {
+    test::writeFile(root.path() / "pkg.toml",
+                    std::string("[build]\nenv_passthrough = [\"") + name +
+                        "\"]\n");
+    CHECK_EQ(build(root.path()), 1);
+    CHECK_EQ(run({"pkg", "build", "--resume", "--root", root.path().string()}),
+             1);
+  }
+  CHECK_EQ(statuses(root.path()), std::string("c=failed d=skipped "));
+}
+
+PKG_TEST(store, store_dir_is_part_of_the_drv) {
+  // Outputs embed $PKG_STORE_DIR, so the same tree under another root must
+  // not share derivations with this one.
+  test::TempDir a;
+  test::TempDir b;
+  writeTree(a.path());
+  writeTree(b.path());
+  CHECK_EQ(build(a.path()), 0);
+  CHECK_EQ(build(b.path()), 0);
+  auto lock_a = LockfileStore::load(a.path(), Config{});
+  auto lock_b = LockfileStore::load(b.path(), Config{});
+  REQUIRE_OK(lock_a);
+  REQUIRE_OK(lock_b);
+  REQUIRE(lock_a.value().entries.size() == lock_b.value().entries.size());
+  for (std::size_t i = 0; i < lock_a.value().entries.size(); ++i) {
+    CHECK(lock_a.value().entries[i].drv != lock_b.value().entries[i].drv);
+  }
+}
+
+}  // namespace
+}  // namespace pkg
@@ -0,0 +1,78 @@
+#include <string>
+
+#include "pkg/config.hpp"
+#include "pkg/derivation.hpp"
+#include "pkg/lockfile.hpp"
+#include "pkg/substituter.hpp"
+#include "test.hpp"
+
+namespace pkg {
+namespace {
+
+LockEntry entry() {
+  LockEntry e;
+  e.name = "c";
+  e.version = "1.0";
+  e.drv = std::string(64, 'c');
+  return e;
+}
+
+PKG_TEST(substituter, round_trips_a_store_dir) {
+  test::TempDir dir;
+  const auto built = dir.path() / "built";
+  test::writeFile(built / "bin/tool", "#!/bin/sh\n", true);
+  test::writeFile(built / "share/doc", "docs");
+  const auto log = dir.path() / "log";
+
+  const DirectorySubstituter cache(dir.path() / "cache", "env-1");
+  CHECK(!cache.has(entry()));
+  CHECK(cache.fetch(entry(), dir.path() / "out", log).status().code() ==
+        StatusCode::kNotFound);
+  REQUIRE_OK(cache.push(entry(), built, log));
+  CHECK(cache.has(entry()));
+
+  const auto out = dir.path() / "store/out";
+  auto fetched = cache.fetch(entry(), out, log);
+  REQUIRE_OK(fetched);
+  CHECK(fetched.value().bytes > 0);
+  CHECK_EQ(test::readFile(out / "bin/tool"), std::string("#!/bin/sh\n"));
+  CHECK_EQ(test::readFile(out / "share/doc"), std::string("docs"));
+  CHECK(std::filesystem::status(out / "bin/tool").permissions() ==
+        std::filesystem::status(built / "bin/tool").permissions());
+}
+
+PKG_TEST(substituter, refuses_other_environments) {
+  test::TempDir dir;
+  const auto built = dir.path() / "built";
+  test::writeFile(built / "f", "x");
+  const auto log = dir.path() / "log";
+  REQUIRE_OK(DirectorySubstituter(dir.path() / "cache", "env-1")
+                 .push(entry(), built, log));
+
+  const DirectorySubstituter other(dir.path() / "cache", "env-2");
+  CHECK(!other.has(entry()));
+  CHECK(!other.fetch(entry(), dir.path() / "out", log).ok());
+  CHECK(!std::filesystem::exists(dir.path() / "out"));
+}
+
+PKG_TEST(substituter, refuses_corrupt_archives) {
+  test::TempDir dir;
+  const auto built = dir.path() / "built";
+  test::writeFile(built / "f", std::string(4096, 'x'));
+  const auto log = dir.path() / "log";
+  const auto cache_dir = dir.path() / "cache";
+  const DirectorySubstituter cache(cache_dir, "env-1");
+  REQUIRE_OK(cache.push(entry(), built, log));
+  for (const auto& file : std::filesystem::directory_iterator(cache_dir)) {
+    if (file.path().extension() == ".gz") {
+      std::string data = test::readFile(file.path());
+      data[data.size() / 2] ^= 0x55;
+      test::writeFile(file.path(), data);
+    }
+  }
+  CHECK(!cache.fetch(entry(), dir.path() / "out", log).ok());
+  CHECK(!std::filesystem::exists(dir.path() / "out"));
+}
+
+}  // namespace
+}  // namespace pkg
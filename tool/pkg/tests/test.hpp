@@ -0,0 +1,107 @@
+#pragma once
+
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pkg/result.hpp"
+
+// Minimal test harness. Cases register themselves at static init time and
+// pkg_tests runs those whose name starts with its first argument, so each
+// suite is one ctest entry. A failed CHECK marks the case failed and goes
+// on; a failed REQUIRE also returns from the case.
+namespace pkg::test {
+
+using CaseFn = void (*)();
+
+struct Case {
+  std::string name;
+  CaseFn fn;
+};
+
+std::vector<Case>& registry();
+
+struct Registrar {
+  Registrar(const char* name, CaseFn fn) { registry().push_back({name, fn}); }
+};
+
+void fail(const char* file, int line, const std::string& what);
+
+inline const Status& statusOf(const Status& s) { return s; }
+template <typename T>
+const Status& statusOf(const Result<T>& r) {
+  return r.status();
+}
+
+template <typename A, typename B>
+std::string describeMismatch(const char* a_expr, const char* b_expr,
+                             const A& a, const B& b) {
+  std::ostringstream out;
+  out << a_expr << " == " << b_expr << " (" << a << " vs " << b << ")";
+  return out.str();
+}
+
+// A fresh directory under the system temp dir, removed with the object.
+class TempDir {
+ public:
+  TempDir();
+  ~TempDir();
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  const std::filesystem::path& path() const noexcept { return path_; }
+
+ private:
+  std::filesystem::path path_;
+};
+
+void writeFile(const std::filesystem::path& path, std::string_view contents,
+               bool executable = false);
+std::string readFile(const std::filesystem::path& path);
+
+}  // namespace pkg::test
+
+#define PKG_TEST(suite, name)                                             \
+  static void suite##_##name();                                           \
+  static const ::pkg::test::Registrar suite##_##name##_registrar(         \
+      #suite "." #name, &suite##_##name);                                 \
+  static void suite##_##name()
+
+#define CHECK(cond)                                     \
+  do {                                                  \
+    if (!(cond)) {                                      \
+      ::pkg::test::fail(__FILE__, __LINE__, #cond);     \
+    }                                                   \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                    \
+  do {                                                                    \
+    const auto& check_a_ = (a);                                           \
+    const auto& check_b_ = (b);                                           \
+    if (!(check_a_ == check_b_)) {                                        \
+      ::pkg::test::fail(__FILE__, __LINE__,                               \
+                        ::pkg::test::describeMismatch(#a, #b, check_a_,   \
+                                                      check_b_));         \
+    }                                                                     \
+  } while (0)
+
+#define REQUIRE(cond)                                   \
+  do {                                                  \
+    if (!(cond)) {                                      \
+      ::pkg::test::fail(__FILE__, __LINE__, #cond);     \
+      return;                                           \
+    }                                                   \
+  } while (0)
+
+#define REQUIRE_OK(expr)                                                  \
+  do {                                                                    \
+    const ::pkg::Status require_s_ = ::pkg::test::statusOf(expr);        \
+    if (!require_s_.ok()) {                                               \
+      ::pkg::test::fail(__FILE__, __LINE__,                               \
+                        std::string(#expr) + ": " + require_s_.message()); \
+      return;                                                             \
+    }                                                                     \
+  } while (0)